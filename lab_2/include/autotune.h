@@ -0,0 +1,64 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdbool.h>
+
+#include "thread_pool.h"
+#include "median_kernels.h"
+#include "median_lib.h"
+
+// Параметры, которые перебирает автонастройка (остальные берутся из
+// начальной конфигурации как есть)
+typedef enum {
+    TUNE_ALGORITHM = 1 << 0,
+    TUNE_SIMD = 1 << 1,
+    TUNE_THREADS = 1 << 2,
+    TUNE_FUSION = 1 << 3,   // глубина слияния итераций
+    TUNE_TILE = 1 << 4,
+    TUNE_ALL = (1 << 5) - 1
+} autotune_flags_t;
+
+// Конфигурация фильтра для хоста и входа
+typedef struct {
+    filter_params_t params; // алгоритм, набор инструкций, глубина слияния, плитка
+    int num_threads;
+    double time_ms;         // время итераций на образце (0 - не замерялось)
+} autotune_config_t;
+
+// Ключ записи профиля: процессор, класс размера, окно, ранг и тип значений
+typedef struct {
+    char cpu[128];
+    int size_class;         // большая сторона матрицы, округленная вверх до степени двойки
+    int window_size;
+    int percentile;
+    median_element_t type;
+} autotune_key_t;
+
+// Функция для ключа профиля матрицы width x height на этом процессоре
+void autotune_make_key(autotune_key_t *key, int width, int height, int window_size, int percentile,
+                       median_element_t type);
+
+// Функция для пути файла профиля по умолчанию: $MEDIAN_PROFILE или
+// ~/.median_filter_profile
+const char* autotune_profile_path(void);
+
+// Функция для поиска записи key в профиле path (false - файла или
+// записи нет)
+bool autotune_load(const char *path, const autotune_key_t *key, autotune_config_t *config);
+
+// Функция для сохранения записи key в профиль path (прежняя запись с тем
+// же ключом заменяется, файл подменяется целиком через переименование)
+bool autotune_save(const char *path, const autotune_key_t *key, const autotune_config_t *config);
+
+// Пикселей образца автонастройки
+#define AUTOTUNE_SAMPLE_PIXELS (1 << 19)
+
+// Функция для автонастройки на образце матрицы input (центральная часть
+// не больше AUTOTUNE_SAMPLE_PIXELS пикселей) со значениями типа type:
+// параметры tune перебираются по очереди (алгоритм и набор инструкций,
+// слияние и плитка, потоки), каждый кандидат замеряется лучшим из
+// нескольких запусков. config - начальная конфигурация и результат
+bool autotune_run(const matrix_t *input, median_element_t type, int k_iters, pool_placement_t placement,
+                  unsigned tune, autotune_config_t *config);
+
+#endif
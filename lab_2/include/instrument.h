@@ -0,0 +1,53 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdbool.h>
+
+#include "thread_pool.h"
+
+// Фазы работы программы
+typedef enum {
+    PHASE_READ,
+    PHASE_FILTER,
+    PHASE_WRITE,
+    PHASE_COUNT
+} instrument_phase_t;
+
+// Аппаратные счетчики perf_event_open
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_COUNT
+} instrument_counter_t;
+
+// Функция для получения времени CLOCK_MONOTONIC в наносекундах
+unsigned long long instrument_now_ns(void);
+
+// Функция для включения инструментирования: таймеры фаз и потоков пула
+// (pool может быть NULL), с counters - еще и аппаратные счетчики каждого
+// потока (если ядро их не дает, остаются только таймеры)
+bool instrument_start(thread_pool_t *pool, bool counters);
+
+// Функция для проверки, включено ли инструментирование
+bool instrument_active(void);
+
+// Функция для начала фазы (вызывает главный поток, фазы не вкладываются)
+void instrument_phase_begin(instrument_phase_t phase);
+
+// Функция для завершения текущей фазы
+void instrument_phase_end(void);
+
+// Функция для учета работы потока thread_id: строк (отрезков строк
+// плиток) и пикселей (-1 - главный поток; каждый поток пишет только
+// в свою ячейку)
+void instrument_add_work(int thread_id, long long rows, long long pixels);
+
+// Функция для учета ожидания потоком готовой работы внутри задачи пула
+void instrument_add_wait(int thread_id, unsigned long long ns);
+
+// Функция для вывода отчета по фазам и потокам, с оценкой дисбаланса
+// нагрузки, и выключения инструментирования
+void instrument_report(void);
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef MEDIAN_KERNELS_H
+#define MEDIAN_KERNELS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+
+// Структура для матрицы: одно выровненное выделение памяти, строки идут
+// с шагом stride, вокруг данных рамка из halo ячеек со значением MATRIX_PAD
+typedef struct {
+    int *data;      // элемент (0, 0)
+    int *buffer;    // начало выделенной памяти
+    int width;
+    int height;
+    int stride;     // шаг между строками в элементах
+    int halo;
+    void *mapping;  // отображенный файл (buffer == NULL) или NULL
+    size_t mapping_size;
+} matrix_t;
+
+// Выравнивание строк (кэш-линия) и значение рамки: рамка больше любого
+// значения матрицы, поэтому в отсортированном окне она всегда в конце
+#define MATRIX_ALIGNMENT 64
+#define MATRIX_PAD INT_MAX
+
+#define MATRIX_ROW(m, y) ((m)->data + (ptrdiff_t)(y) * (m)->stride)
+
+// Плоскость одного канала компактного типа (8 или 16 бит без знака) без
+// рамки: граничные пиксели считаются с обрезанным окном
+typedef struct {
+    void *data;
+    int width;
+    int height;
+    int stride;         // шаг между строками в элементах
+    int element_size;   // 1 (uint8) или 2 (uint16) байта
+} compact_plane_t;
+
+// Размер огромной страницы (x86-64): большие матрицы по запросу
+// выравниваются по нему и выделяются на огромных страницах
+#define HUGE_PAGE_SIZE (2 << 20)
+
+// Рабочая память потока для ядер фильтра: один выровненный по кэш-линии
+// блок. Выделяется заранее по размеру окна и ширине матрицы, ядра берут
+// из него буферы на вызов и возвращают их, так что в цикле фильтра нет
+// обращений к malloc
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;    // занято буферами текущего вызова ядра
+} scratch_arena_t;
+
+// Наибольшее число буферов, которое ядро берет из рабочей памяти
+#define SCRATCH_BUFFERS 5
+
+// Алгоритмы вычисления ранга окна
+typedef enum {
+    ALGO_AUTO,      // выбор по размеру окна и рангу
+    ALGO_SORT,      // эталонный: сортировка всех w*w значений окна
+    ALGO_HISTOGRAM, // гистограммы столбцов (Perreault-Hebert), O(1) по размеру окна
+    ALGO_NETWORK,   // сети сравнения-обмена для медианы окон 3x3, 5x5 и 7x7
+    ALGO_VAN_HERK,  // минимум и максимум (van Herk/Gil-Werman), O(1) по размеру окна
+    ALGO_BITPLANE   // выбор уровня по битовым плоскостям, 64 пикселя на слово
+} filter_algorithm_t;
+
+// Наборы векторных инструкций для сетей сравнения-обмена
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_COUNT,
+    SIMD_AUTO = SIMD_COUNT  // определить по процессору
+} simd_level_t;
+
+// Уровни яркости для гистограммного алгоритма: значения матрицы
+// заменяются номерами уровней, медиана ищется среди номеров
+typedef struct {
+    int *values;    // отсортированные различные значения (NULL для плотного диапазона)
+    int min_value;  // для плотного диапазона уровень = значение - min_value
+    int count;
+} value_levels_t;
+
+// Процентиль медианы, минимума и максимума окна
+#define RANK_MEDIAN 50
+#define RANK_MIN 0
+#define RANK_MAX 100
+
+// Параметры фильтра
+typedef struct {
+    int window_size;
+    int percentile; // ранг окна в процентах: 0 - минимум, 50 - медиана, 100 - максимум
+    filter_algorithm_t algorithm;
+    simd_level_t simd;
+    int levels;     // число уровней яркости для гистограммного алгоритма
+    int fuse_depth; // итераций подряд внутри одной плитки (1 - без блокирования)
+    int tile_size;  // сторона плитки для временного блокирования
+    bool skip_clean; // не пересчитывать плитки, соседство которых не изменилось,
+                     // и остановиться, когда проход ничего не меняет
+    bool in_place;   // писать результат в ту же матрицу (без второй матрицы)
+} filter_params_t;
+
+// Гистограммы: мелкие корзины сгруппированы по HIST_FINE_BINS в крупные
+#define HIST_FINE_SHIFT 4
+#define HIST_FINE_BINS (1 << HIST_FINE_SHIFT)
+#define HIST_MAX_LEVELS 4096
+
+static inline int imin(int a, int b) { return a < b ? a : b; }
+static inline int imax(int a, int b) { return a > b ? a : b; }
+
+// Номер значения с заданным процентилем среди count отсортированных
+// (округление вверх: для четного count медиана - верхняя из двух средних)
+static inline int rank_index(int count, int percentile) {
+    return (percentile * (count - 1) + 50) / 100;
+}
+
+// Функция для выделения больших матриц на прозрачных огромных страницах
+// (действует на матрицы, выделенные после вызова)
+void matrix_use_huge_pages(bool enabled);
+
+// Функция для заполнения рамки матрицы значением MATRIX_PAD
+void fill_matrix_halo(matrix_t *matrix);
+
+// Функция для выделения матрицы с рамкой из halo ячеек без записи в нее:
+// страницы памяти достанутся узлу NUMA потока, который первым их заполнит
+matrix_t* allocate_matrix(int width, int height, int halo);
+
+// Функция для создания матрицы с рамкой из halo ячеек
+matrix_t* create_matrix(int width, int height, int halo);
+
+// Функция для изменения размеров матрицы в пределах выделенной памяти
+// (буферы плиток переиспользуются для плиток разного размера)
+void resize_matrix(matrix_t *matrix, int width, int height);
+
+// Функция для освобождения матрицы
+void free_matrix(matrix_t *matrix);
+
+// Функция для копирования матрицы (с новой рамкой)
+matrix_t* copy_matrix(const matrix_t *src, int halo);
+
+// Функция для подготовки рабочей памяти не меньше size байт (память
+// прежнего размера переиспользуется)
+bool scratch_reserve(scratch_arena_t *arena, size_t size);
+
+// Функция для освобождения рабочей памяти
+void scratch_free(scratch_arena_t *arena);
+
+// Функция для выделения буфера из рабочей памяти, выровненного по кэш-линии
+// (NULL, если места нет или arena NULL). Ядро возвращает буферы, восстанавливая
+// запомненное значение used
+void* scratch_alloc(scratch_arena_t *arena, size_t bytes);
+
+// Функция для размера рабочей памяти потока, которому достаются
+// прямоугольники не шире cols столбцов матриц шириной до width
+// (для гистограмм params->levels должно быть уже известно)
+size_t filter_scratch_size(const filter_params_t *params, int width, int cols);
+
+// Функция для применения рангового фильтра (процентиль percentile) к одной точке.
+// Окно обрезается краями матрицы: собираются и сортируются только значения
+// внутри нее, рамка не читается. window - буфер на w*w значений
+int apply_median_filter(const matrix_t *matrix, int x, int y, int window_size, int percentile, int *window);
+
+// Функция для одной итерации рангового фильтра (без граничных пикселей):
+// пиксели [start_col, end_col) строк [start_row, end_row). Буфер окна
+// берется из scratch (без места в ней - из кучи на весь вызов)
+bool apply_median_filter_iteration(const matrix_t *src, matrix_t *dst, int window_size, int percentile,
+                                   scratch_arena_t *scratch, int start_row, int end_row,
+                                   int start_col, int end_col);
+
+// Функция для построения уровней яркости матрицы
+bool build_value_levels(const matrix_t *matrix, value_levels_t *levels);
+
+// Функция для замены значений матрицы номерами уровней
+void matrix_to_levels(matrix_t *matrix, const value_levels_t *levels);
+
+// Функция для обратной замены номеров уровней значениями
+void matrix_from_levels(matrix_t *matrix, const value_levels_t *levels);
+
+// Функция для одной итерации гистограммным алгоритмом (Perreault-Hebert).
+// Для каждого столбца хранится гистограмма его 2r+1 строк, она обновляется
+// при сдвиге вниз одним удалением и одним добавлением. Гистограмма окна
+// сдвигается вправо вычитанием и добавлением гистограмм столбцов: крупные
+// корзины обновляются сразу, мелкие - лениво, только для корзины медианы.
+// Значения матрицы должны быть номерами уровней из [0, levels). Граничные
+// пиксели тоже считаются: ячейки рамки (она не меньше радиуса окна) идут
+// в корзину выше любого уровня, а ранг берется среди значений в матрице
+bool apply_median_filter_iteration_histogram(const matrix_t *src, matrix_t *dst, int window_size,
+                                             int percentile, int levels, scratch_arena_t *scratch,
+                                             int start_row, int end_row, int start_col, int end_col);
+
+// Функция для одной итерации по битовым плоскостям: номер уровня
+// выбирается от старшего бита к младшему, бит равен 1, если значений окна
+// меньше уровня с этим битом не больше ранга. Биты 64 соседних пикселей
+// лежат в одном слове, счетчики окна ведутся срезами логическими
+// операциями без сравнений. При немногих уровнях (двоичное изображение)
+// плоскости пороговые (значение больше p), и счетчик окна раздельный:
+// столбцы скользят по строкам, строка складывается удвоением. Граничные
+// пиксели тоже считаются: ячейки за краем больше любого уровня, ранг
+// берется среди попавших в окно. Значения матрицы должны быть номерами
+// уровней из [0, levels)
+bool apply_median_filter_iteration_bitplane(const matrix_t *src, matrix_t *dst, int window_size,
+                                            int percentile, int levels, scratch_arena_t *scratch,
+                                            int start_row, int end_row, int start_col, int end_col);
+
+// Функция для проверки, идет ли алгоритм в номерах уровней яркости
+static inline bool uses_levels(filter_algorithm_t algorithm) {
+    return algorithm == ALGO_HISTOGRAM || algorithm == ALGO_BITPLANE;
+}
+
+// Функция для определения лучшего набора инструкций процессора
+simd_level_t detect_simd_level(void);
+
+// Функция для одной итерации сетями сравнения-обмена
+bool apply_median_filter_iteration_network(const matrix_t *src, matrix_t *dst, int window_size,
+                                           simd_level_t simd, scratch_arena_t *scratch, int start_row,
+                                           int end_row, int start_col, int end_col);
+
+// Функция для размера рабочей памяти потока для компактных плоскостей
+// шириной до width
+size_t compact_scratch_size(int window_size, int width, int element_size);
+
+// Функция для одной итерации медианы окна 3, 5 или 7 над строками
+// [start_row, end_row) компактной плоскости сетями сравнения-обмена
+// (ядра для uint8 и uint16 отдельные, вместе с граничными пикселями)
+bool apply_median_filter_compact(const compact_plane_t *src, compact_plane_t *dst, int window_size,
+                                 simd_level_t simd, scratch_arena_t *scratch, int start_row, int end_row);
+
+// Функция для одной итерации фильтра минимума (maximum - максимума) методом
+// van Herk/Gil-Werman. Фильтр раздельный: сначала по строкам, затем по
+// столбцам. Ряд делится на блоки длины окна, в каждом блоке считаются
+// минимумы от начала блока и от конца; окно покрывает не больше двух
+// блоков, и его минимум - одно сравнение двух готовых значений. Всего
+// три сравнения на пиксель в каждом направлении при любом размере окна.
+// Граничные пиксели тоже считаются: окно обрезается краями матрицы
+bool apply_min_max_filter_iteration(const matrix_t *src, matrix_t *dst, int window_size, bool maximum,
+                                    scratch_arena_t *scratch, int start_row, int end_row,
+                                    int start_col, int end_col);
+
+// Функция для граничных пикселей прямоугольника [start_row, end_row) x
+// [start_col, end_col): окно обрезается краями матрицы, значение ранга
+// выбирается среди попавших в него значений за линейное в среднем время
+bool apply_median_filter_border(const matrix_t *src, matrix_t *dst, int window_size, int percentile,
+                                scratch_arena_t *scratch, int start_row, int end_row,
+                                int start_col, int end_col);
+
+// Функция для выбора алгоритма по размеру окна и процентилю
+filter_algorithm_t select_algorithm(filter_algorithm_t algorithm, int window_size, int percentile);
+
+// Функция для обработки прямоугольника [start_row, end_row) x [start_col, end_col)
+// выбранным алгоритмом; буферы ядер берутся из scratch (false - не хватило памяти)
+bool filter_rect(const matrix_t *src, matrix_t *dst, const filter_params_t *params,
+                 scratch_arena_t *scratch, int start_row, int end_row, int start_col, int end_col);
+
+// Функция для обработки полосы строк выбранным алгоритмом
+bool filter_rows(const matrix_t *src, matrix_t *dst, const filter_params_t *params,
+                 scratch_arena_t *scratch, int start_row, int end_row);
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef MEDIAN_LIB_H
+#define MEDIAN_LIB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "thread_pool.h"
+#include "median_kernels.h"
+
+// Типы элементов буферов вызывающей стороны
+typedef enum {
+    MEDIAN_INT32,
+    MEDIAN_UINT8,
+    MEDIAN_UINT16,
+    MEDIAN_ELEMENT_COUNT
+} median_element_t;
+
+// Изображение вызывающей стороны: height строк по width пикселей из
+// channels каналов. Значения каналов пикселя идут подряд (channel_stride 0)
+// или каждый канал лежит своей плоскостью через channel_stride байт
+typedef struct {
+    void *data;
+    int width;
+    int height;
+    int channels;
+    size_t stride;          // байт между началами строк
+    size_t channel_stride;  // байт между плоскостями каналов (0 - каналы чередуются)
+    median_element_t type;
+} median_image_t;
+
+// Контекст фильтра: пул потоков и рабочие матрицы, которые живут между
+// вызовами (повторный вызов с матрицей не больше прежней память не выделяет)
+typedef struct median_context median_context_t;
+
+// Функция для создания контекста с num_threads потоками (1 - без пула)
+// и размещением потоков placement (NULL при ошибке)
+median_context_t* median_context_create(int num_threads, pool_placement_t placement);
+
+// Функция для получения пула потоков контекста (NULL для одного потока)
+thread_pool_t* median_context_pool(const median_context_t *ctx);
+
+// Функция для освобождения контекста
+void median_context_destroy(median_context_t *ctx);
+
+// Функция для параметров фильтра по умолчанию: медиана окна window_size,
+// алгоритм, набор инструкций и плитка выбираются автоматически
+filter_params_t median_default_params(int window_size);
+
+// Функция для замены автоматических параметров (ALGO_AUTO, SIMD_AUTO,
+// tile_size 0) конкретными значениями для этого процессора
+filter_params_t median_resolve_params(const filter_params_t *params);
+
+// Функция для k_iters итераций фильтра над матрицей input. Результат
+// лежит в рабочей матрице контекста и действует до следующего вызова
+// (NULL при ошибке; с params->in_place рабочая матрица одна). converged
+// (может быть NULL) получает число итераций, после которого матрица
+// перестала меняться, или -1
+const matrix_t* median_context_filter(median_context_t *ctx, const matrix_t *input, int k_iters,
+                                      const filter_params_t *params, int *converged);
+
+// Функция для k_iters итераций фильтра на месте в матрице matrix: вместо
+// второй матрицы у каждого потока кольцо исходных строк и буфер порции
+// (слияние итераций и пропуск плиток не применяются)
+bool median_context_filter_in_place(median_context_t *ctx, matrix_t *matrix, int k_iters,
+                                    const filter_params_t *params);
+
+// Прямоугольник [y, y + height) x [x, x + width) матрицы
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} median_rect_t;
+
+// Область интереса: объединение прямоугольников и ненулевых пикселей
+// маски той же формы, что и матрица (mask может быть NULL)
+typedef struct {
+    const median_rect_t *rects;
+    int rect_count;
+    const matrix_t *mask;
+} median_region_t;
+
+// Функция для k_iters итераций фильтра только в области region матрицы
+// matrix: пиксели области получают те же значения, что и при фильтре всей
+// матрицы, остальные не меняются. Считаются только плитки области и их
+// окрестность в k_iters * r пикселей, так что время растет с площадью
+// области, а не матрицы (слияние, пропуск плиток и фильтр на месте здесь
+// не применяются)
+bool median_context_filter_region(median_context_t *ctx, matrix_t *matrix, int k_iters,
+                                  const filter_params_t *params, const median_region_t *region);
+
+// Функция для фильтрации буфера вызывающей стороны: src и dst - строки
+// height x width элементов type с шагом src_stride и dst_stride байт
+// (dst может совпадать с src). Буфер int32 читается на месте, без
+// промежуточных копий и файлов; с params->in_place фильтр идет прямо в dst.
+// uint8 и uint16 фильтруются как одноканальное изображение
+bool median_filter_buffer(median_context_t *ctx, const void *src, size_t src_stride, void *dst,
+                          size_t dst_stride, int width, int height, median_element_t type, int k_iters,
+                          const filter_params_t *params, int *converged);
+
+// Функция для фильтрации изображения src в dst той же формы и типа (может
+// совпадать с src): каждый канал фильтруется отдельно. Медиана окна 3, 5
+// и 7 для uint8 и uint16 считается ядрами этих типов над плоскостью канала
+// без расширения до int (в 4 и 2 раза больше полос вектора); остальные
+// случаи идут через матрицу int канала
+bool median_filter_image(median_context_t *ctx, const median_image_t *src, const median_image_t *dst,
+                         int k_iters, const filter_params_t *params);
+
+// Функция для чтения матрицы из файла (.bin - двоичный формат, иначе текст;
+// текст разбирается потоками пула, pool может быть NULL)
+matrix_t* read_matrix(const char *filename, thread_pool_t *pool);
+
+// Функция для чтения размеров матрицы из заголовка файла (значения не
+// читаются)
+bool read_matrix_size(const char *filename, int *width, int *height);
+
+// Функция для записи матрицы в файл (.bin - двоичный формат, иначе текст);
+// файл заменяется целиком через переименование <filename>.tmp
+bool write_matrix(const char *filename, const matrix_t *matrix, thread_pool_t *pool);
+
+// Функция для выбора стороны плитки: два буфера плитки вместе с ореолом
+// должны занимать не больше половины кэша L2
+int default_tile_size(int window_size, int fuse_depth);
+
+// Функция для потоковой фильтрации файла input в файл output (матрица
+// целиком в память не загружается; pool может быть NULL)
+bool median_filter_stream(const char *input, const char *output, int k_iters,
+                          thread_pool_t *pool, const filter_params_t *filter);
+
+// Функция пакетной обработки: list - файл списка пар "вход выход"
+// (NULL - текстовые кадры из input_fd в output_fd). Фильтр идет на
+// пуле контекста, чтение и запись - в своих потоках. false - хотя бы
+// один кадр не обработан
+bool median_filter_batch(const char *list, int input_fd, int output_fd, int k_iters,
+                         median_context_t *ctx, const filter_params_t *filter);
+
+// Функция для замера времени в миллисекундах (монотонные часы с точностью
+// до микросекунд: малые матрицы считаются быстрее миллисекунды)
+double get_time_ms(void);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef TEXT_IO_H
+#define TEXT_IO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "thread_pool.h"
+
+// Текстовая матрица, отображенная в память: "rows cols" и значения
+// через пробельные символы (обычно по строке матрицы на строку файла)
+typedef struct {
+    const char *text;   // содержимое файла
+    size_t size;
+    size_t body;        // смещение первого значения после заголовка
+    int rows;
+    int cols;
+} text_matrix_t;
+
+// Функция для открытия текстового файла матрицы и чтения заголовка
+bool text_matrix_open(const char *filename, text_matrix_t *text);
+
+// Функция для разбора значений в data (строки с шагом stride элементов).
+// Файл делится по переводам строк на части по числу потоков пула
+// (pool может быть NULL - разбор в вызывающем потоке)
+bool text_matrix_parse(const text_matrix_t *text, int *data, int stride, thread_pool_t *pool);
+
+// Функция для закрытия отображения файла
+void text_matrix_close(text_matrix_t *text);
+
+// Функция для записи матрицы в текстовый файл: потоки форматируют свои
+// полосы строк в большие буферы и пишут их по своим смещениям в файле
+bool text_matrix_write(const char *filename, const int *data, int rows, int cols, int stride,
+                       thread_pool_t *pool);
+
+// Функция для последовательного чтения строки из cols значений,
+// начиная с позиции *pos (потоковый режим); *pos сдвигается за строку
+bool text_matrix_read_row(const text_matrix_t *text, size_t *pos, int *row);
+
+// Потоковая запись текстовой матрицы по строкам через большой буфер
+typedef struct text_writer text_writer_t;
+
+// Функция для создания файла и записи заголовка "rows cols"
+text_writer_t* text_writer_open(const char *filename, int rows, int cols);
+
+// Функция для записи очередной строки матрицы
+bool text_writer_row(text_writer_t *writer, const int *row);
+
+// Функция для начала записи матрицы в уже открытый дескриптор fd (канал,
+// stdout): запись идет подряд, дескриптор остается открытым
+text_writer_t* text_writer_fd(int fd, int rows, int cols);
+
+// Функция для сброса буфера и закрытия файла
+bool text_writer_close(text_writer_t *writer);
+
+// Поток текстовых матриц (кадров) из дескриптора без перемотки, например
+// stdin: кадры "rows cols" и значения идут друг за другом
+typedef struct text_stream text_stream_t;
+
+// Функция для создания потока кадров из дескриптора fd
+text_stream_t* text_stream_open(int fd);
+
+// Функция для чтения заголовка следующего кадра; в конце потока
+// возвращает false с *end = true
+bool text_stream_header(text_stream_t *stream, int *rows, int *cols, bool *end);
+
+// Функция для чтения значений кадра: rows строк по cols значений в data
+// (строки с шагом stride элементов)
+bool text_stream_read(text_stream_t *stream, int *data, int rows, int cols, int stride);
+
+// Функция для закрытия потока (дескриптор не закрывается)
+void text_stream_close(text_stream_t *stream);
+
+#endif
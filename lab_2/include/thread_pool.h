@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+
+// Задача пула: выполняется каждым рабочим потоком со своим номером
+typedef void (*thread_pool_task_t)(void *arg, int thread_id);
+
+// Пул долгоживущих рабочих потоков
+typedef struct thread_pool thread_pool_t;
+
+// Размещение рабочих потоков по ядрам
+typedef enum {
+    POOL_PLACE_NONE,     // без привязки, потоки распределяет ОС
+    POOL_PLACE_COMPACT,  // подряд по ядрам, узел NUMA за узлом
+    POOL_PLACE_SCATTER,  // по очереди на каждый узел NUMA
+    POOL_PLACE_COUNT
+} pool_placement_t;
+
+// Функция для создания пула из num_threads потоков (NULL при ошибке)
+thread_pool_t* thread_pool_create(int num_threads);
+
+// Функция для запуска task(arg, thread_id) на всех потоках пула
+// с ожиданием завершения (потоки между запусками не пересоздаются)
+void thread_pool_run(thread_pool_t *pool, thread_pool_task_t task, void *arg);
+
+// Функция для получения числа потоков пула
+int thread_pool_size(const thread_pool_t *pool);
+
+// Функция для привязки каждого потока пула к своему ядру по топологии
+// из /sys/devices/system/node (false, если привязать не удалось)
+bool thread_pool_place(thread_pool_t *pool, pool_placement_t placement);
+
+// Функция для вывода узлов NUMA и ядер, к которым привязаны потоки
+void thread_pool_print_layout(const thread_pool_t *pool);
+
+// Функция для включения учета времени потоков в задачах (учет обнуляется)
+void thread_pool_set_timing(thread_pool_t *pool, bool enabled);
+
+// Функция для чтения учета в наносекундах: время потока thread_id
+// в задачах, а для thread_id == thread_pool_size(pool) - время ожидания
+// главного потока в thread_pool_run. Читать между запусками
+unsigned long long thread_pool_busy_ns(const thread_pool_t *pool, int thread_id);
+
+// Функция для остановки потоков и освобождения пула
+void thread_pool_destroy(thread_pool_t *pool);
+
+#endif
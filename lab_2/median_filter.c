@@ -7,9 +7,15 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include "include/thread_pool.h"
+#include "include/text_io.h"
+
 // Ограничение на максимальный размер окна
 #define MAX_WINDOW_SIZE 25
 
+// Размер кэш-линии для буферов окна потоков
+#define CACHE_LINE 64
+
 typedef struct {
     const int *matrix;
     int *result;
@@ -18,16 +24,17 @@ typedef struct {
     int window_size;
     int start_row;
     int end_row;
+    int *values;    // буфер окна потока, выделяется один раз на все итерации
 } ThreadArgs;
 
 void generate_matrix(int *matrix, int rows, int cols);
 void median_filter_seq(int *matrix, int rows, int cols, int window_size, int k);
 void *median_filter_worker(void *arg);
-int median_filter_par(int *matrix, int rows, int cols, int window_size, int k, int num_threads);
+int median_filter_par(int *matrix, int rows, int cols, int window_size, int k, thread_pool_t *pool);
 int parse_int(const char *str, int *out);
 double get_time_ms(void);
-int read_matrix_from_file(const char *filename, int **matrix, int *rows, int *cols);
-int write_matrix_to_file(const char *filename, const int *matrix, int rows, int cols);
+int read_matrix_from_file(const char *filename, int **matrix, int *rows, int *cols, thread_pool_t *pool);
+int write_matrix_to_file(const char *filename, const int *matrix, int rows, int cols, thread_pool_t *pool);
 
 void sort_array(int *arr, int n) {
     for (int i = 0; i < n - 1; ++i) {
@@ -41,11 +48,17 @@ void sort_array(int *arr, int n) {
     }
 }
 
-int apply_median_filter(const int *matrix, int rows, int cols, int r, int c, int w) {
-    int size = w * w;
-    int *values = malloc(size * sizeof(int));
-    if (!values) return matrix[r * cols + c];
+// Буфер окна выровнен по кэш-линии и дополнен до целых линий,
+// чтобы буферы соседних потоков не делили одну линию
+int *alloc_window_buffer(int w) {
+    size_t bytes = (size_t)w * (size_t)w * sizeof(int);
+    bytes = (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, CACHE_LINE, bytes) != 0) return NULL;
+    return buffer;
+}
 
+int apply_median_filter(const int *matrix, int rows, int cols, int r, int c, int w, int *values) {
     int count = 0;
     int half = w / 2;
 
@@ -60,26 +73,29 @@ int apply_median_filter(const int *matrix, int rows, int cols, int r, int c, int
     }
 
     sort_array(values, count);
-    int result = values[count / 2];
-    free(values);
-    return result;
+    return values[count / 2];
 }
 
 void median_filter_seq(int *matrix, int rows, int cols, int window_size, int k) {
     int *temp = malloc((size_t)rows * (size_t)cols * sizeof(int));
-    if (!temp) return;
+    int *values = alloc_window_buffer(window_size);
+    if (!temp || !values) {
+        free(temp); free(values);
+        return;
+    }
 
     memcpy(temp, matrix, (size_t)rows * (size_t)cols * sizeof(int));
 
     for (int iter = 0; iter < k; ++iter) {
         for (int r = 0; r < rows; ++r) {
             for (int c = 0; c < cols; ++c) {
-                matrix[r * cols + c] = apply_median_filter(temp, rows, cols, r, c, window_size);
+                matrix[r * cols + c] = apply_median_filter(temp, rows, cols, r, c, window_size, values);
             }
         }
         memcpy(temp, matrix, (size_t)rows * (size_t)cols * sizeof(int));
     }
     free(temp);
+    free(values);
 }
 
 void *median_filter_worker(void *arg) {
@@ -87,58 +103,71 @@ void *median_filter_worker(void *arg) {
     for (int r = args->start_row; r < args->end_row; ++r) {
         for (int c = 0; c < args->cols; ++c) {
             args->result[r * args->cols + c] =
-                apply_median_filter(args->matrix, args->rows, args->cols, r, c, args->window_size);
+                apply_median_filter(args->matrix, args->rows, args->cols, r, c, args->window_size, args->values);
         }
     }
     return NULL;
 }
 
-int median_filter_par(int *matrix, int rows, int cols, int window_size, int k, int num_threads) {
+// Задача пула: поток обрабатывает свою полосу строк
+static void median_filter_task(void *arg, int thread_id) {
+    median_filter_worker((ThreadArgs *)arg + thread_id);
+}
+
+// Потоки пула живут все k итераций, буферы меняются местами без копирования
+int median_filter_par(int *matrix, int rows, int cols, int window_size, int k, thread_pool_t *pool) {
+    int num_threads = thread_pool_size(pool);
     int *temp = malloc((size_t)rows * (size_t)cols * sizeof(int));
-    int *result = malloc((size_t)rows * (size_t)cols * sizeof(int));
-    pthread_t *threads = malloc((size_t)num_threads * sizeof(pthread_t));
-    ThreadArgs *targs = malloc((size_t)num_threads * sizeof(ThreadArgs));
+    ThreadArgs *targs = calloc((size_t)num_threads, sizeof(ThreadArgs));
 
-    if (!temp || !result || !threads || !targs) {
-        free(temp); free(result); free(threads); free(targs);
+    if (!temp || !targs) {
+        free(temp); free(targs);
         return -1;
     }
+    for (int t = 0; t < num_threads; ++t) {
+        targs[t].values = alloc_window_buffer(window_size);
+        if (!targs[t].values) {
+            for (int i = 0; i < t; ++i) free(targs[i].values);
+            free(temp); free(targs);
+            return -1;
+        }
+    }
 
-    memcpy(temp, matrix, (size_t)rows * (size_t)cols * sizeof(int));
-    for (int iter = 0; iter < k; ++iter) {
-        int rows_per_thread = rows / num_threads;
-        int extra_rows = rows % num_threads;
-
-        for (int t = 0; t < num_threads; ++t) {
-            targs[t] = (ThreadArgs){
-                .matrix = temp,
-                .result = result,
-                .rows = rows,
-                .cols = cols,
-                .window_size = window_size,
-                .start_row = t * rows_per_thread,
-                .end_row = (t + 1) * rows_per_thread
-            };
-            if (t == num_threads - 1) {
-                targs[t].end_row += extra_rows;
-            }
-            int ret = pthread_create(&threads[t], NULL, median_filter_worker, &targs[t]);
-            if (ret != 0) {
-                free(temp); free(result); free(threads); free(targs);
-                return ret;
-            }
+    int rows_per_thread = rows / num_threads;
+    int extra_rows = rows % num_threads;
+    for (int t = 0; t < num_threads; ++t) {
+        targs[t] = (ThreadArgs){
+            .rows = rows,
+            .cols = cols,
+            .window_size = window_size,
+            .start_row = t * rows_per_thread,
+            .end_row = (t + 1) * rows_per_thread,
+            .values = targs[t].values
+        };
+        if (t == num_threads - 1) {
+            targs[t].end_row += extra_rows;
         }
+    }
 
+    int *src = matrix;
+    int *dst = temp;
+    for (int iter = 0; iter < k; ++iter) {
         for (int t = 0; t < num_threads; ++t) {
-            pthread_join(threads[t], NULL);
+            targs[t].matrix = src;
+            targs[t].result = dst;
         }
-        memcpy(temp, result, (size_t)rows * (size_t)cols * sizeof(int));
+        thread_pool_run(pool, median_filter_task, targs);
+
+        int *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != matrix) {
+        memcpy(matrix, src, (size_t)rows * (size_t)cols * sizeof(int));
     }
-    memcpy(matrix, temp, (size_t)rows * (size_t)cols * sizeof(int));
 
+    for (int t = 0; t < num_threads; ++t) free(targs[t].values);
     free(temp);
-    free(result);
-    free(threads);
     free(targs);
     return 0;
 }
@@ -175,50 +204,30 @@ double get_time_ms(void) {
     return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
 }
 
-// Чтение матрицы из файла
-int read_matrix_from_file(const char *filename, int **matrix, int *rows, int *cols) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        const char msg[] = "Error: Cannot open input file\n";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        return -1;
-    }
-
-    // Read dimensions
-    if (fscanf(file, "%d %d", rows, cols) != 2) {
-        const char msg[] = "Error: Invalid file format (dimensions)\n";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        fclose(file);
+// Чтение матрицы из файла (разбор идет параллельно на потоках пула)
+int read_matrix_from_file(const char *filename, int **matrix, int *rows, int *cols, thread_pool_t *pool) {
+    text_matrix_t text;
+    if (!text_matrix_open(filename, &text)) {
         return -1;
     }
 
-    if (*rows <= 0 || *cols <= 0) {
-        const char msg[] = "Error: Matrix dimensions must be positive\n";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        fclose(file);
-        return -1;
-    }
+    *rows = text.rows;
+    *cols = text.cols;
 
     // Allocate memory
     *matrix = malloc((size_t)(*rows) * (size_t)(*cols) * sizeof(int));
     if (!*matrix) {
         const char msg[] = "Error: Memory allocation failed\n";
         write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        fclose(file);
+        text_matrix_close(&text);
         return -1;
     }
 
     // Read matrix data
-    int idx = 0;
-    while (idx < (*rows) * (*cols) && fscanf(file, "%d", &(*matrix)[idx]) == 1) {
-        idx++;
-    }
-
-    fclose(file);
+    bool ok = text_matrix_parse(&text, *matrix, *cols, pool);
+    text_matrix_close(&text);
 
-    if (idx != (*rows) * (*cols)) {
-        const char msg[] = "Error: Incomplete matrix data\n";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    if (!ok) {
         free(*matrix);
         *matrix = NULL;
         return -1;
@@ -227,66 +236,9 @@ int read_matrix_from_file(const char *filename, int **matrix, int *rows, int *co
     return 0;
 }
 
-
-int write_matrix_to_file(const char *filename, const int *matrix, int rows, int cols) {
-    int file = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (file == -1) {
-        const char msg[] = "Error: Cannot create output file '";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        write(STDERR_FILENO, filename, strlen(filename));
-        const char end[] = "'\n";
-        write(STDERR_FILENO, end, sizeof(end) - 1);
-        return -1;
-    }
-
-    // Формируем первую строку: "rows cols\n"
-    char header[64];
-    int len = snprintf(header, sizeof(header), "%d %d\n", rows, cols);
-    if (len < 0 || len >= (int)sizeof(header)) {
-        const char msg[] = "Error: Header too long\n";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        close(file);
-        return -1;
-    }
-    if (write(file, header, len) != len) {
-        const char msg[] = "Error: Failed to write header\n";
-        write(STDERR_FILENO, msg, sizeof(msg) - 1);
-        close(file);
-        return -1;
-    }
-
-    // Записываем элементы матрицы построчно
-    for (int i = 0; i < rows; ++i) {
-        char line[1024] = {0};
-        int pos = 0;
-        for (int j = 0; j < cols; ++j) {
-            int val = matrix[i * cols + j];
-            char num[16];
-            int nlen = snprintf(num, sizeof(num), "%d", val);
-            if (nlen < 0 || nlen >= (int)sizeof(num)) {
-                const char msg[] = "Error: Number too long\n";
-                write(STDERR_FILENO, msg, sizeof(msg) - 1);
-                close(file);
-                return -1;
-            }
-            // Добавляем пробел, если не последний элемент
-            if (j < cols - 1) {
-                num[nlen++] = ' ';
-            }
-            memcpy(line + pos, num, nlen);
-            pos += nlen;
-        }
-        line[pos++] = '\n';
-        if (write(file, line, pos) != pos) {
-            const char msg[] = "Error: Failed to write row\n";
-            write(STDERR_FILENO, msg, sizeof(msg) - 1);
-            close(file);
-            return -1;
-        }
-    }
-
-    close(file);
-    return 0;
+// Запись матрицы в файл: потоки пула форматируют свои полосы строк
+int write_matrix_to_file(const char *filename, const int *matrix, int rows, int cols, thread_pool_t *pool) {
+    return text_matrix_write(filename, matrix, rows, cols, cols, pool) ? 0 : -1;
 }
 
 int main(int argc, char **argv) {
@@ -337,9 +289,16 @@ int main(int argc, char **argv) {
 
     int *matrix = NULL;
 
+    // Пул потоков для чтения, фильтра и записи
+    thread_pool_t *pool = thread_pool_create(num_threads);
+    if (!pool) {
+        return 1;
+    }
+
     // Чтение матрицы из файла или генерация случайной
     if (input_file) {
-        if (read_matrix_from_file(input_file, &matrix, &rows, &cols) != 0) {
+        if (read_matrix_from_file(input_file, &matrix, &rows, &cols, pool) != 0) {
+            thread_pool_destroy(pool);
             return 1;
         }
     } else {
@@ -347,6 +306,7 @@ int main(int argc, char **argv) {
         if (!matrix) {
             const char msg[] = "Error: Memory allocation failed for matrix\n";
             write(STDERR_FILENO, msg, sizeof(msg) - 1);
+            thread_pool_destroy(pool);
             return 1;
         }
         generate_matrix(matrix, rows, cols);
@@ -355,11 +315,12 @@ int main(int argc, char **argv) {
     double start_time = get_time_ms();
 
     // Применение фильтра
-    int result = median_filter_par(matrix, rows, cols, window_size, k, num_threads);
+    int result = median_filter_par(matrix, rows, cols, window_size, k, pool);
     if (result != 0) {
         const char msg[] = "Error: Median filter failed\n";
         write(STDERR_FILENO, msg, sizeof(msg) - 1);
         free(matrix);
+        thread_pool_destroy(pool);
         return 1;
     }
 
@@ -368,11 +329,13 @@ int main(int argc, char **argv) {
 
     // Запись результата в файл
     if (output_file) {
-        if (write_matrix_to_file(output_file, matrix, rows, cols) != 0) {
+        if (write_matrix_to_file(output_file, matrix, rows, cols, pool) != 0) {
             free(matrix);
+            thread_pool_destroy(pool);
             return 1;
         }
     }
+    thread_pool_destroy(pool);
 
     // Вывод метрик через write
     char time_msg[128];
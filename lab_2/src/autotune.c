@@ -0,0 +1,383 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/median_kernels.h"
+#include "../include/median_lib.h"
+#include "../include/autotune.h"
+
+// Запусков каждого кандидата после прогревочного (берется лучший)
+#define AUTOTUNE_RUNS 3
+
+// Итераций на запуск образца: хватает, чтобы слияние итераций сработало
+#define AUTOTUNE_MAX_ITERS 4
+
+// Кандидат заменяет лучшую конфигурацию, только если быстрее на эту
+// долю: при равенстве остается более простая, замеренная раньше
+#define AUTOTUNE_MARGIN 0.03
+
+// Первая строка файла профиля (версия формата и поля записей)
+#define AUTOTUNE_PROFILE_HEADER \
+    "# median_filter profile v1: cpu, size, window, percentile, type, algorithm, simd, threads, fuse, tile, ms"
+
+// Размеры элементов типов (в порядке median_element_t)
+static const size_t element_sizes[] = { sizeof(int32_t), sizeof(uint8_t), sizeof(uint16_t) };
+
+// Состояние автонастройки: образец входа (матрица int и для компактных
+// типов исходный и рабочий буферы, исходный между запусками не меняется)
+// и лучшая замеренная конфигурация
+typedef struct {
+    matrix_t *matrix;
+    median_image_t source;
+    median_image_t work;
+    median_element_t type;
+    int iters;
+    pool_placement_t placement;
+    int trials;                 // замеренных конфигураций
+    autotune_config_t best;
+} tune_state_t;
+
+// Функция для вырезания образца из центра input и упаковки его значений
+// в тип type (значения вне диапазона типа обрезаются)
+static bool make_sample(const matrix_t *input, median_element_t type, tune_state_t *state) {
+    int width = imin(input->width, AUTOTUNE_SAMPLE_PIXELS / 64);
+    int height = imin(input->height, AUTOTUNE_SAMPLE_PIXELS / width);
+    int x0 = (input->width - width) / 2;
+    int y0 = (input->height - height) / 2;
+    
+    state->matrix = create_matrix(width, height, 0);
+    if (!state->matrix) {
+        fprintf(stderr, "Error: Memory allocation failed for %dx%d autotune sample\n", height, width);
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        memcpy(MATRIX_ROW(state->matrix, y), MATRIX_ROW(input, y0 + y) + x0, width * sizeof(int));
+    }
+    if (type == MEDIAN_INT32) return true;
+    
+    int max_value = type == MEDIAN_UINT8 ? UINT8_MAX : UINT16_MAX;
+    size_t size = element_sizes[type];
+    state->source = (median_image_t){
+        .width = width,
+        .height = height,
+        .channels = 1,
+        .stride = (size_t)width * size,
+        .type = type
+    };
+    state->work = state->source;
+    state->source.data = malloc(state->source.stride * height);
+    state->work.data = malloc(state->work.stride * height);
+    if (!state->source.data || !state->work.data) {
+        fprintf(stderr, "Error: Memory allocation failed for %dx%d autotune sample\n", height, width);
+        return false;
+    }
+    
+    for (int y = 0; y < height; y++) {
+        const int *row = MATRIX_ROW(state->matrix, y);
+        char *out = (char*)state->source.data + (size_t)y * state->source.stride;
+        for (int x = 0; x < width; x++) {
+            int value = row[x] < 0 ? 0 : row[x] > max_value ? max_value : row[x];
+            if (size == 1) ((uint8_t*)out)[x] = (uint8_t)value;
+            else ((uint16_t*)out)[x] = (uint16_t)value;
+        }
+    }
+    return true;
+}
+
+// Функция для замера конфигурации на образце: лучшее время из
+// AUTOTUNE_RUNS запусков после прогревочного (-1 при ошибке)
+static double time_config(const tune_state_t *state, const autotune_config_t *config) {
+    pool_placement_t placement = config->num_threads > 1 ? state->placement : POOL_PLACE_NONE;
+    median_context_t *ctx = median_context_create(config->num_threads, placement);
+    if (!ctx) return -1;
+    
+    double best = -1;
+    for (int run = 0; run <= AUTOTUNE_RUNS; run++) {
+        double start = get_time_ms();
+        bool ok = state->type == MEDIAN_INT32
+                  ? median_context_filter(ctx, state->matrix, state->iters, &config->params, NULL) != NULL
+                  : median_filter_image(ctx, &state->source, &state->work, state->iters, &config->params);
+        double elapsed = get_time_ms() - start;
+        if (!ok) {
+            best = -1;
+            break;
+        }
+        if (run > 0 && (best < 0 || elapsed < best)) best = elapsed;
+    }
+    median_context_destroy(ctx);
+    return best;
+}
+
+// Функция для замера кандидата: он становится лучшим, если быстрее
+// лучшего на AUTOTUNE_MARGIN (первый замеренный - всегда)
+static void try_config(tune_state_t *state, autotune_config_t candidate) {
+    candidate.time_ms = time_config(state, &candidate);
+    state->trials++;
+    if (candidate.time_ms <= 0) return;
+    if (state->best.time_ms <= 0 || candidate.time_ms < state->best.time_ms * (1 - AUTOTUNE_MARGIN)) {
+        state->best = candidate;
+    }
+}
+
+// Функция для проверки, годится ли алгоритм для окна и ранга (уровни -
+// можно ли перейти к номерам уровней яркости)
+static bool algorithm_fits(filter_algorithm_t algorithm, const filter_params_t *params, bool levels) {
+    bool min_max = params->percentile == RANK_MIN || params->percentile == RANK_MAX;
+    switch (algorithm) {
+        case ALGO_NETWORK:
+            return params->percentile == RANK_MEDIAN &&
+                   (params->window_size == 3 || params->window_size == 5 || params->window_size == 7);
+        case ALGO_VAN_HERK:
+            return min_max;
+        case ALGO_HISTOGRAM:
+        case ALGO_BITPLANE:
+            return levels;
+        default:
+            return false;
+    }
+}
+
+// Функция для перебора алгоритмов (и наборов инструкций сетей)
+static void tune_algorithm(tune_state_t *state, const matrix_t *input, unsigned tune) {
+    static const filter_algorithm_t algorithms[] = { ALGO_NETWORK, ALGO_VAN_HERK, ALGO_HISTOGRAM, ALGO_BITPLANE };
+    
+    value_levels_t levels;
+    bool few_levels = build_value_levels(input, &levels);
+    if (few_levels) free(levels.values);
+    
+    autotune_config_t base = state->best;
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++) {
+        autotune_config_t candidate = base;
+        candidate.params.algorithm = algorithms[i];
+        if (!(tune & TUNE_ALGORITHM) && algorithms[i] != base.params.algorithm) continue;
+        if (!algorithm_fits(algorithms[i], &base.params, few_levels)) continue;
+        
+        // Набор инструкций важен только сетям сравнения-обмена
+        bool simd = (tune & TUNE_SIMD) && algorithms[i] == ALGO_NETWORK;
+        int top = base.params.simd;
+        for (int level = simd ? SIMD_SCALAR : top; level <= top; level++) {
+            candidate.params.simd = (simd_level_t)level;
+            if (candidate.params.algorithm == base.params.algorithm && level == top) continue;
+            try_config(state, candidate);
+        }
+    }
+}
+
+// Функция для перебора глубины слияния итераций и стороны плитки
+static void tune_fusion(tune_state_t *state, unsigned tune) {
+    static const int tiles[] = { 64, 128, 256 };
+    autotune_config_t base = state->best;
+    
+    int first = tune & TUNE_FUSION ? 1 : base.params.fuse_depth;
+    int last = tune & TUNE_FUSION ? state->iters : base.params.fuse_depth;
+    for (int depth = first; depth <= last; depth *= 2) {
+        // Плитки нужны слиянию и пропуску неизменившихся плиток: кроме
+        // плитки по умолчанию (или заданной) пробуются плитки из tiles
+        int tile = tune & TUNE_TILE ? default_tile_size(base.params.window_size, depth) : base.params.tile_size;
+        bool tiled = (tune & TUNE_TILE) && (depth > 1 || base.params.skip_clean);
+        int count = tiled ? (int)(sizeof(tiles) / sizeof(tiles[0])) : 0;
+        
+        for (int i = -1; i < count; i++) {
+            autotune_config_t candidate = base;
+            candidate.params.fuse_depth = depth;
+            candidate.params.tile_size = i < 0 ? tile : tiles[i];
+            if (i >= 0 && tiles[i] == tile) continue;
+            if (depth == base.params.fuse_depth && candidate.params.tile_size == base.params.tile_size) continue;
+            try_config(state, candidate);
+        }
+    }
+}
+
+// Функция для перебора числа потоков: степени двойки и все ядра
+static void tune_threads(tune_state_t *state, int max_threads) {
+    autotune_config_t base = state->best;
+    for (int threads = 1;; threads = imin(threads * 2, max_threads)) {
+        if (threads != base.num_threads) {
+            autotune_config_t candidate = base;
+            candidate.num_threads = threads;
+            try_config(state, candidate);
+        }
+        if (threads >= max_threads) break;
+    }
+}
+
+bool autotune_run(const matrix_t *input, median_element_t type, int k_iters, pool_placement_t placement,
+                  unsigned tune, autotune_config_t *config) {
+    tune_state_t state = {
+        .type = type,
+        .iters = imin(k_iters, AUTOTUNE_MAX_ITERS),
+        .placement = placement
+    };
+    if (!make_sample(input, type, &state)) {
+        free_matrix(state.matrix);
+        free(state.source.data);
+        free(state.work.data);
+        return false;
+    }
+    
+    // Подбор идет с наибольшим числом потоков, если их тоже подбирать
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cpus > 0 ? (int)cpus : 1;
+    autotune_config_t start = *config;
+    start.params = median_resolve_params(&config->params);
+    if (start.params.in_place) start.params.fuse_depth = 1;
+    if (tune & TUNE_THREADS) start.num_threads = max_threads;
+    
+    double begin = get_time_ms();
+    try_config(&state, start);
+    if (tune & (TUNE_ALGORITHM | TUNE_SIMD)) tune_algorithm(&state, input, tune);
+    if ((tune & (TUNE_FUSION | TUNE_TILE)) && !start.params.in_place) tune_fusion(&state, tune);
+    if (tune & TUNE_THREADS) tune_threads(&state, max_threads);
+    
+    printf("Autotune: %d configurations on %dx%d sample, %d iterations each, %.3f ms\n", state.trials,
+           state.matrix->height, state.matrix->width, state.iters, get_time_ms() - begin);
+    free_matrix(state.matrix);
+    free(state.source.data);
+    free(state.work.data);
+    
+    if (state.best.time_ms <= 0) {
+        fprintf(stderr, "Error: No filter configuration ran on the autotune sample\n");
+        return false;
+    }
+    *config = state.best;
+    return true;
+}
+
+// ПРОФИЛЬ
+// Текстовый файл: заголовок AUTOTUNE_PROFILE_HEADER и по записи на
+// строку, поля разделены табуляцией (модель процессора идет первой
+// и может содержать пробелы)
+
+void autotune_make_key(autotune_key_t *key, int width, int height, int window_size, int percentile,
+                       median_element_t type) {
+    memset(key, 0, sizeof(*key));
+    strcpy(key->cpu, "unknown");
+    
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    char line[256];
+    while (cpuinfo && fgets(line, sizeof(line), cpuinfo)) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) != 0 || !colon) continue;
+        
+        char *name = colon + 1 + strspn(colon + 1, " \t");
+        name[strcspn(name, "\n")] = '\0';
+        for (char *c = name; *c; c++) {
+            if (*c == '\t') *c = ' ';
+        }
+        if (*name) snprintf(key->cpu, sizeof(key->cpu), "%s", name);
+        break;
+    }
+    if (cpuinfo) fclose(cpuinfo);
+    
+    int side = width > height ? width : height;
+    key->size_class = 1;
+    while (key->size_class < side && key->size_class < INT_MAX / 2) key->size_class *= 2;
+    key->window_size = window_size;
+    key->percentile = percentile;
+    key->type = type;
+}
+
+const char* autotune_profile_path(void) {
+    static char path[PATH_MAX];
+    const char *profile = getenv("MEDIAN_PROFILE");
+    if (profile && *profile) return profile;
+    
+    const char *home = getenv("HOME");
+    if (!home || !*home) return ".median_filter_profile";
+    snprintf(path, sizeof(path), "%s/.median_filter_profile", home);
+    return path;
+}
+
+// Функция для разбора записи профиля (false - строка не запись)
+static bool parse_record(char *line, autotune_key_t *key, autotune_config_t *config) {
+    char *tab = strchr(line, '\t');
+    if (line[0] == '#' || !tab || tab - line >= (long)sizeof(key->cpu)) return false;
+    
+    memset(key, 0, sizeof(*key));
+    memcpy(key->cpu, line, tab - line);
+    
+    int type, algorithm, simd;
+    *config = (autotune_config_t){ .params = median_default_params(3) };
+    filter_params_t *params = &config->params;
+    if (sscanf(tab + 1, "%d %d %d %d %d %d %d %d %d %lf", &key->size_class, &key->window_size,
+               &key->percentile, &type, &algorithm, &simd, &config->num_threads, &params->fuse_depth,
+               &params->tile_size, &config->time_ms) != 10) {
+        return false;
+    }
+    key->type = (median_element_t)type;
+    params->window_size = key->window_size;
+    params->percentile = key->percentile;
+    params->algorithm = (filter_algorithm_t)algorithm;
+    params->simd = (simd_level_t)simd;
+    
+    return type >= 0 && type < MEDIAN_ELEMENT_COUNT && algorithm > ALGO_AUTO && algorithm <= ALGO_BITPLANE &&
+           simd >= 0 && simd < SIMD_COUNT && config->num_threads > 0 && params->fuse_depth > 0 &&
+           params->tile_size > 0;
+}
+
+// Функция для сравнения ключей записей
+static bool same_key(const autotune_key_t *a, const autotune_key_t *b) {
+    return strcmp(a->cpu, b->cpu) == 0 && a->size_class == b->size_class && a->window_size == b->window_size &&
+           a->percentile == b->percentile && a->type == b->type;
+}
+
+bool autotune_load(const char *path, const autotune_key_t *key, autotune_config_t *config) {
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    
+    char line[512];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file)) {
+        autotune_key_t record;
+        autotune_config_t value;
+        if (parse_record(line, &record, &value) && same_key(&record, key)) {
+            *config = value;
+            found = true;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+bool autotune_save(const char *path, const autotune_key_t *key, const autotune_config_t *config) {
+    char temp[PATH_MAX];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+        fprintf(stderr, "Error: Profile path %s is too long\n", path);
+        return false;
+    }
+    FILE *out = fopen(temp, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot create profile %s\n", temp);
+        return false;
+    }
+    fprintf(out, "%s\n", AUTOTUNE_PROFILE_HEADER);
+    
+    // Прежние записи с другими ключами переносятся как есть
+    FILE *in = fopen(path, "r");
+    char line[512];
+    while (in && fgets(line, sizeof(line), in)) {
+        char copy[sizeof(line)];
+        autotune_key_t record;
+        autotune_config_t value;
+        memcpy(copy, line, sizeof(line));
+        if (parse_record(copy, &record, &value) && !same_key(&record, key)) fputs(line, out);
+    }
+    if (in) fclose(in);
+    
+    const filter_params_t *params = &config->params;
+    fprintf(out, "%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%.3f\n", key->cpu, key->size_class, key->window_size,
+            key->percentile, (int)key->type, (int)params->algorithm, (int)params->simd, config->num_threads,
+            params->fuse_depth, params->tile_size, config->time_ms);
+    
+    bool ok = fclose(out) == 0;
+    if (ok && rename(temp, path) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write profile %s\n", path);
+        unlink(temp);
+    }
+    return ok;
+}
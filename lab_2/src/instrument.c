@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../include/instrument.h"
+
+// Имена фаз для отчета (в порядке instrument_phase_t)
+static const char *phase_names[PHASE_COUNT] = { "read", "filter", "write" };
+
+// События perf_event_open (в порядке instrument_counter_t); промахи
+// PERF_COUNT_HW_CACHE_MISSES на x86 - промахи последнего уровня кэша
+static const uint64_t counter_configs[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES
+};
+
+// Ячейка потока: пишет только сам поток, главный читает между запусками
+// пула. Ячейки выровнены по кэш-линии, чтобы потоки не делили линию
+typedef struct {
+    _Alignas(64) long long rows;
+    long long pixels;
+    unsigned long long wait_ns;     // ожидание готовой работы внутри задач
+    int fds[COUNTER_COUNT];         // группа счетчиков (fds[0] - лидер, -1 - нет)
+    int error;                      // errno открытия группы
+} thread_slot_t;
+
+// Показатели потока за фазу (или снимок накопленных значений)
+typedef struct {
+    unsigned long long busy_ns;
+    unsigned long long wait_ns;
+    unsigned long long idle_ns;
+    long long rows;
+    long long pixels;
+    unsigned long long counters[COUNTER_COUNT];
+} thread_sample_t;
+
+// Состояние инструментирования
+static struct {
+    bool active;
+    bool counters;
+    thread_pool_t *pool;
+    int slot_count;                 // [0] - главный поток, [1 + i] - поток пула i
+    thread_slot_t *slots;
+    thread_sample_t *start;         // снимок в начале текущей фазы
+    thread_sample_t *totals;        // [phase * slot_count + slot]
+    int phase;                      // текущая фаза (-1 - вне фаз)
+    unsigned long long phase_start;
+    unsigned long long wall_ns[PHASE_COUNT];
+    int entries[PHASE_COUNT];       // сколько раз фаза начиналась
+} inst = { .phase = -1 };
+
+unsigned long long instrument_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+// Функция для закрытия группы счетчиков потока
+static void close_counter_group(thread_slot_t *slot) {
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (slot->fds[c] >= 0) close(slot->fds[c]);
+        slot->fds[c] = -1;
+    }
+}
+
+// Функция для открытия группы счетчиков вызывающего потока (только
+// пользовательский режим: так счетчики доступны без прав администратора)
+static void open_counter_group(thread_slot_t *slot) {
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counter_configs[c];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        
+        slot->fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, c ? slot->fds[0] : -1, 0);
+        if (slot->fds[c] < 0) {
+            slot->error = errno;
+            close_counter_group(slot);
+            return;
+        }
+    }
+}
+
+// Функция для чтения группы счетчиков с поправкой на мультиплексирование
+// (счетчики делят регистры с другими группами и идут не все время)
+static void read_counter_group(const thread_slot_t *slot, unsigned long long *values) {
+    uint64_t data[3 + COUNTER_COUNT];   // число, время включения и работы, значения
+    if (slot->fds[0] < 0 || read(slot->fds[0], data, sizeof(data)) != (ssize_t)sizeof(data)) {
+        memset(values, 0, COUNTER_COUNT * sizeof(unsigned long long));
+        return;
+    }
+    
+    double scale = (data[2] > 0 && data[2] < data[1]) ? (double)data[1] / (double)data[2] : 1.0;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        values[c] = (unsigned long long)((double)data[3 + c] * scale);
+    }
+}
+
+// Функция потока пула для открытия его счетчиков
+static void attach_task(void *arg, int thread_id) {
+    (void)arg;
+    open_counter_group(&inst.slots[1 + thread_id]);
+}
+
+bool instrument_start(thread_pool_t *pool, bool counters) {
+    inst.pool = pool;
+    inst.slot_count = 1 + (pool ? thread_pool_size(pool) : 0);
+    inst.slots = aligned_alloc(64, inst.slot_count * sizeof(thread_slot_t));
+    inst.start = calloc(inst.slot_count, sizeof(thread_sample_t));
+    inst.totals = calloc((size_t)PHASE_COUNT * inst.slot_count, sizeof(thread_sample_t));
+    if (!inst.slots || !inst.start || !inst.totals) {
+        fprintf(stderr, "Error: Memory allocation failed for instrumentation\n");
+        free(inst.slots);
+        free(inst.start);
+        free(inst.totals);
+        return false;
+    }
+    
+    memset(inst.slots, 0, inst.slot_count * sizeof(thread_slot_t));
+    for (int s = 0; s < inst.slot_count; s++) {
+        for (int c = 0; c < COUNTER_COUNT; c++) inst.slots[s].fds[c] = -1;
+    }
+    
+    // Счетчики открывает сам поток: они считают только его
+    if (counters) {
+        open_counter_group(&inst.slots[0]);
+        if (pool) thread_pool_run(pool, attach_task, NULL);
+        
+        int error = 0;
+        for (int s = 0; s < inst.slot_count && !error; s++) error = inst.slots[s].error;
+        if (error) {
+            fprintf(stderr, "Warning: Hardware counters unavailable (%s), using timers only\n", strerror(error));
+            for (int s = 0; s < inst.slot_count; s++) close_counter_group(&inst.slots[s]);
+            counters = false;
+        }
+    }
+    
+    inst.counters = counters;
+    if (pool) thread_pool_set_timing(pool, true);
+    inst.active = true;
+    return true;
+}
+
+bool instrument_active(void) {
+    return inst.active;
+}
+
+// Функция для снимка накопленных значений ячейки slot
+static void take_sample(int slot, thread_sample_t *sample) {
+    memset(sample, 0, sizeof(thread_sample_t));
+    sample->rows = inst.slots[slot].rows;
+    sample->pixels = inst.slots[slot].pixels;
+    sample->wait_ns = inst.slots[slot].wait_ns;
+    if (inst.pool) {
+        // Для главного потока пул учитывает ожидание в thread_pool_run
+        int id = slot == 0 ? inst.slot_count - 1 : slot - 1;
+        sample->busy_ns = thread_pool_busy_ns(inst.pool, id);
+    }
+    if (inst.counters) read_counter_group(&inst.slots[slot], sample->counters);
+}
+
+void instrument_phase_begin(instrument_phase_t phase) {
+    if (!inst.active) return;
+    
+    inst.phase = phase;
+    inst.entries[phase]++;
+    for (int s = 0; s < inst.slot_count; s++) take_sample(s, &inst.start[s]);
+    inst.phase_start = instrument_now_ns();
+}
+
+void instrument_phase_end(void) {
+    if (!inst.active || inst.phase < 0) return;
+    
+    unsigned long long wall = instrument_now_ns() - inst.phase_start;
+    inst.wall_ns[inst.phase] += wall;
+    
+    for (int s = 0; s < inst.slot_count; s++) {
+        thread_sample_t now;
+        take_sample(s, &now);
+        const thread_sample_t *start = &inst.start[s];
+        thread_sample_t *total = &inst.totals[inst.phase * inst.slot_count + s];
+        
+        unsigned long long pooled = now.busy_ns - start->busy_ns;
+        unsigned long long waited = now.wait_ns - start->wait_ns;
+        if (s == 0) {
+            // Главный поток работает все время фазы, кроме ожидания пула
+            pooled = pooled < wall ? pooled : wall;
+            total->busy_ns += wall - pooled;
+            total->wait_ns += pooled + waited;
+        } else {
+            // Поток пула: в задачах (минус ожидание работы) или простаивает
+            waited = waited < pooled ? waited : pooled;
+            total->busy_ns += pooled - waited;
+            total->wait_ns += waited;
+            total->idle_ns += wall > pooled ? wall - pooled : 0;
+        }
+        total->rows += now.rows - start->rows;
+        total->pixels += now.pixels - start->pixels;
+        for (int c = 0; c < COUNTER_COUNT; c++) total->counters[c] += now.counters[c] - start->counters[c];
+    }
+    inst.phase = -1;
+}
+
+void instrument_add_work(int thread_id, long long rows, long long pixels) {
+    if (!inst.active) return;
+    inst.slots[1 + thread_id].rows += rows;
+    inst.slots[1 + thread_id].pixels += pixels;
+}
+
+void instrument_add_wait(int thread_id, unsigned long long ns) {
+    if (inst.active) inst.slots[1 + thread_id].wait_ns += ns;
+}
+
+// Функция для вывода значений аппаратных счетчиков строки отчета
+static void print_counters(const unsigned long long *counters) {
+    double ipc = counters[COUNTER_CYCLES] ? (double)counters[COUNTER_INSTRUCTIONS] / counters[COUNTER_CYCLES] : 0.0;
+    printf(" %14llu %14llu %6.2f %12llu", counters[COUNTER_CYCLES], counters[COUNTER_INSTRUCTIONS],
+           ipc, counters[COUNTER_LLC_MISSES]);
+}
+
+void instrument_report(void) {
+    if (!inst.active) return;
+    instrument_phase_end();
+    
+    printf("Instrumentation (CLOCK_MONOTONIC, ns resolution%s):\n",
+           inst.counters ? ", user-mode counters" : "");
+    printf("%-8s %12s", "Phase", "Wall, ms");
+    if (inst.counters) printf(" %14s %14s %6s %12s", "Cycles", "Instructions", "IPC", "LLC misses");
+    printf("\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (!inst.entries[p]) continue;
+        printf("%-8s %12.3f", phase_names[p], inst.wall_ns[p] / 1e6);
+        if (inst.counters) {
+            unsigned long long sum[COUNTER_COUNT] = { 0 };
+            for (int s = 0; s < inst.slot_count; s++) {
+                for (int c = 0; c < COUNTER_COUNT; c++) sum[c] += inst.totals[p * inst.slot_count + s].counters[c];
+            }
+            print_counters(sum);
+        }
+        printf("\n");
+    }
+    
+    printf("%-8s %-8s %12s %12s %12s %10s %12s", "Thread", "Phase", "Busy, ms", "Wait, ms", "Idle, ms",
+           "Rows", "Pixels");
+    if (inst.counters) printf(" %14s %14s %6s %12s", "Cycles", "Instructions", "IPC", "LLC misses");
+    printf("\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (!inst.entries[p]) continue;
+        for (int s = 0; s < inst.slot_count; s++) {
+            const thread_sample_t *total = &inst.totals[p * inst.slot_count + s];
+            char name[16];
+            if (s == 0) snprintf(name, sizeof(name), "main");
+            else snprintf(name, sizeof(name), "%d", s - 1);
+            printf("%-8s %-8s %12.3f %12.3f %12.3f %10lld %12lld", name, phase_names[p], total->busy_ns / 1e6,
+                   total->wait_ns / 1e6, total->idle_ns / 1e6, total->rows, total->pixels);
+            if (inst.counters) print_counters(total->counters);
+            printf("\n");
+        }
+    }
+    
+    // Дисбаланс нагрузки потоков пула на фильтре: самый загруженный поток
+    // против среднего, и доля времени потоков без работы
+    if (inst.entries[PHASE_FILTER] && inst.slot_count > 2) {
+        const thread_sample_t *filter = &inst.totals[PHASE_FILTER * inst.slot_count];
+        unsigned long long max_busy = 0, sum_busy = 0, sum_lost = 0;
+        int max_thread = 0;
+        for (int s = 1; s < inst.slot_count; s++) {
+            if (filter[s].busy_ns > max_busy) {
+                max_busy = filter[s].busy_ns;
+                max_thread = s - 1;
+            }
+            sum_busy += filter[s].busy_ns;
+            sum_lost += filter[s].wait_ns + filter[s].idle_ns;
+        }
+        double mean = (double)sum_busy / (inst.slot_count - 1);
+        double total = (double)(sum_busy + sum_lost);
+        printf("Load imbalance (filter): busy max %.3f ms (thread %d), mean %.3f ms, max/mean %.2f, "
+               "waiting or idle %.1f%% of thread time\n", max_busy / 1e6, max_thread, mean / 1e6,
+               mean > 0 ? max_busy / mean : 0.0, total > 0 ? 100.0 * sum_lost / total : 0.0);
+    }
+    
+    for (int s = 0; s < inst.slot_count; s++) close_counter_group(&inst.slots[s]);
+    if (inst.pool) thread_pool_set_timing(inst.pool, false);
+    free(inst.slots);
+    free(inst.start);
+    free(inst.totals);
+    inst.active = false;
+}
@@ -0,0 +1,455 @@
+///usr/bin/cc -O2 -o /tmp/median_bench $0 && exec /tmp/median_bench "$@"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Замеры median_filter по сетке параметров: каждая точка запускается
+// отдельным процессом (fork/exec) несколько раз после прогрева, время
+// берется из строки "Execution time" (без чтения и записи файлов)
+
+#define BENCH_MAX_AXIS 32       // значений на одной оси перебора
+#define BENCH_MAX_REPEATS 1000
+#define BENCH_MAX_ARGS 64
+#define BENCH_OUTPUT_SIZE 65536 // вывод одного запуска
+
+// Значения оси перебора из опции вида "256,512,1024"
+typedef struct {
+    int values[BENCH_MAX_AXIS];
+    int count;
+} int_list_t;
+
+// Имена оси перебора из опции вида "sort,network"
+typedef struct {
+    char *names[BENCH_MAX_AXIS];
+    int count;
+} name_list_t;
+
+// Результат одной точки перебора (времена в миллисекундах)
+typedef struct {
+    int size;
+    int window;
+    int k;
+    int threads;
+    const char *kernel;   // NULL - алгоритм по умолчанию (опция -a не передается)
+    bool ok;
+    double median;
+    double p10;
+    double p90;
+    double min;
+    double max;
+    double mpix;          // мегапикселей в секунду за все k итераций
+    double efficiency;    // T(t0) * t0 / (T(t) * t), t0 - наименьшее число потоков
+} bench_point_t;
+
+// Глобальные переменные для параметров
+static const char *binary = "./median_filter";
+static int_list_t sizes = { { 256, 512, 1024 }, 3 };
+static int_list_t windows = { { 3, 5 }, 2 };
+static int_list_t iterations = { { 1 }, 1 };
+static int_list_t threads = { { 1, 2, 4 }, 3 };
+static name_list_t kernels = { { NULL }, 1 };
+static int repeats = 5;
+static int warmups = 1;
+static int max_value = 255;
+static const char *work_dir = "/tmp";
+static const char *json_file = NULL;
+static const char *csv_file = NULL;
+static char *extra_args = NULL;
+
+// Функция для разбора списка целых чисел через запятую
+static bool parse_int_list(const char *text, int_list_t *list) {
+    list->count = 0;
+    const char *p = text;
+    while (*p) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value <= 0 || list->count == BENCH_MAX_AXIS) return false;
+        list->values[list->count++] = (int)value;
+        if (*end == ',') end++;
+        else if (*end) return false;
+        p = end;
+    }
+    return list->count > 0;
+}
+
+// Функция для разбора списка имен через запятую (строка изменяется)
+static bool parse_name_list(char *text, name_list_t *list) {
+    list->count = 0;
+    for (char *name = strtok(text, ","); name; name = strtok(NULL, ",")) {
+        if (list->count == BENCH_MAX_AXIS) return false;
+        list->names[list->count++] = name;
+    }
+    return list->count > 0;
+}
+
+// Функция для создания входной матрицы size x size в текстовом формате
+static bool generate_input(const char *filename, int size, unsigned seed) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        return false;
+    }
+    
+    fprintf(file, "%d %d\n", size, size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            seed = seed * 1103515245u + 12345u;
+            fprintf(file, "%d%c", (int)((seed >> 8) % (unsigned)(max_value + 1)), x + 1 < size ? ' ' : '\n');
+        }
+    }
+    
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Cannot write file %s\n", filename);
+    return ok;
+}
+
+// Функция для одного запуска: argv выполняется в дочернем процессе,
+// из его вывода берется время фильтра в миллисекундах
+static bool run_once(char **argv, double *time_ms) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "Error: Cannot create pipe\n");
+        return false;
+    }
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error: Cannot fork\n");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(argv[0], argv);
+        fprintf(stderr, "Error: Cannot run %s\n", argv[0]);
+        _exit(127);
+    }
+    close(fds[1]);
+    
+    // Вывод сверх буфера дочитывается и отбрасывается
+    static char output[BENCH_OUTPUT_SIZE];
+    size_t length = 0;
+    char chunk[4096];
+    ssize_t got;
+    while ((got = read(fds[0], chunk, sizeof(chunk))) > 0) {
+        size_t copy = (size_t)got < sizeof(output) - 1 - length ? (size_t)got : sizeof(output) - 1 - length;
+        memcpy(output + length, chunk, copy);
+        length += copy;
+    }
+    output[length] = '\0';
+    close(fds[0]);
+    
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: %s failed\n", argv[0]);
+        return false;
+    }
+    
+    // Новая версия печатает "Execution time", старая - "Processing time"
+    const char *line = strstr(output, "Execution time:");
+    if (!line) line = strstr(output, "Processing time:");
+    if (!line || sscanf(strchr(line, ':') + 1, "%lf", time_ms) != 1) {
+        fprintf(stderr, "Error: No execution time in output of %s\n", argv[0]);
+        return false;
+    }
+    return true;
+}
+
+// Функция для сравнения времен (для qsort)
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Функция для вычисления перцентиля q (0..1) отсортированной выборки
+// с линейной интерполяцией между соседними значениями
+static double percentile(const double *sorted, int count, double q) {
+    double position = q * (count - 1);
+    int lower = (int)position;
+    if (lower + 1 >= count) return sorted[count - 1];
+    return sorted[lower] + (position - lower) * (sorted[lower + 1] - sorted[lower]);
+}
+
+// Функция для замера одной точки: warmups запусков без учета и repeats
+// учитываемых запусков
+static void bench_point(bench_point_t *point, const char *input, const char *output) {
+    char arguments[5][16];
+    char *argv[BENCH_MAX_ARGS];
+    int argc = 0;
+    argv[argc++] = (char*)binary;
+    snprintf(arguments[0], sizeof(arguments[0]), "%d", point->threads);
+    snprintf(arguments[1], sizeof(arguments[1]), "%d", point->k);
+    snprintf(arguments[2], sizeof(arguments[2]), "%d", point->window);
+    argv[argc++] = "-t";
+    argv[argc++] = arguments[0];
+    argv[argc++] = "-k";
+    argv[argc++] = arguments[1];
+    argv[argc++] = "-w";
+    argv[argc++] = arguments[2];
+    if (point->kernel) {
+        argv[argc++] = "-a";
+        argv[argc++] = (char*)point->kernel;
+    }
+    
+    // Дополнительные опции (-e "-f 4 -p scatter") передаются как есть
+    char extra[1024] = "";
+    if (extra_args) snprintf(extra, sizeof(extra), "%s", extra_args);
+    for (char *arg = strtok(extra, " "); arg && argc < BENCH_MAX_ARGS - 5; arg = strtok(NULL, " ")) {
+        argv[argc++] = arg;
+    }
+    argv[argc++] = "-i";
+    argv[argc++] = (char*)input;
+    argv[argc++] = "-o";
+    argv[argc++] = (char*)output;
+    argv[argc] = NULL;
+    
+    double times[BENCH_MAX_REPEATS];
+    point->ok = false;
+    for (int i = 0; i < warmups + repeats; i++) {
+        double time_ms;
+        if (!run_once(argv, &time_ms)) return;
+        if (i >= warmups) times[i - warmups] = time_ms;
+    }
+    
+    qsort(times, repeats, sizeof(double), compare_doubles);
+    point->ok = true;
+    point->min = times[0];
+    point->max = times[repeats - 1];
+    point->median = percentile(times, repeats, 0.5);
+    point->p10 = percentile(times, repeats, 0.1);
+    point->p90 = percentile(times, repeats, 0.9);
+    point->mpix = point->median > 0
+        ? (double)point->size * point->size * point->k / (point->median * 1e3) : 0.0;
+}
+
+// Функция для вычисления параллельной эффективности относительно точки
+// с наименьшим числом потоков при тех же остальных параметрах
+static void compute_efficiency(bench_point_t *points, int count) {
+    for (int i = 0; i < count; i++) {
+        bench_point_t *point = &points[i];
+        point->efficiency = 0.0;
+        if (!point->ok) continue;
+    
+        const bench_point_t *base = NULL;
+        for (int j = 0; j < count; j++) {
+            const bench_point_t *other = &points[j];
+            if (!other->ok || other->size != point->size || other->window != point->window ||
+                other->k != point->k || other->kernel != point->kernel) continue;
+            if (!base || other->threads < base->threads) base = other;
+        }
+        if (base && point->median > 0) {
+            point->efficiency = base->median * base->threads / (point->median * point->threads);
+        }
+    }
+}
+
+// Функция для записи результатов в CSV
+static bool write_csv(const char *filename, const bench_point_t *points, int count) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        return false;
+    }
+    
+    fprintf(file, "size,window,k,threads,kernel,ok,median_ms,p10_ms,p90_ms,min_ms,max_ms,mpix_per_s,efficiency\n");
+    for (int i = 0; i < count; i++) {
+        const bench_point_t *p = &points[i];
+        fprintf(file, "%d,%d,%d,%d,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.3f\n",
+                p->size, p->window, p->k, p->threads, p->kernel ? p->kernel : "default", p->ok,
+                p->median, p->p10, p->p90, p->min, p->max, p->mpix, p->efficiency);
+    }
+    
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Cannot write file %s\n", filename);
+    return ok;
+}
+
+// Функция для записи результатов в JSON
+static bool write_json(const char *filename, const bench_point_t *points, int count) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        return false;
+    }
+    
+    fprintf(file, "{\n  \"binary\": \"%s\",\n  \"repeats\": %d,\n  \"warmups\": %d,\n  \"points\": [\n",
+            binary, repeats, warmups);
+    for (int i = 0; i < count; i++) {
+        const bench_point_t *p = &points[i];
+        fprintf(file, "    {\"size\": %d, \"window\": %d, \"k\": %d, \"threads\": %d, \"kernel\": \"%s\", "
+                "\"ok\": %s, \"median_ms\": %.3f, \"p10_ms\": %.3f, \"p90_ms\": %.3f, \"min_ms\": %.3f, "
+                "\"max_ms\": %.3f, \"mpix_per_s\": %.2f, \"efficiency\": %.3f}%s\n",
+                p->size, p->window, p->k, p->threads, p->kernel ? p->kernel : "default",
+                p->ok ? "true" : "false", p->median, p->p10, p->p90, p->min, p->max,
+                p->mpix, p->efficiency, i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Cannot write file %s\n", filename);
+    return ok;
+}
+
+// Функция для вывода справки
+void print_usage(const char *program_name) {
+    printf("Usage: %s [-b <binary>] [-n <sizes>] [-w <windows>] [-k <iterations>] [-t <threads>] [-a <kernels>] [-j <json>] [-c <csv>]\n", program_name);
+    printf("Options (lists are comma-separated):\n");
+    printf("  -b <binary>      median_filter executable (default: ./median_filter)\n");
+    printf("  -n <sizes>       Square matrix sides (default: 256,512,1024)\n");
+    printf("  -w <windows>     Window sizes (default: 3,5)\n");
+    printf("  -k <iterations>  Iteration counts (default: 1)\n");
+    printf("  -t <threads>     Thread counts (default: 1,2,4)\n");
+    printf("  -a <kernels>     Algorithms passed as -a (default: none, binary's own choice)\n");
+    printf("  -e <options>     Extra options for every run, e.g. \"-f 4 -p scatter\"\n");
+    printf("  -r <repeats>     Measured runs per point (default: 5)\n");
+    printf("  -W <warmups>     Unmeasured runs per point (default: 1)\n");
+    printf("  -v <max_value>   Input values are random in [0, max_value] (default: 255)\n");
+    printf("  -d <dir>         Directory for generated inputs and outputs (default: /tmp)\n");
+    printf("  -j <json>        Write results as JSON\n");
+    printf("  -c <csv>         Write results as CSV\n");
+}
+
+// Функция для парсинга аргументов командной строки
+bool parse_arguments(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "b:n:w:k:t:a:e:r:W:v:d:j:c:")) != -1) {
+        switch (opt) {
+            case 'b':
+                binary = optarg;
+                break;
+            case 'n':
+            case 'w':
+            case 'k':
+            case 't': {
+                int_list_t *list = opt == 'n' ? &sizes : opt == 'w' ? &windows : opt == 'k' ? &iterations : &threads;
+                if (!parse_int_list(optarg, list)) {
+                    fprintf(stderr, "Error: Invalid list '%s' for -%c\n", optarg, opt);
+                    return false;
+                }
+                break;
+            }
+            case 'a':
+                if (!parse_name_list(optarg, &kernels)) {
+                    fprintf(stderr, "Error: Invalid list '%s' for -a\n", optarg);
+                    return false;
+                }
+                break;
+            case 'e':
+                extra_args = optarg;
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                if (repeats <= 0 || repeats > BENCH_MAX_REPEATS) {
+                    fprintf(stderr, "Error: Repeats must be in 1..%d\n", BENCH_MAX_REPEATS);
+                    return false;
+                }
+                break;
+            case 'W':
+                warmups = atoi(optarg);
+                if (warmups < 0) {
+                    fprintf(stderr, "Error: Warm-up count must be non-negative\n");
+                    return false;
+                }
+                break;
+            case 'v':
+                max_value = atoi(optarg);
+                if (max_value < 0) {
+                    fprintf(stderr, "Error: Maximum value must be non-negative\n");
+                    return false;
+                }
+                break;
+            case 'd':
+                work_dir = optarg;
+                break;
+            case 'j':
+                json_file = optarg;
+                break;
+            case 'c':
+                csv_file = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!parse_arguments(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    int total = sizes.count * windows.count * iterations.count * threads.count * kernels.count;
+    bench_point_t *points = calloc(total, sizeof(bench_point_t));
+    if (!points) {
+        fprintf(stderr, "Error: Memory allocation failed for results\n");
+        return 1;
+    }
+    
+    char input[4096], output[4096], profile[4096];
+    snprintf(output, sizeof(output), "%s/median_bench_%d_out.txt", work_dir, (int)getpid());
+    
+    // Профиль хоста (--autotune) подменял бы заданные точкой параметры:
+    // запуски получают путь к несуществующему профилю
+    snprintf(profile, sizeof(profile), "%s/median_bench_%d_no_profile", work_dir, (int)getpid());
+    setenv("MEDIAN_PROFILE", profile, 1);
+    printf("%6s %6s %4s %7s %-10s %10s %10s %10s %10s %10s\n",
+           "size", "window", "k", "threads", "kernel", "median_ms", "p10_ms", "p90_ms", "Mpix/s", "speedup");
+    
+    int count = 0;
+    bool failed = false;
+    for (int s = 0; s < sizes.count; s++) {
+        // Один вход на размер: все точки размера считают одни и те же данные
+        snprintf(input, sizeof(input), "%s/median_bench_%d_%d.txt", work_dir, (int)getpid(), sizes.values[s]);
+        if (!generate_input(input, sizes.values[s], (unsigned)sizes.values[s])) {
+            free(points);
+            return 1;
+        }
+    
+        for (int w = 0; w < windows.count; w++) {
+            for (int k = 0; k < iterations.count; k++) {
+                for (int a = 0; a < kernels.count; a++) {
+                    for (int t = 0; t < threads.count; t++) {
+                        bench_point_t *point = &points[count++];
+                        point->size = sizes.values[s];
+                        point->window = windows.values[w];
+                        point->k = iterations.values[k];
+                        point->threads = threads.values[t];
+                        point->kernel = kernels.names[a];
+                        bench_point(point, input, output);
+                        failed |= !point->ok;
+    
+                        // Ускорение относительно первого числа потоков в списке
+                        const bench_point_t *base = point - t;
+                        printf("%6d %6d %4d %7d %-10s %10.3f %10.3f %10.3f %10.2f %10.2f\n",
+                               point->size, point->window, point->k, point->threads,
+                               point->kernel ? point->kernel : "default", point->median,
+                               point->p10, point->p90, point->mpix,
+                               point->ok && base->ok && point->median > 0 ? base->median / point->median : 0.0);
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+        unlink(input);
+    }
+    unlink(output);
+    
+    compute_efficiency(points, count);
+    if (csv_file && !write_csv(csv_file, points, count)) failed = true;
+    if (json_file && !write_json(json_file, points, count)) failed = true;
+    
+    free(points);
+    return failed ? 1 : 0;
+}
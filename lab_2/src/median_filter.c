@@ -1,399 +1,671 @@
-///usr/bin/cc -o /tmp/median_filter -pthread $0 && exec /tmp/median_filter "$@"
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/time.h>
-#include <pthread.h>
-
-//   
-typedef struct {
-    int **data;
-    int width;
-    int height;
-} matrix_t;
-
-//   
-typedef struct {
-    int thread_id;
-    int total_threads;
-    matrix_t *src_matrix;
-    matrix_t *dst_matrix;
-    int window_size;
-    int k_iters;
-    pthread_barrier_t *barrier;
-} thread_args_t;
-
-//    
-static int num_threads = 1;
-static int k_iters = 1;
-static int window_size = 3;
-static char *input_file = NULL;
-static char *output_file = NULL;
-
-//    
-matrix_t* create_matrix(int width, int height) {
-    matrix_t *matrix = malloc(sizeof(matrix_t));
-    matrix->width = width;
-    matrix->height = height;
-    
-    matrix->data = malloc(height * sizeof(int*));
-    for (int i = 0; i < height; i++) {
-        matrix->data[i] = malloc(width * sizeof(int));
-    }
-    
-    return matrix;
-}
-
-//    
-void free_matrix(matrix_t *matrix) {
-    if (!matrix) return;
-    
-    for (int i = 0; i < matrix->height; i++) {
-        free(matrix->data[i]);
-    }
-    free(matrix->data);
-    free(matrix);
-}
-
-//    
-matrix_t* copy_matrix(const matrix_t *src) {
-    matrix_t *dst = create_matrix(src->width, src->height);
-    
-    for (int y = 0; y < src->height; y++) {
-        for (int x = 0; x < src->width; x++) {
-            dst->data[y][x] = src->data[y][x];
-        }
-    }
-    
-    return dst;
-}
-
-//      
-matrix_t* read_matrix(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file %s\n", filename);
-        return NULL;
-    }
-    
-    int width, height;
-    if (fscanf(file, "%d %d", &height, &width) != 2) {
-        fprintf(stderr, "Error: Invalid file format\n");
-        fclose(file);
-        return NULL;
-    }
-    
-    matrix_t *matrix = create_matrix(width, height);
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            if (fscanf(file, "%d", &matrix->data[y][x]) != 1) {
-                fprintf(stderr, "Error: Invalid data at position (%d, %d)\n", y, x);
-                fclose(file);
-                free_matrix(matrix);
-                return NULL;
-            }
-        }
-    }
-    
-    fclose(file);
-    return matrix;
-}
-
-//      
-bool write_matrix(const char *filename, const matrix_t *matrix) {
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot create file %s\n", filename);
-        return false;
-    }
-    
-    fprintf(file, "%d %d\n", matrix->height, matrix->width);
-    
-    for (int y = 0; y < matrix->height; y++) {
-        for (int x = 0; x < matrix->width; x++) {
-            fprintf(file, "%d", matrix->data[y][x]);
-            if (x < matrix->width - 1) fprintf(file, " ");
-        }
-        fprintf(file, "\n");
-    }
-    
-    fclose(file);
-    return true;
-}
-
-//        
-int apply_median_filter(const matrix_t *matrix, int x, int y, int window_size) {
-    int radius = window_size / 2;
-    int window[window_size * window_size];
-    int count = 0;
-    
-    //    
-    for (int dy = -radius; dy <= radius; dy++) {
-        for (int dx = -radius; dx <= radius; dx++) {
-            int ny = y + dy;
-            int nx = x + dx;
-            
-            if (ny >= 0 && ny < matrix->height && nx >= 0 && nx < matrix->width) {
-                window[count++] = matrix->data[ny][nx];
-            }
-        }
-    }
-    
-    //   ( )
-    for (int i = 0; i < count - 1; i++) {
-        for (int j = 0; j < count - i - 1; j++) {
-            if (window[j] > window[j + 1]) {
-                int temp = window[j];
-                window[j] = window[j + 1];
-                window[j + 1] = temp;
-            }
-        }
-    }
-    
-    //  
-    return window[count / 2];
-}
-
-//       (  )
-void apply_median_filter_iteration(const matrix_t *src, matrix_t *dst, int window_size, 
-                                  int start_row, int end_row) {
-    int radius = window_size / 2;
-    
-    for (int y = start_row; y < end_row; y++) {
-        for (int x = radius; x < src->width - radius; x++) {
-            dst->data[y][x] = apply_median_filter(src, x, y, window_size);
-        }
-    }
-}
-
-//  
-matrix_t* median_filter_sequential(matrix_t *input, int window_size, int k_iters) {
-    matrix_t *current = copy_matrix(input);
-    matrix_t *next = create_matrix(input->width, input->height);
-    
-    int radius = window_size / 2;
-    
-    for (int iter = 0; iter < k_iters; iter++) {
-        apply_median_filter_iteration(current, next, window_size, radius, current->height - radius);
-        
-        //      
-        matrix_t *temp = current;
-        current = next;
-        next = temp;
-    }
-    
-    free_matrix(next);
-    return current;
-}
-
-//      
-static void* worker_thread(void *_args) {
-    thread_args_t *args = (thread_args_t*)_args;
-    int radius = args->window_size / 2;
-    
-    //    
-    int rows_per_thread = args->src_matrix->height / args->total_threads;
-    int start_row = args->thread_id * rows_per_thread;
-    int end_row = (args->thread_id == args->total_threads - 1) ? 
-                  args->src_matrix->height : start_row + rows_per_thread;
-    
-    //   
-    start_row = (start_row < radius) ? radius : start_row;
-    end_row = (end_row > args->src_matrix->height - radius) ? 
-              args->src_matrix->height - radius : end_row;
-    
-    matrix_t *current = args->src_matrix;
-    matrix_t *next = args->dst_matrix;
-    
-    for (int iter = 0; iter < args->k_iters; iter++) {
-        //   
-        apply_median_filter_iteration(current, next, args->window_size, start_row, end_row);
-        
-        //   
-        pthread_barrier_wait(args->barrier);
-        
-        //    ,  
-        pthread_barrier_wait(args->barrier);
-    }
-    
-    return NULL;
-}
-
-//  
-matrix_t* median_filter_parallel(matrix_t *input, int window_size, int k_iters, int num_threads) {
-    matrix_t *current = copy_matrix(input);
-    matrix_t *next = create_matrix(input->width, input->height);
-    
-    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
-    thread_args_t *args = malloc(num_threads * sizeof(thread_args_t));
-    pthread_barrier_t barrier;
-    
-    //  
-    pthread_barrier_init(&barrier, NULL, num_threads);
-    
-    //   
-    for (int i = 0; i < num_threads; i++) {
-        args[i] = (thread_args_t){
-            .thread_id = i,
-            .total_threads = num_threads,
-            .src_matrix = current,
-            .dst_matrix = next,
-            .window_size = window_size,
-            .k_iters = k_iters,
-            .barrier = &barrier
-        };
-        
-        pthread_create(&threads[i], NULL, worker_thread, &args[i]);
-    }
-    
-    //    
-    for (int iter = 0; iter < k_iters; iter++) {
-        //     
-        pthread_barrier_wait(&barrier);
-        
-        //   
-        matrix_t *temp = current;
-        current = next;
-        next = temp;
-        
-        //       
-        for (int i = 0; i < num_threads; i++) {
-            args[i].src_matrix = current;
-            args[i].dst_matrix = next;
-        }
-        
-        //     
-        pthread_barrier_wait(&barrier);
-    }
-    
-    //    
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL);
-    }
-    
-    pthread_barrier_destroy(&barrier);
-    free(args);
-    free(threads);
-    free_matrix(next);
-    
-    return current;
-}
-
-//      
-long long get_time_ms() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
-}
-
-//    
-void print_usage(const char *program_name) {
-    printf("Usage: %s -t <threads> -k <iterations> -w <window_size> -i <input> -o <output>\n", program_name);
-    printf("Options:\n");
-    printf("  -t <threads>     Number of threads (default: 1)\n");
-    printf("  -k <iterations>  Number of filter iterations (default: 1)\n");
-    printf("  -w <window_size> Filter window size (default: 3)\n");
-    printf("  -i <input>       Input file with matrix\n");
-    printf("  -o <output>      Output file for result\n");
-}
-
-//      
-bool parse_arguments(int argc, char **argv) {
-    int opt;
-    while ((opt = getopt(argc, argv, "t:k:w:i:o:")) != -1) {
-        switch (opt) {
-            case 't':
-                num_threads = atoi(optarg);
-                if (num_threads <= 0) {
-                    fprintf(stderr, "Error: Number of threads must be positive\n");
-                    return false;
-                }
-                break;
-            case 'k':
-                k_iters = atoi(optarg);
-                if (k_iters <= 0) {
-                    fprintf(stderr, "Error: Number of iterations must be positive\n");
-                    return false;
-                }
-                break;
-            case 'w':
-                window_size = atoi(optarg);
-                if (window_size <= 0 || window_size % 2 == 0) {
-                    fprintf(stderr, "Error: Window size must be positive and odd\n");
-                    return false;
-                }
-                break;
-            case 'i':
-                input_file = optarg;
-                break;
-            case 'o':
-                output_file = optarg;
-                break;
-            default:
-                return false;
-        }
-    }
-    
-    if (!input_file || !output_file) {
-        fprintf(stderr, "Error: Input and output files are required\n");
-        return false;
-    }
-    
-    return true;
-}
-
-int main(int argc, char **argv) {
-    if (!parse_arguments(argc, argv)) {
-        print_usage(argv[0]);
-        return 1;
-    }
-    
-    //   
-    matrix_t *input = read_matrix(input_file);
-    if (!input) {
-        return 1;
-    }
-    
-    printf("Matrix: %dx%d, Threads: %d, Iterations: %d, Window: %dx%d\n",
-           input->height, input->width, num_threads, k_iters, window_size, window_size);
-    
-    matrix_t *result;
-    long long start_time, end_time;
-    
-    if (num_threads == 1) {
-        //  
-        printf("Running sequential version...\n");
-        start_time = get_time_ms();
-        result = median_filter_sequential(input, window_size, k_iters);
-        end_time = get_time_ms();
-    } else {
-        //  
-        printf("Running parallel version with %d threads...\n", num_threads);
-        start_time = get_time_ms();
-        result = median_filter_parallel(input, window_size, k_iters, num_threads);
-        end_time = get_time_ms();
-    }
-    
-    long long execution_time = end_time - start_time;
-    printf("Execution time: %lld ms\n", execution_time);
-    
-    //  
-    if (!write_matrix(output_file, result)) {
-        free_matrix(input);
-        free_matrix(result);
-        return 1;
-    }
-    
-    printf("Result written to %s\n", output_file);
-    
-    //  
-    free_matrix(input);
-    free_matrix(result);
-    
-    return 0;
+///usr/bin/cc -O3 -o /tmp/median_filter -pthread $0 "$(dirname $0)/median_lib.c" "$(dirname $0)/median_kernels.c" "$(dirname $0)/thread_pool.c" "$(dirname $0)/text_io.c" "$(dirname $0)/instrument.c" "$(dirname $0)/autotune.c" && exec /tmp/median_filter "$@"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "../include/thread_pool.h"
+#include "../include/instrument.h"
+#include "../include/median_kernels.h"
+#include "../include/median_lib.h"
+#include "../include/autotune.h"
+
+// Глобальные переменные для параметров
+static int num_threads = 1;
+static int k_iters = 1;
+static int window_size = 3;
+static int percentile = RANK_MEDIAN;
+static filter_algorithm_t algorithm = ALGO_AUTO;
+
+static simd_level_t simd_level = SIMD_AUTO;
+static int fuse_depth = 1;
+static int tile_size = 0;   // 0 - по размеру кэша L2
+static pool_placement_t placement = POOL_PLACE_NONE;
+static bool skip_clean = false;   // пропуск неизменившихся плиток и остановка при сходимости
+static bool huge_pages = false;   // большие матрицы на огромных страницах
+static bool in_place = false;     // фильтр на месте, без второй матрицы
+static median_element_t element_type = MEDIAN_INT32;   // тип значений при фильтре
+static int channels = 1;          // чередующихся каналов в строке матрицы
+
+// Область интереса: фильтруются только прямоугольники -R и пиксели маски -M
+#define MAX_REGION_RECTS 64
+static median_rect_t region_rects[MAX_REGION_RECTS];
+static int region_rect_count = 0;
+static char *mask_file = NULL;
+
+// Имена алгоритмов для опции -a (в порядке filter_algorithm_t)
+static const char *algorithm_names[] = { "auto", "sort", "histogram", "network", "vanherk", "bitplane" };
+
+// Имена наборов инструкций для опции -x (в порядке simd_level_t)
+static const char *simd_names[] = { "scalar", "sse4.1", "avx2", "avx512", "auto" };
+
+// Имена размещений потоков для опции -p (в порядке pool_placement_t)
+static const char *placement_names[] = { "none", "compact", "scatter" };
+
+// Имена типов элементов для опции -E (в порядке median_element_t)
+static const char *element_names[] = { "int32", "uint8", "uint16" };
+
+// Имена уровней инструментирования для опции -I
+static const char *instrument_names[] = { "none", "time", "perf" };
+static char *input_file = NULL;
+static char *output_file = NULL;
+static bool convert_only = false;   // только преобразовать формат файла
+static bool streaming = false;      // потоковый режим без загрузки матрицы
+static char *batch_list = NULL;     // список пар "вход выход" пакетного режима
+static int instrument_level = 0;    // 0 - нет, 1 - таймеры, 2 - таймеры и счетчики
+static bool autotune = false;       // подобрать параметры на образце входа и сохранить в профиль
+static bool use_profile = true;     // брать параметры из профиля
+static const char *profile_file = NULL;   // NULL - autotune_profile_path()
+static unsigned tuned = TUNE_ALL;   // параметры, не заданные явно (их дают профиль и автонастройка)
+
+// Длинные опции (значения вне диапазона символов коротких опций)
+enum { OPT_AUTOTUNE = 256, OPT_PROFILE, OPT_NO_PROFILE };
+static const struct option long_options[] = {
+    { "autotune", no_argument, NULL, OPT_AUTOTUNE },
+    { "profile", required_argument, NULL, OPT_PROFILE },
+    { "no-profile", no_argument, NULL, OPT_NO_PROFILE },
+    { NULL, 0, NULL, 0 }
+};
+
+// Функция для вывода справки
+void print_usage(const char *program_name) {
+    printf("Usage: %s -t <threads> -k <iterations> -w <window_size> [-a <algorithm>] -i <input> -o <output>\n", program_name);
+    printf("       %s [options] -b <list>\n", program_name);
+    printf("       %s [options] -i - -o <output|->\n", program_name);
+    printf("Options:\n");
+    printf("  -t <threads>     Number of threads (default: 1)\n");
+    printf("  -k <iterations>  Number of filter iterations (default: 1)\n");
+    printf("  -w <window_size> Filter window size (default: 3)\n");
+    printf("  -r <percentile>  Rank of the window value: 50 - median (default), 0 - minimum, 100 - maximum\n");
+    printf("  -a <algorithm>   Rank algorithm: auto (default), sort (reference), histogram, network (median),\n");
+    printf("                   vanherk (minimum and maximum) or bitplane (bit-sliced, for few distinct values)\n");
+    printf("  -x <simd>        Instruction set for network: auto (default), scalar, sse4.1, avx2, avx512\n");
+    printf("  -f <depth>       Iterations fused per cache-resident tile (default: 1, no fusion)\n");
+    printf("  -T <tile>        Tile side for fused iterations (default: from L2 cache size)\n");
+    printf("  -p <placement>   Pin threads to cores: none (default), compact or scatter across NUMA nodes\n");
+    printf("  -I <mode>        Instrumentation: none (default), time (per-phase and per-thread timers)\n");
+    printf("                   or perf (timers and cycles, instructions, LLC misses per thread)\n");
+    printf("  -E <type>        Element type while filtering: int32 (default), uint8 or uint16\n");
+    printf("  -C <channels>    Interleaved channels per matrix row, each filtered on its own (default: 1)\n");
+    printf("  -R <x,y,w,h>     Filter only this rectangle (repeatable, up to %d); other pixels stay unchanged\n",
+           MAX_REGION_RECTS);
+    printf("  -M <mask>        Filter only pixels that are non-zero in this matrix file of the same size\n");
+    printf("  -H               Back large matrices with transparent huge pages\n");
+    printf("  -m               Filter in place through per-thread row bands (about one matrix of memory)\n");
+    printf("  -e               Skip tiles whose neighbourhood did not change and stop once the matrix converges\n");
+    printf("  -s               Stream row bands through a k-stage pipeline (for matrices larger than RAM)\n");
+    printf("  -c               Only convert input to output format, without filtering\n");
+    printf("  -b <list>        Batch: filter every \"input output\" pair listed one per line\n");
+    printf("  -i <input>       Input file with matrix (.bin - binary, otherwise text; - text frames from stdin)\n");
+    printf("  -o <output>      Output file for result (.bin - binary, otherwise text; - stdout for frames)\n");
+    printf("  --autotune       Benchmark algorithms, SIMD, fusion, tiles and threads on a sample of the input\n");
+    printf("                   and store the fastest in the profile (options given explicitly stay fixed)\n");
+    printf("  --profile <file> Profile of tuned settings per CPU, size, window, rank and element type\n");
+    printf("                   (default: $MEDIAN_PROFILE or ~/.median_filter_profile), applied when found\n");
+    printf("  --no-profile     Do not apply the profile\n");
+}
+
+// Функция для поиска имени в таблице опций
+static int find_name(const char *name, const char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Функция для парсинга аргументов командной строки
+bool parse_arguments(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:k:w:r:a:x:f:T:p:I:E:C:R:M:Hmescb:i:o:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                num_threads = atoi(optarg);
+                if (num_threads <= 0) {
+                    fprintf(stderr, "Error: Number of threads must be positive\n");
+                    return false;
+                }
+                tuned &= ~TUNE_THREADS;
+                break;
+            case 'k':
+                k_iters = atoi(optarg);
+                if (k_iters <= 0) {
+                    fprintf(stderr, "Error: Number of iterations must be positive\n");
+                    return false;
+                }
+                break;
+            case 'w':
+                window_size = atoi(optarg);
+                if (window_size <= 0 || window_size % 2 == 0) {
+                    fprintf(stderr, "Error: Window size must be positive and odd\n");
+                    return false;
+                }
+                break;
+            case 'r': {
+                char *end;
+                long value = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || value < 0 || value > 100) {
+                    fprintf(stderr, "Error: Percentile must be between 0 and 100\n");
+                    return false;
+                }
+                percentile = (int)value;
+                break;
+            }
+            case 'a': {
+                int found = find_name(optarg, algorithm_names, sizeof(algorithm_names) / sizeof(char*));
+                if (found < 0) {
+                    fprintf(stderr, "Error: Unknown algorithm '%s'\n", optarg);
+                    return false;
+                }
+                algorithm = (filter_algorithm_t)found;
+                if (algorithm != ALGO_AUTO) tuned &= ~TUNE_ALGORITHM;
+                break;
+            }
+            case 'x': {
+                int found = find_name(optarg, simd_names, sizeof(simd_names) / sizeof(char*));
+                if (found < 0) {
+                    fprintf(stderr, "Error: Unknown instruction set '%s'\n", optarg);
+                    return false;
+                }
+                simd_level = (simd_level_t)found;
+                if (simd_level != SIMD_AUTO && simd_level > detect_simd_level()) {
+                    fprintf(stderr, "Error: Instruction set '%s' is not supported by this CPU\n", optarg);
+                    return false;
+                }
+                if (simd_level != SIMD_AUTO) tuned &= ~TUNE_SIMD;
+                break;
+            }
+            case 'f':
+                fuse_depth = atoi(optarg);
+                if (fuse_depth <= 0) {
+                    fprintf(stderr, "Error: Fusion depth must be positive\n");
+                    return false;
+                }
+                tuned &= ~TUNE_FUSION;
+                break;
+            case 'T':
+                tile_size = atoi(optarg);
+                if (tile_size <= 0) {
+                    fprintf(stderr, "Error: Tile size must be positive\n");
+                    return false;
+                }
+                tuned &= ~TUNE_TILE;
+                break;
+            case 'p': {
+                int found = find_name(optarg, placement_names, sizeof(placement_names) / sizeof(char*));
+                if (found < 0) {
+                    fprintf(stderr, "Error: Unknown placement '%s'\n", optarg);
+                    return false;
+                }
+                placement = (pool_placement_t)found;
+                break;
+            }
+            case 'I': {
+                int found = find_name(optarg, instrument_names, sizeof(instrument_names) / sizeof(char*));
+                if (found < 0) {
+                    fprintf(stderr, "Error: Unknown instrumentation mode '%s'\n", optarg);
+                    return false;
+                }
+                instrument_level = found;
+                break;
+            }
+            case 'E': {
+                int found = find_name(optarg, element_names, sizeof(element_names) / sizeof(char*));
+                if (found < 0) {
+                    fprintf(stderr, "Error: Unknown element type '%s'\n", optarg);
+                    return false;
+                }
+                element_type = (median_element_t)found;
+                break;
+            }
+            case 'C':
+                channels = atoi(optarg);
+                if (channels <= 0) {
+                    fprintf(stderr, "Error: Number of channels must be positive\n");
+                    return false;
+                }
+                break;
+            case 'R': {
+                median_rect_t rect;
+                char tail;
+                if (sscanf(optarg, "%d,%d,%d,%d%c", &rect.x, &rect.y, &rect.width, &rect.height, &tail) != 4 ||
+                    rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0) {
+                    fprintf(stderr, "Error: Region must be x,y,width,height with a positive size\n");
+                    return false;
+                }
+                if (region_rect_count == MAX_REGION_RECTS) {
+                    fprintf(stderr, "Error: At most %d region rectangles\n", MAX_REGION_RECTS);
+                    return false;
+                }
+                region_rects[region_rect_count++] = rect;
+                break;
+            }
+            case 'M':
+                mask_file = optarg;
+                break;
+            case 'H':
+                huge_pages = true;
+                break;
+            case 'm':
+                in_place = true;
+                break;
+            case 'e':
+                skip_clean = true;
+                break;
+            case 's':
+                streaming = true;
+                break;
+            case 'c':
+                convert_only = true;
+                break;
+            case 'b':
+                batch_list = optarg;
+                break;
+            case 'i':
+                input_file = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case OPT_AUTOTUNE:
+                autotune = true;
+                break;
+            case OPT_PROFILE:
+                profile_file = optarg;
+                break;
+            case OPT_NO_PROFILE:
+                use_profile = false;
+                break;
+            default:
+                return false;
+        }
+    }
+    
+    if (batch_list && (input_file || output_file)) {
+        fprintf(stderr, "Error: Batch list already names input and output files\n");
+        return false;
+    }
+    if (!batch_list && (!input_file || !output_file)) {
+        fprintf(stderr, "Error: Input and output files are required\n");
+        return false;
+    }
+    if (input_file && strcmp(input_file, "-") == 0 && (streaming || convert_only)) {
+        fprintf(stderr, "Error: Frames from stdin cannot be streamed or converted\n");
+        return false;
+    }
+    if (autotune && (batch_list || streaming || convert_only || strcmp(input_file, "-") == 0)) {
+        fprintf(stderr, "Error: Autotuning needs an input matrix file to filter\n");
+        return false;
+    }
+    bool region = region_rect_count > 0 || mask_file;
+    if (region && (batch_list || streaming || convert_only || strcmp(input_file, "-") == 0)) {
+        fprintf(stderr, "Error: Region filtering needs an input matrix file\n");
+        return false;
+    }
+    if (region && (element_type != MEDIAN_INT32 || channels > 1 || in_place || skip_clean || fuse_depth > 1)) {
+        fprintf(stderr, "Warning: Region filtering visits only the region tiles of the int32 matrix, "
+                        "-E, -C, -m, -e and -f ignored\n");
+    }
+    if ((element_type != MEDIAN_INT32 || channels > 1) && (batch_list || streaming)) {
+        fprintf(stderr, "Warning: Batch and streaming modes filter int32 matrices, -E and -C ignored\n");
+    }
+    if (in_place && (skip_clean || fuse_depth > 1)) {
+        fprintf(stderr, "Warning: In-place filtering neither fuses iterations nor skips tiles, -f and -e ignored\n");
+    }
+    
+    return true;
+}
+
+// Функция для сборки параметров фильтра из опций командной строки
+// (автоматические значения не заменяются)
+static filter_params_t make_filter_options(void) {
+    filter_params_t options = median_default_params(window_size);
+    options.percentile = percentile;
+    options.algorithm = algorithm;
+    options.simd = simd_level;
+    options.fuse_depth = fuse_depth;
+    options.tile_size = tile_size;
+    options.skip_clean = skip_clean;
+    options.in_place = in_place;
+    return options;
+}
+
+// Функция для сборки параметров фильтра для этого процессора
+static filter_params_t make_filter_params(void) {
+    filter_params_t options = make_filter_options();
+    filter_params_t params = median_resolve_params(&options);
+    printf("Algorithm: %s, SIMD: %s\n", algorithm_names[params.algorithm], simd_names[params.simd]);
+    if (params.percentile != RANK_MEDIAN) printf("Percentile: %d\n", params.percentile);
+    return params;
+}
+
+// Функция для замены параметров, не заданных явно, конфигурацией из
+// профиля или автонастройки (source - откуда она взята, для вывода).
+// Выводятся итоговые параметры вместе с явно заданными
+static void apply_config(const autotune_config_t *config, const char *source) {
+    if (tuned & TUNE_THREADS) num_threads = config->num_threads;
+    if (tuned & TUNE_ALGORITHM) algorithm = config->params.algorithm;
+    if (tuned & TUNE_SIMD) simd_level = config->params.simd;
+    if (tuned & TUNE_FUSION) fuse_depth = config->params.fuse_depth;
+    if (tuned & TUNE_TILE) tile_size = config->params.tile_size;
+    
+    printf("%s: threads %d, algorithm %s, SIMD %s, fusion %d, tile %d (%.3f ms on sample)\n", source,
+           num_threads, algorithm_names[algorithm], simd_names[simd_level], fuse_depth, tile_size,
+           config->time_ms);
+}
+
+// Функция для параметров из профиля или автонастройки до создания
+// контекста (от них зависит число потоков). При автонастройке вход
+// читается здесь и отдается в *input
+static bool tune_parameters(matrix_t **input) {
+    int width, height;
+    if (!read_matrix_size(input_file, &width, &height)) return false;
+    
+    autotune_key_t key;
+    autotune_make_key(&key, width, height, window_size, percentile, element_type);
+    const char *path = profile_file ? profile_file : autotune_profile_path();
+    autotune_config_t config = { .params = make_filter_options(), .num_threads = num_threads };
+    
+    if (!autotune) {
+        if (use_profile && autotune_load(path, &key, &config)) apply_config(&config, "Profile");
+        return true;
+    }
+    
+    *input = read_matrix(input_file, NULL);
+    if (!*input) return false;
+    if (!autotune_run(*input, element_type, k_iters, placement, tuned, &config)) return false;
+    apply_config(&config, "Autotuned");
+    if (autotune_save(path, &key, &config)) printf("Profile written to %s\n", path);
+    return true;
+}
+
+// Функция для фильтрации матрицы как изображения из channels чередующихся
+// каналов типа element_type: значения упаковываются в буфер этого типа
+// и распаковываются обратно вне замера времени (elapsed - только фильтр).
+// Распаковка пишет в matrix: у входа .bin меняется частная копия страниц,
+// а не файл, так что -o может указывать на сам вход
+static bool filter_as_image(median_context_t *ctx, matrix_t *matrix, const filter_params_t *params,
+                            double *elapsed) {
+    static const int sizes[] = { 4, 1, 2 };
+    static const int max_values[] = { INT_MAX, UINT8_MAX, UINT16_MAX };
+    int min_value = element_type == MEDIAN_INT32 ? INT_MIN : 0;
+    int size = sizes[element_type];
+    
+    if (matrix->width % channels != 0) {
+        fprintf(stderr, "Error: Matrix width %d is not a multiple of %d channels\n", matrix->width, channels);
+        return false;
+    }
+    
+    median_image_t image = {
+        .width = matrix->width / channels,
+        .height = matrix->height,
+        .channels = channels,
+        .stride = (size_t)matrix->width * size,
+        .type = element_type
+    };
+    image.data = malloc(image.stride * image.height);
+    if (!image.data) {
+        fprintf(stderr, "Error: Memory allocation failed for %dx%d image\n", matrix->height, matrix->width);
+        return false;
+    }
+    
+    // Упаковка с проверкой диапазона типа
+    for (int y = 0; y < matrix->height; y++) {
+        const int *row = MATRIX_ROW(matrix, y);
+        char *out = (char*)image.data + (size_t)y * image.stride;
+        for (int x = 0; x < matrix->width; x++) {
+            if (row[x] < min_value || row[x] > max_values[element_type]) {
+                fprintf(stderr, "Error: Value %d at (%d, %d) does not fit %s\n", row[x], y, x,
+                        element_names[element_type]);
+                free(image.data);
+                return false;
+            }
+            if (size == 1) ((uint8_t*)out)[x] = (uint8_t)row[x];
+            else if (size == 2) ((uint16_t*)out)[x] = (uint16_t)row[x];
+            else ((int32_t*)out)[x] = row[x];
+        }
+    }
+    
+    double start_time = get_time_ms();
+    instrument_phase_begin(PHASE_FILTER);
+    bool ok = median_filter_image(ctx, &image, &image, k_iters, params);
+    instrument_phase_end();
+    *elapsed = get_time_ms() - start_time;
+    
+    for (int y = 0; y < matrix->height && ok; y++) {
+        int *row = MATRIX_ROW(matrix, y);
+        const char *in = (const char*)image.data + (size_t)y * image.stride;
+        for (int x = 0; x < matrix->width; x++) {
+            if (size == 1) row[x] = ((const uint8_t*)in)[x];
+            else if (size == 2) row[x] = ((const uint16_t*)in)[x];
+            else row[x] = ((const int32_t*)in)[x];
+        }
+    }
+    free(image.data);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    if (!parse_arguments(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    // Кадры из stdin: вывод кадров в stdout забирает себе копию
+    // дескриптора, а сообщения программы уходят в stderr
+    bool frames = input_file && strcmp(input_file, "-") == 0;
+    int frames_fd = -1;
+    if (frames) {
+        if (strcmp(output_file, "-") == 0) {
+            frames_fd = dup(STDOUT_FILENO);
+            if (frames_fd >= 0) dup2(STDERR_FILENO, STDOUT_FILENO);
+        } else {
+            frames_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (frames_fd < 0) {
+            fprintf(stderr, "Error: Cannot open output %s\n", output_file);
+            return 1;
+        }
+    }
+    
+    matrix_use_huge_pages(huge_pages);
+    
+    // Профиль и автонастройка нужны только фильтру одной матрицы из файла
+    matrix_t *input = NULL;
+    if (!batch_list && !frames && !streaming && !convert_only && (autotune || use_profile) &&
+        !tune_parameters(&input)) {
+        free_matrix(input);
+        return 1;
+    }
+    
+    // Контекст (пул потоков и рабочие матрицы) живет всю работу
+    // программы: чтение, фильтр и запись
+    median_context_t *ctx = median_context_create(num_threads, placement);
+    if (!ctx) {
+        free_matrix(input);
+        return 1;
+    }
+    thread_pool_t *pool = median_context_pool(ctx);
+    if (pool && placement != POOL_PLACE_NONE) {
+        printf("Placement: %s\n", placement_names[placement]);
+        thread_pool_print_layout(pool);
+    }
+    
+    if (instrument_level > 0 && !instrument_start(pool, instrument_level > 1)) {
+        free_matrix(input);
+        median_context_destroy(ctx);
+        return 1;
+    }
+    
+    // Пакетный режим: чтение, фильтр и запись соседних кадров идут
+    // одновременно, пул один на все кадры
+    if (batch_list || frames) {
+        printf("Batch: %s, Threads: %d, Iterations: %d, Window: %dx%d\n",
+               batch_list ? batch_list : "stdin", num_threads, k_iters, window_size, window_size);
+        filter_params_t params = make_filter_params();
+        double start_time = get_time_ms();
+        bool ok = median_filter_batch(batch_list, STDIN_FILENO, frames_fd, k_iters, ctx, &params);
+        double end_time = get_time_ms();
+        instrument_report();
+        median_context_destroy(ctx);
+        if (frames_fd >= 0) close(frames_fd);
+        printf("Execution time (with I/O): %.3f ms\n", end_time - start_time);
+        return ok ? 0 : 1;
+    }
+    
+    // Потоковый режим: матрица целиком в память не загружается
+    if (streaming && !convert_only) {
+        printf("Streaming: %s, Threads: %d, Iterations: %d, Window: %dx%d\n",
+               input_file, num_threads, k_iters, window_size, window_size);
+        filter_params_t params = make_filter_params();
+        printf("Running streaming version...\n");
+        double start_time = get_time_ms();
+        instrument_phase_begin(PHASE_FILTER);
+        bool ok = median_filter_stream(input_file, output_file, k_iters, pool, &params);
+        instrument_phase_end();
+        double end_time = get_time_ms();
+        instrument_report();
+        median_context_destroy(ctx);
+        if (!ok) return 1;
+        printf("Execution time (with I/O): %.3f ms\n", end_time - start_time);
+        printf("Result written to %s\n", output_file);
+        return 0;
+    }
+    
+    // Читаем входную матрицу (автонастройка уже прочитала ее)
+    if (!input) {
+        instrument_phase_begin(PHASE_READ);
+        input = read_matrix(input_file, pool);
+        instrument_phase_end();
+    }
+    if (!input) {
+        median_context_destroy(ctx);
+        return 1;
+    }
+    
+    // Режим преобразования между текстовым и двоичным форматом
+    if (convert_only) {
+        instrument_phase_begin(PHASE_WRITE);
+        bool ok = write_matrix(output_file, input, pool);
+        instrument_phase_end();
+        if (ok) printf("Converted %dx%d matrix to %s\n", input->height, input->width, output_file);
+        instrument_report();
+        free_matrix(input);
+        median_context_destroy(ctx);
+        return ok ? 0 : 1;
+    }
+    
+    printf("Matrix: %dx%d, Threads: %d, Iterations: %d, Window: %dx%d\n",
+           input->height, input->width, num_threads, k_iters, window_size, window_size);
+    filter_params_t params = make_filter_params();
+    if (params.fuse_depth > 1 && !params.in_place) {
+        printf("Fusion: %d iterations per %dx%d tile\n", params.fuse_depth, params.tile_size, params.tile_size);
+    }
+    
+    const matrix_t *result;
+    double start_time, end_time;
+    int converged = -1;
+    
+    if (region_rect_count > 0 || mask_file) {
+        // Область интереса: считаются только ее плитки с окрестностью.
+        // Результат остается в input (у входа .bin - в частной копии
+        // страниц), поэтому вывод в тот же файл безопасен
+        matrix_t *mask = NULL;
+        if (mask_file) {
+            instrument_phase_begin(PHASE_READ);
+            mask = read_matrix(mask_file, pool);
+            instrument_phase_end();
+            if (!mask) {
+                free_matrix(input);
+                median_context_destroy(ctx);
+                return 1;
+            }
+        }
+        for (int i = 0; i < region_rect_count; i++) {
+            const median_rect_t *rect = &region_rects[i];
+            if (rect->x >= input->width || rect->y >= input->height) {
+                fprintf(stderr, "Warning: Region %d,%d,%d,%d lies outside the %dx%d matrix\n", rect->x, rect->y,
+                        rect->width, rect->height, input->height, input->width);
+            }
+        }
+        median_region_t area = { .rects = region_rects, .rect_count = region_rect_count, .mask = mask };
+        printf("Running region version on %d rectangle(s)%s with %d threads...\n", region_rect_count,
+               mask ? " and mask" : "", num_threads);
+        start_time = get_time_ms();
+        instrument_phase_begin(PHASE_FILTER);
+        result = median_context_filter_region(ctx, input, k_iters, &params, &area) ? input : NULL;
+        instrument_phase_end();
+        end_time = get_time_ms();
+        free_matrix(mask);
+    } else if (element_type != MEDIAN_INT32 || channels > 1) {
+        // Изображение: каналы по отдельности, значения в своем типе
+        printf("Running %s version on %d channel(s) of %s with %d threads...\n",
+               params.in_place ? "in-place" : "image", channels, element_names[element_type], num_threads);
+        double elapsed = 0;
+        result = filter_as_image(ctx, input, &params, &elapsed) ? input : NULL;
+        start_time = 0;
+        end_time = elapsed;
+    } else if (params.in_place) {
+        // Версия на месте: результат пишется во входную матрицу
+        printf("Running in-place version with %d threads...\n", num_threads);
+        start_time = get_time_ms();
+        instrument_phase_begin(PHASE_FILTER);
+        result = median_context_filter_in_place(ctx, input, k_iters, &params) ? input : NULL;
+        instrument_phase_end();
+        end_time = get_time_ms();
+    } else if (num_threads == 1) {
+        // Последовательная версия
+        printf("Running sequential version...\n");
+        start_time = get_time_ms();
+        instrument_phase_begin(PHASE_FILTER);
+        result = median_context_filter(ctx, input, k_iters, &params, &converged);
+        instrument_phase_end();
+        end_time = get_time_ms();
+    } else {
+        // Параллельная версия
+        printf("Running parallel version with %d threads...\n", num_threads);
+        start_time = get_time_ms();
+        instrument_phase_begin(PHASE_FILTER);
+        result = median_context_filter(ctx, input, k_iters, &params, &converged);
+        instrument_phase_end();
+        end_time = get_time_ms();
+    }
+    
+    if (!result) {
+        free_matrix(input);
+        median_context_destroy(ctx);
+        return 1;
+    }
+    
+    double execution_time = end_time - start_time;
+    printf("Execution time: %.3f ms\n", execution_time);
+    if (converged >= 0) {
+        printf("Converged after %d of %d iterations\n", converged, k_iters);
+    } else if (params.skip_clean) {
+        printf("Not converged after %d iterations\n", k_iters);
+    }
+    
+    // Записываем результат
+    instrument_phase_begin(PHASE_WRITE);
+    bool written = write_matrix(output_file, result, pool);
+    instrument_phase_end();
+    if (!written) {
+        free_matrix(input);
+        median_context_destroy(ctx);
+        return 1;
+    }
+    
+    printf("Result written to %s\n", output_file);
+    instrument_report();
+    
+    // Очистка памяти
+    free_matrix(input);
+    median_context_destroy(ctx);
+    
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1362 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <immintrin.h>
+
+#include "../include/median_kernels.h"
+
+// Выделять ли большие матрицы на огромных страницах
+static bool huge_pages = false;
+
+void fill_matrix_halo(matrix_t *matrix) {
+    int halo = matrix->halo;
+    
+    for (int y = -halo; y < matrix->height + halo; y++) {
+        int *row = MATRIX_ROW(matrix, y);
+        if (y < 0 || y >= matrix->height) {
+            for (int x = -halo; x < matrix->width + halo; x++) row[x] = MATRIX_PAD;
+            continue;
+        }
+        for (int x = 1; x <= halo; x++) {
+            row[-x] = MATRIX_PAD;
+            row[matrix->width - 1 + x] = MATRIX_PAD;
+        }
+    }
+}
+
+void matrix_use_huge_pages(bool enabled) {
+    huge_pages = enabled;
+}
+
+matrix_t* allocate_matrix(int width, int height, int halo) {
+    int lanes = MATRIX_ALIGNMENT / sizeof(int);
+    // Левая рамка дополняется до выравнивания, чтобы строки начинались с кэш-линии
+    int left = (halo + lanes - 1) / lanes * lanes;
+    int stride = (left + width + halo + lanes - 1) / lanes * lanes;
+    size_t total = (size_t)stride * (height + 2 * halo);
+    size_t bytes = total * sizeof(int);
+    
+    matrix_t *matrix = malloc(sizeof(matrix_t));
+    if (!matrix) return NULL;
+    
+    // Огромные страницы: память выравнивается по их размеру, а ядро
+    // просится собрать ее из прозрачных огромных страниц (меньше промахов TLB)
+    bool huge = huge_pages && bytes >= HUGE_PAGE_SIZE;
+    if (huge) bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (posix_memalign((void**)&matrix->buffer, huge ? HUGE_PAGE_SIZE : MATRIX_ALIGNMENT, bytes) != 0) {
+        free(matrix);
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) madvise(matrix->buffer, bytes, MADV_HUGEPAGE);
+#endif
+    
+    matrix->width = width;
+    matrix->height = height;
+    matrix->stride = stride;
+    matrix->halo = halo;
+    matrix->mapping = NULL;
+    matrix->mapping_size = 0;
+    matrix->data = matrix->buffer + (size_t)halo * stride + left;
+    
+    return matrix;
+}
+
+matrix_t* create_matrix(int width, int height, int halo) {
+    matrix_t *matrix = allocate_matrix(width, height, halo);
+    if (matrix) fill_matrix_halo(matrix);
+    return matrix;
+}
+
+void resize_matrix(matrix_t *matrix, int width, int height) {
+    matrix->width = width;
+    matrix->height = height;
+    fill_matrix_halo(matrix);
+}
+
+void free_matrix(matrix_t *matrix) {
+    if (!matrix) return;
+    
+    if (matrix->mapping) munmap(matrix->mapping, matrix->mapping_size);
+    free(matrix->buffer);
+    free(matrix);
+}
+
+matrix_t* copy_matrix(const matrix_t *src, int halo) {
+    matrix_t *dst = create_matrix(src->width, src->height, halo);
+    if (!dst) return NULL;
+    
+    for (int y = 0; y < src->height; y++) {
+        memcpy(MATRIX_ROW(dst, y), MATRIX_ROW(src, y), src->width * sizeof(int));
+    }
+    
+    return dst;
+}
+
+bool scratch_reserve(scratch_arena_t *arena, size_t size) {
+    arena->used = 0;
+    if (arena->size >= size) return true;
+    
+    scratch_free(arena);
+    size = (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    if (posix_memalign((void**)&arena->base, MATRIX_ALIGNMENT, size) != 0) {
+        arena->base = NULL;
+        return false;
+    }
+    arena->size = size;
+    return true;
+}
+
+void scratch_free(scratch_arena_t *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void* scratch_alloc(scratch_arena_t *arena, size_t bytes) {
+    if (!arena) return NULL;
+    
+    size_t offset = (arena->used + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    if (offset > arena->size || bytes > arena->size - offset) return NULL;
+    arena->used = offset + bytes;
+    return arena->base + offset;
+}
+
+// Функция для числа битов номера уровня из [0, levels)
+static int bitplane_bits(int levels) {
+    return levels > 2 ? 32 - __builtin_clz(levels - 1) : 1;
+}
+
+// Функция для выбора плоскостей битового алгоритма: число пороговых
+// плоскостей (levels - 1), если их раздельный счет дешевле поразрядного
+// выбора, иначе 0. Оценка - операций на слово строки
+static int bitplane_thresholds(int window_size, int levels) {
+    int log_window = 32 - __builtin_clz(window_size);
+    int slices = 32 - __builtin_clz(window_size * window_size);
+    long long threshold_cost = (long long)(levels - 1) * (4 * window_size + 16 * log_window * slices);
+    long long radix_cost = (long long)bitplane_bits(levels) * 14 * window_size * window_size;
+    return threshold_cost <= radix_cost ? imax(levels - 1, 1) : 0;
+}
+
+size_t filter_scratch_size(const filter_params_t *params, int width, int cols) {
+    int window_size = params->window_size;
+    int radius = window_size / 2;
+    size_t span = (size_t)cols + 2 * radius;
+    
+    // Окно эталонного пути нужно граничным пикселям при любом алгоритме
+    size_t size = (size_t)window_size * window_size * sizeof(int);
+    size_t kernel = 0;
+    if (params->algorithm == ALGO_HISTOGRAM) {
+        size_t coarse_bins = (params->levels + HIST_FINE_BINS) >> HIST_FINE_SHIFT;
+        size_t fine_bins = coarse_bins << HIST_FINE_SHIFT;
+        kernel = span * (fine_bins + coarse_bins) * sizeof(uint16_t) +
+                 (fine_bins + 2 * coarse_bins) * sizeof(uint32_t);
+    } else if (params->algorithm == ALGO_NETWORK) {
+        kernel = (size_t)window_size * width * sizeof(int);
+    } else if (params->algorithm == ALGO_VAN_HERK) {
+        kernel = (3 * (size_t)window_size * cols + 3 * span) * sizeof(int);
+    } else if (params->algorithm == ALGO_BITPLANE) {
+        // Кольцо упакованных строк, состояния значений окна, счетчики
+        // строки, ранги и уровни слов строки
+        size_t bits = bitplane_bits(params->levels);
+        size_t thresholds = bitplane_thresholds(window_size, params->levels);
+        size_t planes = thresholds ? thresholds : bits;
+        size_t words = (span + 63) / 64;
+        size_t state = thresholds ? planes * 32 * words : 3 * (size_t)window_size * window_size;
+        kernel = (window_size * planes * words + state + 2 * 32 * words + (32 + bits) * words + 32) *
+                 sizeof(uint64_t);
+    }
+    if (kernel > size) size = kernel;
+    
+    // Запас на выравнивание каждого буфера по кэш-линии
+    return size + SCRATCH_BUFFERS * MATRIX_ALIGNMENT;
+}
+
+// Функция для получения буфера окна эталонного пути: из рабочей памяти,
+// а если ее нет или она мала - из кучи на весь вызов (*heap для free)
+static int* window_buffer(scratch_arena_t *scratch, int window_size, int **heap) {
+    size_t bytes = (size_t)window_size * window_size * sizeof(int);
+    int *window = scratch_alloc(scratch, bytes);
+    *heap = window ? NULL : malloc(bytes);
+    return window ? window : *heap;
+}
+
+// Функция для сбора в window значений окна точки (x, y), попавших
+// в матрицу (их число)
+static int gather_window(const matrix_t *matrix, int x, int y, int window_size, int *window) {
+    int radius = window_size / 2;
+    int x0 = imax(x - radius, 0);
+    int cols = imin(x + radius, matrix->width - 1) - x0 + 1;
+    int count = 0;
+    for (int yy = imax(y - radius, 0); yy <= imin(y + radius, matrix->height - 1); yy++) {
+        memcpy(window + count, MATRIX_ROW(matrix, yy) + x0, cols * sizeof(int));
+        count += cols;
+    }
+    return count;
+}
+
+// Функция для значения ранга rank среди count значений (выбор Хоара:
+// values переставляются, в среднем O(count))
+static int select_rank(int *values, int count, int rank) {
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int pivot = values[lo + (hi - lo) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j) {
+                int temp = values[i];
+                values[i++] = values[j];
+                values[j--] = temp;
+            }
+        }
+        if (rank <= j) hi = j;
+        else if (rank >= i) lo = i;
+        else break;
+    }
+    return values[rank];
+}
+
+int apply_median_filter(const matrix_t *matrix, int x, int y, int window_size, int percentile, int *window) {
+    // Собираем значения окна, попавшие в матрицу
+    int count = gather_window(matrix, x, y, window_size, window);
+    
+    // Сортировка пузырьком (простая реализация)
+    for (int i = 0; i < count - 1; i++) {
+        for (int j = 0; j < count - i - 1; j++) {
+            if (window[j] > window[j + 1]) {
+                int temp = window[j];
+                window[j] = window[j + 1];
+                window[j + 1] = temp;
+            }
+        }
+    }
+    
+    // Возвращаем значение нужного ранга
+    return window[rank_index(count, percentile)];
+}
+
+bool apply_median_filter_iteration(const matrix_t *src, matrix_t *dst, int window_size, int percentile,
+                                   scratch_arena_t *scratch, int start_row, int end_row,
+                                   int start_col, int end_col) {
+    size_t mark = scratch ? scratch->used : 0;
+    int *heap;
+    int *window = window_buffer(scratch, window_size, &heap);
+    if (!window) return false;
+    
+    for (int y = start_row; y < end_row; y++) {
+        for (int x = start_col; x < end_col; x++) {
+            MATRIX_ROW(dst, y)[x] = apply_median_filter(src, x, y, window_size, percentile, window);
+        }
+    }
+    
+    free(heap);
+    if (scratch) scratch->used = mark;
+    return true;
+}
+
+// Функция сравнения для qsort
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+bool build_value_levels(const matrix_t *matrix, value_levels_t *levels) {
+    int min_value = matrix->data[0];
+    int max_value = matrix->data[0];
+    
+    for (int y = 0; y < matrix->height; y++) {
+        const int *row = MATRIX_ROW(matrix, y);
+        for (int x = 0; x < matrix->width; x++) {
+            int v = row[x];
+            if (v < min_value) min_value = v;
+            if (v > max_value) max_value = v;
+        }
+    }
+    
+    levels->values = NULL;
+    levels->min_value = min_value;
+    
+    // Плотный диапазон: уровень вычисляется вычитанием
+    if ((long long)max_value - min_value < HIST_MAX_LEVELS) {
+        levels->count = max_value - min_value + 1;
+        return true;
+    }
+    
+    // Разреженный диапазон: сжимаем до списка различных значений
+    size_t total = (size_t)matrix->width * matrix->height;
+    int *values = malloc(total * sizeof(int));
+    if (!values) return false;
+    
+    size_t pos = 0;
+    for (int y = 0; y < matrix->height; y++) {
+        memcpy(values + pos, MATRIX_ROW(matrix, y), matrix->width * sizeof(int));
+        pos += matrix->width;
+    }
+    qsort(values, total, sizeof(int), compare_ints);
+    
+    int count = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (count == 0 || values[count - 1] != values[i]) {
+            if (count == HIST_MAX_LEVELS) {
+                free(values);
+                return false;
+            }
+            values[count++] = values[i];
+        }
+    }
+    
+    levels->values = realloc(values, count * sizeof(int));
+    if (!levels->values) levels->values = values;
+    levels->count = count;
+    return true;
+}
+
+void matrix_to_levels(matrix_t *matrix, const value_levels_t *levels) {
+    for (int y = 0; y < matrix->height; y++) {
+        int *row = MATRIX_ROW(matrix, y);
+        for (int x = 0; x < matrix->width; x++) {
+            int v = row[x];
+            if (!levels->values) {
+                row[x] = v - levels->min_value;
+                continue;
+            }
+            
+            // Двоичный поиск значения среди уровней
+            int lo = 0, hi = levels->count - 1;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (levels->values[mid] < v) lo = mid + 1;
+                else hi = mid;
+            }
+            row[x] = lo;
+        }
+    }
+}
+
+void matrix_from_levels(matrix_t *matrix, const value_levels_t *levels) {
+    for (int y = 0; y < matrix->height; y++) {
+        int *row = MATRIX_ROW(matrix, y);
+        for (int x = 0; x < matrix->width; x++) {
+            int level = row[x];
+            row[x] = levels->values ? levels->values[level] : level + levels->min_value;
+        }
+    }
+}
+
+bool apply_median_filter_iteration_histogram(const matrix_t *src, matrix_t *dst, int window_size,
+                                             int percentile, int levels, scratch_arena_t *scratch,
+                                             int start_row, int end_row, int start_col, int end_col) {
+    int radius = window_size / 2;
+    
+    if (start_row >= end_row || start_col >= end_col) return true;
+    
+    // Гистограммы нужны для столбцов [start_col - r, end_col + r)
+    int col0 = start_col - radius;
+    int width = end_col - start_col + 2 * radius;
+    
+    // Ячейки рамки (MATRIX_PAD) попадают в лишнюю корзину levels выше
+    // любого уровня и в ранг окна, обрезанного краями матрицы, не входят
+    int coarse_bins = (levels + HIST_FINE_BINS) >> HIST_FINE_SHIFT;
+    int fine_bins = coarse_bins << HIST_FINE_SHIFT;
+    
+    size_t mark = scratch ? scratch->used : 0;
+    uint16_t *col_fine = scratch_alloc(scratch, (size_t)width * fine_bins * sizeof(uint16_t));
+    uint16_t *col_coarse = scratch_alloc(scratch, (size_t)width * coarse_bins * sizeof(uint16_t));
+    uint32_t *fine = scratch_alloc(scratch, fine_bins * sizeof(uint32_t));
+    uint32_t *coarse = scratch_alloc(scratch, coarse_bins * sizeof(uint32_t));
+    int *last_update = scratch_alloc(scratch, coarse_bins * sizeof(int));
+    
+    if (!col_fine || !col_coarse || !fine || !coarse || !last_update) {
+        if (scratch) scratch->used = mark;
+        return false;
+    }
+    memset(col_fine, 0, (size_t)width * fine_bins * sizeof(uint16_t));
+    memset(col_coarse, 0, (size_t)width * coarse_bins * sizeof(uint16_t));
+    
+    // Начальные гистограммы столбцов по строкам [start_row - r, start_row + r]
+    for (int y = start_row - radius; y <= start_row + radius; y++) {
+        const int *row = MATRIX_ROW(src, y) + col0;
+        for (int x = 0; x < width; x++) {
+            int v = imin(row[x], levels);
+            col_fine[(size_t)x * fine_bins + v]++;
+            col_coarse[(size_t)x * coarse_bins + (v >> HIST_FINE_SHIFT)]++;
+        }
+    }
+    
+    for (int y = start_row; y < end_row; y++) {
+        // Сдвигаем гистограммы столбцов на строку вниз
+        if (y > start_row) {
+            const int *removed = MATRIX_ROW(src, y - radius - 1) + col0;
+            const int *added = MATRIX_ROW(src, y + radius) + col0;
+            for (int x = 0; x < width; x++) {
+                uint16_t *cf = col_fine + (size_t)x * fine_bins;
+                uint16_t *cc = col_coarse + (size_t)x * coarse_bins;
+                int out = imin(removed[x], levels), in = imin(added[x], levels);
+                cf[out]--;
+                cc[out >> HIST_FINE_SHIFT]--;
+                cf[in]++;
+                cc[in >> HIST_FINE_SHIFT]++;
+            }
+        }
+        
+        // Порядковый номер искомого ранга среди значений окна в матрице
+        int rows = imin(y + radius, src->height - 1) - imax(y - radius, 0) + 1;
+        uint32_t row_target = (uint32_t)rank_index(rows * window_size, percentile);
+        
+        // Крупная гистограмма окна для первого пикселя строки
+        memset(coarse, 0, coarse_bins * sizeof(uint32_t));
+        for (int x = 0; x < window_size; x++) {
+            const uint16_t *cc = col_coarse + (size_t)x * coarse_bins;
+            for (int c = 0; c < coarse_bins; c++) coarse[c] += cc[c];
+        }
+        // Мелкие корзины строки еще не построены
+        for (int c = 0; c < coarse_bins; c++) last_update[c] = -window_size - 1;
+        
+        int *out_row = MATRIX_ROW(dst, y) + col0;
+        for (int x = radius; x < width - radius; x++) {
+            if (x > radius) {
+                const uint16_t *in = col_coarse + (size_t)(x + radius) * coarse_bins;
+                const uint16_t *out = col_coarse + (size_t)(x - radius - 1) * coarse_bins;
+                for (int c = 0; c < coarse_bins; c++) coarse[c] += in[c] - out[c];
+            }
+            
+            // У крайних столбцов матрицы окно обрезано и по ширине
+            uint32_t target = row_target;
+            int column = col0 + x;
+            if (column < radius || column >= src->width - radius) {
+                int cols = imin(column + radius, src->width - 1) - imax(column - radius, 0) + 1;
+                target = (uint32_t)rank_index(rows * cols, percentile);
+            }
+            
+            // Ищем крупную корзину, содержащую искомый ранг
+            uint32_t below = 0;
+            int c = 0;
+            while (below + coarse[c] <= target) below += coarse[c++];
+            
+            // Досчитываем мелкие корзины выбранной крупной
+            uint32_t *f = fine + (c << HIST_FINE_SHIFT);
+            size_t offset = (size_t)c << HIST_FINE_SHIFT;
+            if (2 * (x - last_update[c]) >= window_size) {
+                memset(f, 0, HIST_FINE_BINS * sizeof(uint32_t));
+                for (int j = x - radius; j <= x + radius; j++) {
+                    const uint16_t *cf = col_fine + (size_t)j * fine_bins + offset;
+                    for (int b = 0; b < HIST_FINE_BINS; b++) f[b] += cf[b];
+                }
+            } else {
+                for (int j = last_update[c] + 1; j <= x; j++) {
+                    const uint16_t *in = col_fine + (size_t)(j + radius) * fine_bins + offset;
+                    const uint16_t *out = col_fine + (size_t)(j - radius - 1) * fine_bins + offset;
+                    for (int b = 0; b < HIST_FINE_BINS; b++) f[b] += in[b] - out[b];
+                }
+            }
+            last_update[c] = x;
+            
+            int b = 0;
+            while (below + f[b] <= target) below += f[b++];
+            
+            out_row[x] = (c << HIST_FINE_SHIFT) + b;
+        }
+    }
+    
+    scratch->used = mark;
+    return true;
+}
+
+// БИТОВЫЕ ПЛОСКОСТИ
+// Уровень выбирается без сравнений значений. Плоскость строки хранится
+// бит-срезом: слово содержит один бит 64 соседних пикселей, и все действия
+// над окном - логические операции сразу над 64 выходными пикселями.
+// Счетчики тоже хранятся срезами: срез s - слово из битов s счетчиков
+// 64 пикселей. Плоскости бывают двух видов:
+// - пороговые (v >= t для каждого уровня t > 0): ранговый фильтр
+//   перестановочен с порогом, поэтому результат - число порогов, для
+//   которых ранг двоичного окна равен 1, а нули двоичного окна считаются
+//   раздельно, по столбцам и по строке;
+// - разрядные (бит b значения): уровень выбирается поразрядно от старшего
+//   бита, и у каждого значения окна хранится, совпадает ли оно с уже
+//   выбранными битами или уже меньше их (O(w^2) на бит).
+// Для немногих уровней и больших окон дешевле пороговые плоскости
+
+// Функция для 64 битов упакованной строки из words слов, начиная с бита
+// offset (биты за концом строки - нули)
+static inline uint64_t bit_window(const uint64_t *row, int words, int offset) {
+    int word = offset >> 6;
+    int shift = offset & 63;
+    if (word >= words) return 0;
+    
+    uint64_t low = row[word] >> shift;
+    return shift && word + 1 < words ? low | (row[word + 1] << (64 - shift)) : low;
+}
+
+// Функция для прибавления единицы к счетчикам полос mask
+static inline void slice_increment(uint64_t *counter, int slices, uint64_t mask) {
+    for (int s = 0; s < slices && mask; s++) {
+        uint64_t carry = counter[s] & mask;
+        counter[s] ^= mask;
+        mask = carry;
+    }
+}
+
+// Функция для маски полос, где счетчик не больше target (тоже срезы)
+static inline uint64_t slice_not_greater(const uint64_t *counter, const uint64_t *target, int slices) {
+    uint64_t greater = 0;
+    uint64_t equal = ~0ULL;
+    for (int s = slices - 1; s >= 0; s--) {
+        greater |= equal & counter[s] & ~target[s];
+        equal &= ~(counter[s] ^ target[s]);
+    }
+    return ~greater;
+}
+
+// Функция для прибавления к счетчикам строки dst счетчиков src, сдвинутых
+// на shift битов (счетчик пикселя x получает счетчик x + shift). Срез s
+// строки - words слов с dst + s * words; dst может совпадать с src
+static void slice_row_add(uint64_t *dst, const uint64_t *src, int shift, int words, int slices) {
+    for (int k = 0; k < words; k++) {
+        uint64_t carry = 0;
+        for (int s = 0; s < slices; s++) {
+            uint64_t value = bit_window(src + (size_t)s * words, words, k * 64 + shift);
+            uint64_t *sum = &dst[(size_t)s * words + k];
+            uint64_t half = *sum ^ value;
+            uint64_t next = (*sum & value) | (carry & half);
+            *sum = half ^ carry;
+            carry = next;
+        }
+    }
+}
+
+// Функция для упакованной строки y в кольце из window_size строк
+static inline uint64_t* ring_row(uint64_t *ring, int y, int window_size, size_t row_words) {
+    return ring + ((y % window_size + window_size) % window_size) * row_words;
+}
+
+// Функция для упаковки плоскостей строки y, столбцов [x0, x0 + span), в
+// out: плоскость p - words слов с out + p * words (thresholds - пороговые
+// плоскости v >= p + 1, иначе разрядные). Ячейки за краем матрицы получают
+// все единицы - уровень не меньше любого, и в число меньших они не попадают
+static void pack_planes(const matrix_t *src, int y, int x0, int span, int planes, bool thresholds,
+                        int words, uint64_t *out) {
+    int left = imin(imax(-x0, 0), span);
+    int right = imax(imin(src->width - x0, span), left);
+    if (y < 0 || y >= src->height) left = right = span;
+    
+    const int *row = MATRIX_ROW(src, imin(imax(y, 0), src->height - 1)) + x0;
+    for (int k = 0; k < words; k++) {
+        int base = k * 64;
+        int begin = imax(left - base, 0);
+        int end = imin(right - base, 64);
+        
+        // Полосы за краем матрицы
+        uint64_t pad = ~0ULL;
+        if (begin < end) pad = ~((end - begin == 64 ? ~0ULL : ((1ULL << (end - begin)) - 1)) << begin);
+        
+        for (int p = 0; p < planes; p++) {
+            uint64_t word = 0;
+            if (thresholds) {
+                for (int i = begin; i < end; i++) word |= (uint64_t)(row[base + i] > p) << i;
+            } else {
+                for (int i = begin; i < end; i++) word |= (uint64_t)(row[base + i] >> p & 1) << i;
+            }
+            out[(size_t)p * words + k] = word | pad;
+        }
+    }
+}
+
+// Функция для изменения счетчиков нулей столбцов на нули строки row
+// (remove - вычесть строку, иначе прибавить). Срезы счетчиков - по words
+// слов с column
+static void column_zero_counts(uint64_t *column, const uint64_t *row, bool remove, int words, int slices) {
+    for (int k = 0; k < words; k++) {
+        uint64_t zeros = ~row[k];
+        for (int s = 0; s < slices && zeros; s++) {
+            uint64_t *counter = &column[(size_t)s * words + k];
+            uint64_t carry = (remove ? ~*counter : *counter) & zeros;
+            *counter ^= zeros;
+            zeros = carry;
+        }
+    }
+}
+
+// Функция для счетчиков нулей окна window_size x window_size с левым
+// верхним углом в каждом бите строки по счетчикам нулей столбцов окна:
+// сумма window_size соседних столбцов складывается удвоением (степени
+// двойки столбцов), O(log window_size) сложений срезов. power и sum -
+// срезы строки по words слов
+static void window_zero_counts(const uint64_t *column, int window_size, int words, int slices,
+                               uint64_t *power, uint64_t *sum) {
+    memcpy(power, column, (size_t)slices * words * sizeof(uint64_t));
+    memset(sum, 0, (size_t)slices * words * sizeof(uint64_t));
+    
+    int covered = 0;   // столбцов окна уже в sum
+    for (int step = 1, rest = window_size; rest; step <<= 1, rest >>= 1) {
+        if (rest & 1) {
+            slice_row_add(sum, power, covered, words, slices);
+            covered += step;
+        }
+        if (rest > 1) slice_row_add(power, power, step, words, slices);
+    }
+}
+
+// Функция для рангов окна полос слова, начиная со столбца x (count полос),
+// срезами в target: окно обрезается краями матрицы, и ранг берется среди
+// rows строк и попавших в окно столбцов
+static void bitplane_targets(int x, int count, int rows, int width, int window_size, int percentile,
+                             int slices, uint64_t *target) {
+    int radius = window_size / 2;
+    
+    // Внутренние столбцы: ранг у всех полос один
+    if (x >= radius && x + count - 1 + radius < width) {
+        int rank = rank_index(rows * window_size, percentile);
+        for (int s = 0; s < slices; s++) target[s] = rank >> s & 1 ? ~0ULL : 0;
+        return;
+    }
+    
+    memset(target, 0, slices * sizeof(uint64_t));
+    for (int i = 0; i < count; i++, x++) {
+        int cols = imin(x + radius, width - 1) - imax(x - radius, 0) + 1;
+        int rank = rank_index(rows * cols, percentile);
+        for (int s = 0; s < slices; s++) target[s] |= (uint64_t)(rank >> s & 1) << i;
+    }
+}
+
+bool apply_median_filter_iteration_bitplane(const matrix_t *src, matrix_t *dst, int window_size,
+                                            int percentile, int levels, scratch_arena_t *scratch,
+                                            int start_row, int end_row, int start_col, int end_col) {
+    int radius = window_size / 2;
+    
+    if (start_row >= end_row || start_col >= end_col) return true;
+    
+    int bits = bitplane_bits(levels);
+    int thresholds = bitplane_thresholds(window_size, levels);
+    int planes = thresholds ? thresholds : bits;
+    int cols = end_col - start_col;
+    int span = cols + 2 * radius;
+    int words = (span + 63) / 64;
+    int out_words = (cols + 63) / 64;
+    int area = window_size * window_size;
+    int slices = 32 - __builtin_clz(area);
+    
+    // Кольцо упакованных строк окна, состояния значений окна (разрядные
+    // плоскости) или счетчики нулей столбцов (пороговые), счетчики строки,
+    // ранги и уровни каждого слова строки
+    size_t mark = scratch ? scratch->used : 0;
+    size_t row_words = (size_t)planes * words;
+    size_t column_words = thresholds ? (size_t)planes * slices * words : 0;
+    uint64_t *ring = scratch_alloc(scratch, window_size * row_words * sizeof(uint64_t));
+    uint64_t *equal = scratch_alloc(scratch, (thresholds ? column_words : 3 * (size_t)area) * sizeof(uint64_t));
+    uint64_t *power = scratch_alloc(scratch, 2 * (size_t)slices * words * sizeof(uint64_t));
+    uint64_t *target = scratch_alloc(scratch, (size_t)(slices + bits) * out_words * sizeof(uint64_t));
+    uint64_t *counter = scratch_alloc(scratch, slices * sizeof(uint64_t));
+    
+    if (!ring || !equal || !power || !target || !counter) {
+        if (scratch) scratch->used = mark;
+        return false;
+    }
+    uint64_t *less = equal + area;      // значение уже меньше выбранных битов уровня
+    uint64_t *current = less + area;    // бит текущей плоскости
+    uint64_t *column = equal;           // нули столбцов окна, slices * words на плоскость
+    uint64_t *sum = power + (size_t)slices * words;
+    uint64_t *result = target + (size_t)slices * out_words;   // уровни срезами, bits на слово
+    
+    int x0 = start_col - radius;
+    if (thresholds) memset(column, 0, column_words * sizeof(uint64_t));
+    for (int y = start_row - radius; y < start_row + radius; y++) {
+        uint64_t *row = ring_row(ring, y, window_size, row_words);
+        pack_planes(src, y, x0, span, planes, thresholds, words, row);
+        for (int p = 0; p < planes && thresholds; p++) {
+            column_zero_counts(column + (size_t)p * slices * words, row + (size_t)p * words, false, words, slices);
+        }
+    }
+    
+    for (int y = start_row; y < end_row; y++) {
+        // Строка y + r занимает ячейку кольца строки y - r - 1, которая
+        // уходит из окна: ее нули вычитаются из счетчиков столбцов
+        uint64_t *last = ring_row(ring, y + radius, window_size, row_words);
+        for (int p = 0; p < planes && thresholds && y > start_row; p++) {
+            column_zero_counts(column + (size_t)p * slices * words, last + (size_t)p * words, true, words, slices);
+        }
+        pack_planes(src, y + radius, x0, span, planes, thresholds, words, last);
+        for (int p = 0; p < planes && thresholds; p++) {
+            column_zero_counts(column + (size_t)p * slices * words, last + (size_t)p * words, false, words, slices);
+        }
+        
+        int rows = imin(y + radius, src->height - 1) - imax(y - radius, 0) + 1;
+        for (int j = 0; j < out_words; j++) {
+            bitplane_targets(start_col + j * 64, imin(64, cols - j * 64), rows, src->width, window_size,
+                             percentile, slices, target + (size_t)j * slices);
+        }
+        memset(result, 0, (size_t)bits * out_words * sizeof(uint64_t));
+        
+        if (thresholds) {
+            // Ранг двоичного окна равен 1, если нулей в нем не больше ранга
+            for (int p = 0; p < planes; p++) {
+                window_zero_counts(column + (size_t)p * slices * words, window_size, words, slices, power, sum);
+                for (int j = 0; j < out_words; j++) {
+                    for (int s = 0; s < slices; s++) counter[s] = sum[(size_t)s * words + j];
+                    uint64_t above = slice_not_greater(counter, target + (size_t)j * slices, slices);
+                    slice_increment(result + (size_t)j * bits, bits, above);
+                }
+            }
+        } else {
+            for (int j = 0; j < out_words; j++) {
+                for (int e = 0; e < area; e++) {
+                    equal[e] = ~0ULL;
+                    less[e] = 0;
+                }
+                
+                // Бит уровня равен 1, если значений меньше уровня с этим
+                // битом (и выбранными старшими) не больше ранга
+                for (int b = bits - 1; b >= 0; b--) {
+                    memset(counter, 0, slices * sizeof(uint64_t));
+                    for (int dy = 0, e = 0; dy < window_size; dy++) {
+                        const uint64_t *plane = ring_row(ring, y - radius + dy, window_size, row_words) +
+                                                (size_t)b * words;
+                        for (int dx = 0; dx < window_size; dx++, e++) {
+                            current[e] = bit_window(plane, words, j * 64 + dx);
+                            slice_increment(counter, slices, less[e] | (equal[e] & ~current[e]));
+                        }
+                    }
+                    uint64_t set = slice_not_greater(counter, target + (size_t)j * slices, slices);
+                    for (int e = 0; e < area; e++) {
+                        less[e] |= equal[e] & ~current[e] & set;
+                        equal[e] &= ~(current[e] ^ set);
+                    }
+                    result[(size_t)j * bits + b] = set;
+                }
+            }
+        }
+        
+        // Обратно из срезов в номера уровней
+        int *out = MATRIX_ROW(dst, y) + start_col;
+        for (int j = 0; j < out_words; j++) {
+            const uint64_t *level_bits = result + (size_t)j * bits;
+            for (int i = 0; i < 64 && j * 64 + i < cols; i++) {
+                int level = 0;
+                for (int b = 0; b < bits; b++) level |= (int)(level_bits[b] >> i & 1) << b;
+                out[j * 64 + i] = level;
+            }
+        }
+    }
+    
+    scratch->used = mark;
+    return true;
+}
+
+// Сети сравнения-обмена. Сортировки 3, 5 и 7 элементов оптимальны,
+// 13 и 29 построены алгоритмом Бэтчера (merge-exchange). CE(a, i, j)
+// упорядочивает пару a[i] <= a[j] и задается конкретным ядром
+#define SORT_NET_3(CE, a) \
+    CE(a, 0, 2) CE(a, 0, 1) CE(a, 1, 2)
+#define SORT_NET_5(CE, a) \
+    CE(a, 0, 3) CE(a, 1, 4) CE(a, 0, 2) CE(a, 1, 3) CE(a, 0, 1) CE(a, 2, 4) CE(a, 1, 2) \
+    CE(a, 3, 4) CE(a, 2, 3)
+#define SORT_NET_7(CE, a) \
+    CE(a, 0, 6) CE(a, 2, 3) CE(a, 4, 5) CE(a, 0, 2) CE(a, 1, 4) CE(a, 3, 6) CE(a, 0, 1) \
+    CE(a, 2, 5) CE(a, 3, 4) CE(a, 1, 2) CE(a, 4, 6) CE(a, 2, 3) CE(a, 4, 5) CE(a, 1, 2) \
+    CE(a, 3, 4) CE(a, 5, 6)
+#define SORT_NET_13(CE, a) \
+    CE(a, 0, 8) CE(a, 1, 9) CE(a, 2, 10) CE(a, 3, 11) CE(a, 4, 12) CE(a, 0, 4) CE(a, 1, 5) \
+    CE(a, 2, 6) CE(a, 3, 7) CE(a, 8, 12) CE(a, 4, 8) CE(a, 5, 9) CE(a, 6, 10) CE(a, 7, 11) \
+    CE(a, 0, 2) CE(a, 1, 3) CE(a, 4, 6) CE(a, 5, 7) CE(a, 8, 10) CE(a, 9, 11) CE(a, 2, 8) \
+    CE(a, 3, 9) CE(a, 6, 12) CE(a, 2, 4) CE(a, 3, 5) CE(a, 6, 8) CE(a, 7, 9) CE(a, 10, 12) \
+    CE(a, 0, 1) CE(a, 2, 3) CE(a, 4, 5) CE(a, 6, 7) CE(a, 8, 9) CE(a, 10, 11) CE(a, 1, 8) \
+    CE(a, 3, 10) CE(a, 5, 12) CE(a, 1, 4) CE(a, 3, 6) CE(a, 5, 8) CE(a, 7, 10) CE(a, 9, 12) \
+    CE(a, 1, 2) CE(a, 3, 4) CE(a, 5, 6) CE(a, 7, 8) CE(a, 9, 10) CE(a, 11, 12)
+#define SORT_NET_29(CE, a) \
+    CE(a, 0, 16) CE(a, 1, 17) CE(a, 2, 18) CE(a, 3, 19) CE(a, 4, 20) CE(a, 5, 21) CE(a, 6, 22) \
+    CE(a, 7, 23) CE(a, 8, 24) CE(a, 9, 25) CE(a, 10, 26) CE(a, 11, 27) CE(a, 12, 28) CE(a, 0, 8) \
+    CE(a, 1, 9) CE(a, 2, 10) CE(a, 3, 11) CE(a, 4, 12) CE(a, 5, 13) CE(a, 6, 14) CE(a, 7, 15) \
+    CE(a, 16, 24) CE(a, 17, 25) CE(a, 18, 26) CE(a, 19, 27) CE(a, 20, 28) CE(a, 8, 16) \
+    CE(a, 9, 17) CE(a, 10, 18) CE(a, 11, 19) CE(a, 12, 20) CE(a, 13, 21) CE(a, 14, 22) \
+    CE(a, 15, 23) CE(a, 0, 4) CE(a, 1, 5) CE(a, 2, 6) CE(a, 3, 7) CE(a, 8, 12) CE(a, 9, 13) \
+    CE(a, 10, 14) CE(a, 11, 15) CE(a, 16, 20) CE(a, 17, 21) CE(a, 18, 22) CE(a, 19, 23) \
+    CE(a, 24, 28) CE(a, 4, 16) CE(a, 5, 17) CE(a, 6, 18) CE(a, 7, 19) CE(a, 12, 24) \
+    CE(a, 13, 25) CE(a, 14, 26) CE(a, 15, 27) CE(a, 4, 8) CE(a, 5, 9) CE(a, 6, 10) CE(a, 7, 11) \
+    CE(a, 12, 16) CE(a, 13, 17) CE(a, 14, 18) CE(a, 15, 19) CE(a, 20, 24) CE(a, 21, 25) \
+    CE(a, 22, 26) CE(a, 23, 27) CE(a, 0, 2) CE(a, 1, 3) CE(a, 4, 6) CE(a, 5, 7) CE(a, 8, 10) \
+    CE(a, 9, 11) CE(a, 12, 14) CE(a, 13, 15) CE(a, 16, 18) CE(a, 17, 19) CE(a, 20, 22) \
+    CE(a, 21, 23) CE(a, 24, 26) CE(a, 25, 27) CE(a, 2, 16) CE(a, 3, 17) CE(a, 6, 20) \
+    CE(a, 7, 21) CE(a, 10, 24) CE(a, 11, 25) CE(a, 14, 28) CE(a, 2, 8) CE(a, 3, 9) CE(a, 6, 12) \
+    CE(a, 7, 13) CE(a, 10, 16) CE(a, 11, 17) CE(a, 14, 20) CE(a, 15, 21) CE(a, 18, 24) \
+    CE(a, 19, 25) CE(a, 22, 28) CE(a, 2, 4) CE(a, 3, 5) CE(a, 6, 8) CE(a, 7, 9) CE(a, 10, 12) \
+    CE(a, 11, 13) CE(a, 14, 16) CE(a, 15, 17) CE(a, 18, 20) CE(a, 19, 21) CE(a, 22, 24) \
+    CE(a, 23, 25) CE(a, 26, 28) CE(a, 0, 1) CE(a, 2, 3) CE(a, 4, 5) CE(a, 6, 7) CE(a, 8, 9) \
+    CE(a, 10, 11) CE(a, 12, 13) CE(a, 14, 15) CE(a, 16, 17) CE(a, 18, 19) CE(a, 20, 21) \
+    CE(a, 22, 23) CE(a, 24, 25) CE(a, 26, 27) CE(a, 1, 16) CE(a, 3, 18) CE(a, 5, 20) \
+    CE(a, 7, 22) CE(a, 9, 24) CE(a, 11, 26) CE(a, 13, 28) CE(a, 1, 8) CE(a, 3, 10) CE(a, 5, 12) \
+    CE(a, 7, 14) CE(a, 9, 16) CE(a, 11, 18) CE(a, 13, 20) CE(a, 15, 22) CE(a, 17, 24) \
+    CE(a, 19, 26) CE(a, 21, 28) CE(a, 1, 4) CE(a, 3, 6) CE(a, 5, 8) CE(a, 7, 10) CE(a, 9, 12) \
+    CE(a, 11, 14) CE(a, 13, 16) CE(a, 15, 18) CE(a, 17, 20) CE(a, 19, 22) CE(a, 21, 24) \
+    CE(a, 23, 26) CE(a, 25, 28) CE(a, 1, 2) CE(a, 3, 4) CE(a, 5, 6) CE(a, 7, 8) CE(a, 9, 10) \
+    CE(a, 11, 12) CE(a, 13, 14) CE(a, 15, 16) CE(a, 17, 18) CE(a, 19, 20) CE(a, 21, 22) \
+    CE(a, 23, 24) CE(a, 25, 26) CE(a, 27, 28)
+#define NET_CANDIDATES_3(g, c) \
+    c[0] = g[2]; c[1] = g[4]; c[2] = g[6];
+#define NET_CANDIDATE_COUNT_3 3
+#define NET_CANDIDATE_RANK_3 1
+#define NET_CANDIDATES_5(g, c) \
+    c[0] = g[3]; c[1] = g[4]; c[2] = g[7]; c[3] = g[8]; c[4] = g[9]; c[5] = g[11]; c[6] = g[12]; \
+    c[7] = g[13]; c[8] = g[15]; c[9] = g[16]; c[10] = g[17]; c[11] = g[20]; c[12] = g[21];
+#define NET_CANDIDATE_COUNT_5 13
+#define NET_CANDIDATE_RANK_5 6
+#define NET_CANDIDATES_7(g, c) \
+    c[0] = g[4]; c[1] = g[5]; c[2] = g[6]; c[3] = g[10]; c[4] = g[11]; c[5] = g[12]; \
+    c[6] = g[13]; c[7] = g[16]; c[8] = g[17]; c[9] = g[18]; c[10] = g[19]; c[11] = g[20]; \
+    c[12] = g[22]; c[13] = g[23]; c[14] = g[24]; c[15] = g[25]; c[16] = g[26]; c[17] = g[28]; \
+    c[18] = g[29]; c[19] = g[30]; c[20] = g[31]; c[21] = g[32]; c[22] = g[35]; c[23] = g[36]; \
+    c[24] = g[37]; c[25] = g[38]; c[26] = g[42]; c[27] = g[43]; c[28] = g[44];
+#define NET_CANDIDATE_COUNT_7 29
+#define NET_CANDIDATE_RANK_7 14
+
+// Кандидаты в медиану: после сортировки столбцов и строк рангов элемент
+// g[i][j] не меньше (i+1)(j+1)-1 и не больше (N-i)(N-j)-1 других, поэтому
+// медиана окна N x N находится среди NET_CANDIDATE_COUNT_N элементов
+// на позиции NET_CANDIDATE_RANK_N (остальные заведомо меньше или больше)
+
+// Сравнение-обмен для скалярных значений (без ветвлений)
+#define CE_INT(a, i, j) { \
+    int lo_ = (a)[i] < (a)[j] ? (a)[i] : (a)[j]; \
+    int hi_ = (a)[i] < (a)[j] ? (a)[j] : (a)[i]; \
+    (a)[i] = lo_; (a)[j] = hi_; }
+
+#define LOAD_INT(p) (*(p))
+#define STORE_INT(p, v) (*(p) = (v))
+
+// Сортировка столбца окна в точке x строки y
+#define NETWORK_COLUMN(N, T, LOAD, STORE, CE, src, cols, width, y, x) { \
+    T v_[N]; \
+    _Pragma("GCC unroll 8") \
+    for (int k_ = 0; k_ < N; k_++) v_[k_] = LOAD(MATRIX_ROW(src, (y) - N / 2 + k_) + (x)); \
+    SORT_NET_##N(CE, v_) \
+    _Pragma("GCC unroll 8") \
+    for (int k_ = 0; k_ < N; k_++) STORE(&(cols)[k_ * (width) + (x)], v_[k_]); }
+
+// Медиана окна с центром в x по отсортированным столбцам
+#define NETWORK_PIXEL(N, C, T, LOAD, STORE, CE, cols, width, out, x) { \
+    T g_[N * N], c_[C]; \
+    _Pragma("GCC unroll 8") \
+    for (int i_ = 0; i_ < N; i_++) { \
+        _Pragma("GCC unroll 8") \
+        for (int j_ = 0; j_ < N; j_++) g_[i_ * N + j_] = LOAD(&(cols)[i_ * (width) + (x) - N / 2 + j_]); \
+        SORT_NET_##N(CE, g_ + i_ * N) \
+    } \
+    NET_CANDIDATES_##N(g_, c_) \
+    SORT_NET_##C(CE, c_) \
+    STORE(out, c_[NET_CANDIDATE_RANK_##N]); }
+
+// Векторные операции: одна полоса вектора - один выходной пиксель
+#define CE_SSE(a, i, j) { __m128i lo_ = _mm_min_epi32((a)[i], (a)[j]); \
+    (a)[j] = _mm_max_epi32((a)[i], (a)[j]); (a)[i] = lo_; }
+#define LOAD_SSE(p) _mm_loadu_si128((const __m128i*)(p))
+#define STORE_SSE(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+
+#define CE_AVX2(a, i, j) { __m256i lo_ = _mm256_min_epi32((a)[i], (a)[j]); \
+    (a)[j] = _mm256_max_epi32((a)[i], (a)[j]); (a)[i] = lo_; }
+#define LOAD_AVX2(p) _mm256_loadu_si256((const __m256i*)(p))
+#define STORE_AVX2(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+
+#define CE_AVX512(a, i, j) { __m512i lo_ = _mm512_min_epi32((a)[i], (a)[j]); \
+    (a)[j] = _mm512_max_epi32((a)[i], (a)[j]); (a)[i] = lo_; }
+#define LOAD_AVX512(p) _mm512_loadu_si512((const void*)(p))
+#define STORE_AVX512(p, v) _mm512_storeu_si512((void*)(p), (v))
+
+// Ядро для окна N x N: пиксели [x_begin, x_end) строк [start_row, end_row).
+// cols - буфер N * width отсортированных столбцов текущей строки.
+// Основной цикл обрабатывает по LANES соседних пикселей; последний вектор
+// сдвигается назад и перекрывает предыдущий, скалярно считаются только
+// участки короче вектора
+#define DEFINE_NETWORK_KERNEL(NAME, N, C, ATTR, T, LANES, LOAD, STORE, CE) \
+ATTR static void NAME(const matrix_t *src, matrix_t *dst, int *cols, \
+                      int start_row, int end_row, int x_begin, int x_end) { \
+    int width = src->width; \
+    int col_begin = x_begin - N / 2; \
+    int col_end = x_end + N / 2; \
+    for (int y = start_row; y < end_row; y++) { \
+        int x = col_begin; \
+        for (; x < col_end && col_end - col_begin >= LANES; x += LANES) { \
+            if (x + LANES > col_end) x = col_end - LANES; \
+            NETWORK_COLUMN(N, T, LOAD, STORE, CE, src, cols, width, y, x) \
+        } \
+        for (; x < col_end; x++) { \
+            NETWORK_COLUMN(N, int, LOAD_INT, STORE_INT, CE_INT, src, cols, width, y, x) \
+        } \
+        int *out = MATRIX_ROW(dst, y); \
+        for (x = x_begin; x < x_end && x_end - x_begin >= LANES; x += LANES) { \
+            if (x + LANES > x_end) x = x_end - LANES; \
+            NETWORK_PIXEL(N, C, T, LOAD, STORE, CE, cols, width, out + x, x) \
+        } \
+        for (; x < x_end; x++) { \
+            NETWORK_PIXEL(N, C, int, LOAD_INT, STORE_INT, CE_INT, cols, width, out + x, x) \
+        } \
+    } \
+}
+
+#define DEFINE_NETWORK_KERNELS(SUFFIX, ATTR, T, LANES, LOAD, STORE, CE) \
+    DEFINE_NETWORK_KERNEL(network_3_##SUFFIX, 3, 3, ATTR, T, LANES, LOAD, STORE, CE) \
+    DEFINE_NETWORK_KERNEL(network_5_##SUFFIX, 5, 13, ATTR, T, LANES, LOAD, STORE, CE) \
+    DEFINE_NETWORK_KERNEL(network_7_##SUFFIX, 7, 29, ATTR, T, LANES, LOAD, STORE, CE)
+
+DEFINE_NETWORK_KERNELS(scalar, , int, 1, LOAD_INT, STORE_INT, CE_INT)
+DEFINE_NETWORK_KERNELS(sse41, __attribute__((target("sse4.1"))), __m128i, 4, LOAD_SSE, STORE_SSE, CE_SSE)
+DEFINE_NETWORK_KERNELS(avx2, __attribute__((target("avx2"))), __m256i, 8, LOAD_AVX2, STORE_AVX2, CE_AVX2)
+DEFINE_NETWORK_KERNELS(avx512, __attribute__((target("avx512f"))), __m512i, 16,
+                       LOAD_AVX512, STORE_AVX512, CE_AVX512)
+
+typedef void (*network_kernel_t)(const matrix_t*, matrix_t*, int*, int, int, int, int);
+
+// Наборы ядер для окон 3, 5 и 7 (в порядке simd_level_t)
+static const network_kernel_t network_kernels[SIMD_COUNT][3] = {
+    { network_3_scalar, network_5_scalar, network_7_scalar },
+    { network_3_sse41, network_5_sse41, network_7_sse41 },
+    { network_3_avx2, network_5_avx2, network_7_avx2 },
+    { network_3_avx512, network_5_avx512, network_7_avx512 }
+};
+
+simd_level_t detect_simd_level(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE41;
+    return SIMD_SCALAR;
+}
+
+bool apply_median_filter_iteration_network(const matrix_t *src, matrix_t *dst, int window_size,
+                                           simd_level_t simd, scratch_arena_t *scratch, int start_row,
+                                           int end_row, int start_col, int end_col) {
+    int radius = window_size / 2;
+    
+    if (window_size != 3 && window_size != 5 && window_size != 7) return false;
+    if (start_row >= end_row || start_col >= end_col) return true;
+    
+    size_t mark = scratch ? scratch->used : 0;
+    int *cols = scratch_alloc(scratch, (size_t)window_size * src->width * sizeof(int));
+    if (!cols) return false;
+    
+    network_kernels[simd][radius - 1](src, dst, cols, start_row, end_row, start_col, end_col);
+    
+    scratch->used = mark;
+    return true;
+}
+
+// КОМПАКТНЫЕ ТИПЫ
+// Те же сети сравнения-обмена над 8- и 16-битными значениями без знака:
+// в векторе в 4 (2) раза больше полос, чем для int, и во столько же раз
+// меньше памяти читается и пишется за итерацию
+#define CE_U8_SSE(a, i, j) { __m128i lo_ = _mm_min_epu8((a)[i], (a)[j]); \
+    (a)[j] = _mm_max_epu8((a)[i], (a)[j]); (a)[i] = lo_; }
+#define CE_U16_SSE(a, i, j) { __m128i lo_ = _mm_min_epu16((a)[i], (a)[j]); \
+    (a)[j] = _mm_max_epu16((a)[i], (a)[j]); (a)[i] = lo_; }
+#define CE_U8_AVX2(a, i, j) { __m256i lo_ = _mm256_min_epu8((a)[i], (a)[j]); \
+    (a)[j] = _mm256_max_epu8((a)[i], (a)[j]); (a)[i] = lo_; }
+#define CE_U16_AVX2(a, i, j) { __m256i lo_ = _mm256_min_epu16((a)[i], (a)[j]); \
+    (a)[j] = _mm256_max_epu16((a)[i], (a)[j]); (a)[i] = lo_; }
+#define CE_U8_AVX512(a, i, j) { __m512i lo_ = _mm512_min_epu8((a)[i], (a)[j]); \
+    (a)[j] = _mm512_max_epu8((a)[i], (a)[j]); (a)[i] = lo_; }
+#define CE_U16_AVX512(a, i, j) { __m512i lo_ = _mm512_min_epu16((a)[i], (a)[j]); \
+    (a)[j] = _mm512_max_epu16((a)[i], (a)[j]); (a)[i] = lo_; }
+
+// Ядро для окна N x N над плоскостью элементов E: пиксели [x_begin, x_end)
+// строк [start_row, end_row), как DEFINE_NETWORK_KERNEL. Строки плоскости
+// читаются через представление с полями data и stride нужного типа
+#define DEFINE_COMPACT_KERNEL(NAME, N, C, ATTR, E, T, LANES, LOAD, STORE, CE) \
+ATTR static void NAME(const compact_plane_t *plane, compact_plane_t *target, void *buffer, \
+                      int start_row, int end_row, int x_begin, int x_end) { \
+    struct { E *data; int stride; } src_ = { plane->data, plane->stride }, *src = &src_; \
+    struct { E *data; int stride; } dst_ = { target->data, target->stride }, *dst = &dst_; \
+    E *cols = buffer; \
+    int width = plane->width; \
+    int col_begin = x_begin - N / 2; \
+    int col_end = x_end + N / 2; \
+    for (int y = start_row; y < end_row; y++) { \
+        int x = col_begin; \
+        for (; x < col_end && col_end - col_begin >= LANES; x += LANES) { \
+            if (x + LANES > col_end) x = col_end - LANES; \
+            NETWORK_COLUMN(N, T, LOAD, STORE, CE, src, cols, width, y, x) \
+        } \
+        for (; x < col_end; x++) { \
+            NETWORK_COLUMN(N, E, LOAD_INT, STORE_INT, CE_INT, src, cols, width, y, x) \
+        } \
+        E *out = MATRIX_ROW(dst, y); \
+        for (x = x_begin; x < x_end && x_end - x_begin >= LANES; x += LANES) { \
+            if (x + LANES > x_end) x = x_end - LANES; \
+            NETWORK_PIXEL(N, C, T, LOAD, STORE, CE, cols, width, out + x, x) \
+        } \
+        for (; x < x_end; x++) { \
+            NETWORK_PIXEL(N, C, E, LOAD_INT, STORE_INT, CE_INT, cols, width, out + x, x) \
+        } \
+    } \
+}
+
+#define DEFINE_COMPACT_KERNELS(SUFFIX, ATTR, E, T, LANES, LOAD, STORE, CE) \
+    DEFINE_COMPACT_KERNEL(compact_3_##SUFFIX, 3, 3, ATTR, E, T, LANES, LOAD, STORE, CE) \
+    DEFINE_COMPACT_KERNEL(compact_5_##SUFFIX, 5, 13, ATTR, E, T, LANES, LOAD, STORE, CE) \
+    DEFINE_COMPACT_KERNEL(compact_7_##SUFFIX, 7, 29, ATTR, E, T, LANES, LOAD, STORE, CE)
+
+DEFINE_COMPACT_KERNELS(u8_scalar, , uint8_t, uint8_t, 1, LOAD_INT, STORE_INT, CE_INT)
+DEFINE_COMPACT_KERNELS(u8_sse41, __attribute__((target("sse4.1"))), uint8_t, __m128i, 16,
+                       LOAD_SSE, STORE_SSE, CE_U8_SSE)
+DEFINE_COMPACT_KERNELS(u8_avx2, __attribute__((target("avx2"))), uint8_t, __m256i, 32,
+                       LOAD_AVX2, STORE_AVX2, CE_U8_AVX2)
+DEFINE_COMPACT_KERNELS(u8_avx512, __attribute__((target("avx512f,avx512bw"))), uint8_t, __m512i, 64,
+                       LOAD_AVX512, STORE_AVX512, CE_U8_AVX512)
+DEFINE_COMPACT_KERNELS(u16_scalar, , uint16_t, uint16_t, 1, LOAD_INT, STORE_INT, CE_INT)
+DEFINE_COMPACT_KERNELS(u16_sse41, __attribute__((target("sse4.1"))), uint16_t, __m128i, 8,
+                       LOAD_SSE, STORE_SSE, CE_U16_SSE)
+DEFINE_COMPACT_KERNELS(u16_avx2, __attribute__((target("avx2"))), uint16_t, __m256i, 16,
+                       LOAD_AVX2, STORE_AVX2, CE_U16_AVX2)
+DEFINE_COMPACT_KERNELS(u16_avx512, __attribute__((target("avx512f,avx512bw"))), uint16_t, __m512i, 32,
+                       LOAD_AVX512, STORE_AVX512, CE_U16_AVX512)
+
+typedef void (*compact_kernel_t)(const compact_plane_t*, compact_plane_t*, void*, int, int, int, int);
+
+// Наборы ядер для 8- и 16-битных значений и окон 3, 5 и 7 (в порядке simd_level_t)
+static const compact_kernel_t compact_kernels[2][SIMD_COUNT][3] = {
+    {
+        { compact_3_u8_scalar, compact_5_u8_scalar, compact_7_u8_scalar },
+        { compact_3_u8_sse41, compact_5_u8_sse41, compact_7_u8_sse41 },
+        { compact_3_u8_avx2, compact_5_u8_avx2, compact_7_u8_avx2 },
+        { compact_3_u8_avx512, compact_5_u8_avx512, compact_7_u8_avx512 }
+    },
+    {
+        { compact_3_u16_scalar, compact_5_u16_scalar, compact_7_u16_scalar },
+        { compact_3_u16_sse41, compact_5_u16_sse41, compact_7_u16_sse41 },
+        { compact_3_u16_avx2, compact_5_u16_avx2, compact_7_u16_avx2 },
+        { compact_3_u16_avx512, compact_5_u16_avx512, compact_7_u16_avx512 }
+    }
+};
+
+// Функция для чтения значения плоскости как int
+static inline int compact_get(const compact_plane_t *plane, int x, int y) {
+    size_t index = (size_t)y * plane->stride + x;
+    return plane->element_size == 1 ? ((const uint8_t*)plane->data)[index]
+                                    : ((const uint16_t*)plane->data)[index];
+}
+
+// Функция для медианы граничного пикселя плоскости: окно обрезается
+// краями, как в apply_median_filter_border. window - буфер на w*w значений
+static int compact_border_pixel(const compact_plane_t *plane, int x, int y, int window_size, int *window) {
+    int radius = window_size / 2;
+    int count = 0;
+    
+    for (int yy = imax(y - radius, 0); yy <= imin(y + radius, plane->height - 1); yy++) {
+        for (int xx = imax(x - radius, 0); xx <= imin(x + radius, plane->width - 1); xx++) {
+            // Вставка в отсортированную часть окна
+            int value = compact_get(plane, xx, yy);
+            int i = count++;
+            for (; i > 0 && window[i - 1] > value; i--) window[i] = window[i - 1];
+            window[i] = value;
+        }
+    }
+    return window[rank_index(count, RANK_MEDIAN)];
+}
+
+size_t compact_scratch_size(int window_size, int width, int element_size) {
+    return (size_t)window_size * width * element_size + (size_t)window_size * window_size * sizeof(int) +
+           SCRATCH_BUFFERS * MATRIX_ALIGNMENT;
+}
+
+bool apply_median_filter_compact(const compact_plane_t *src, compact_plane_t *dst, int window_size,
+                                 simd_level_t simd, scratch_arena_t *scratch, int start_row, int end_row) {
+    int radius = window_size / 2;
+    int width = src->width;
+    int height = src->height;
+    
+    if (window_size != 3 && window_size != 5 && window_size != 7) return false;
+    if (src->element_size != 1 && src->element_size != 2) return false;
+    if (start_row >= end_row) return true;
+    
+    size_t mark = scratch ? scratch->used : 0;
+    void *cols = scratch_alloc(scratch, (size_t)window_size * width * src->element_size);
+    int *window = scratch_alloc(scratch, (size_t)window_size * window_size * sizeof(int));
+    if (!cols || !window) {
+        if (scratch) scratch->used = mark;
+        return false;
+    }
+    
+    // 16-битные сравнения AVX-512 требуют AVX512BW
+    if (simd == SIMD_AVX512 && !__builtin_cpu_supports("avx512bw")) simd = SIMD_AVX2;
+    
+    int inner_begin = imax(start_row, radius);
+    int inner_end = imin(end_row, height - radius);
+    if (width > 2 * radius && inner_begin < inner_end) {
+        compact_kernels[src->element_size - 1][simd][radius - 1](src, dst, cols, inner_begin, inner_end,
+                                                                  radius, width - radius);
+    }
+    
+    // Граничные пиксели: строки у краев целиком, остальные - по radius с каждой стороны
+    for (int y = start_row; y < end_row; y++) {
+        bool edge_row = y < radius || y >= height - radius || width <= 2 * radius;
+        for (int x = 0; x < width; x++) {
+            if (!edge_row && x == radius) x = width - radius;
+            int value = compact_border_pixel(src, x, y, window_size, window);
+            size_t index = (size_t)y * dst->stride + x;
+            if (dst->element_size == 1) ((uint8_t*)dst->data)[index] = (uint8_t)value;
+            else ((uint16_t*)dst->data)[index] = (uint16_t)value;
+        }
+    }
+    
+    scratch->used = mark;
+    return true;
+}
+
+// Функция для выбора минимума или максимума пары
+static inline int min_max(int a, int b, bool maximum) {
+    return maximum ? imax(a, b) : imin(a, b);
+}
+
+// Функция для фильтра минимума (максимума) по строке: out[i] - минимум
+// in[i .. i + window_size), in содержит count + window_size - 1 значений.
+// prefix и suffix - рабочие буферы той же длины
+static void min_max_line(const int *in, int *out, int count, int window_size, bool maximum,
+                         int *prefix, int *suffix) {
+    int length = count + window_size - 1;
+    
+    // Минимумы от начала и от конца каждого блока длины окна
+    for (int b = 0; b < length; b += window_size) {
+        int end = imin(b + window_size, length);
+        prefix[b] = in[b];
+        for (int i = b + 1; i < end; i++) prefix[i] = min_max(prefix[i - 1], in[i], maximum);
+        suffix[end - 1] = in[end - 1];
+        for (int i = end - 2; i >= b; i--) suffix[i] = min_max(suffix[i + 1], in[i], maximum);
+    }
+    
+    // Окно [i, i + window_size) - конец блока с i и начало следующего
+    for (int i = 0; i < count; i++) {
+        out[i] = min_max(suffix[i], prefix[i + window_size - 1], maximum);
+    }
+}
+
+// Функция для горизонтального прохода по строкам [first, first + count)
+// блока: строка k блока пишется в block + k * cols. Ячейки вне матрицы
+// заменяются нейтральным значением, и окно у краев обрезается.
+// line, prefix и suffix - рабочие буферы на cols + window_size - 1 значений
+static void min_max_block_rows(const matrix_t *src, int *block, int first, int count, int cols,
+                               int window_size, bool maximum, int start_col,
+                               int *line, int *prefix, int *suffix) {
+    int radius = window_size / 2;
+    int neutral = maximum ? INT_MIN : INT_MAX;
+    int length = cols + 2 * radius;
+    int x0 = start_col - radius;
+    int left = imin(imax(-x0, 0), length);                 // ячеек левее матрицы
+    int right = imin(imax(x0 + length - src->width, 0), length - left);  // правее
+    
+    for (int k = 0; k < count; k++) {
+        int y = first + k;
+        int *out = block + (size_t)k * cols;
+        if (y < 0 || y >= src->height) {
+            for (int x = 0; x < cols; x++) out[x] = neutral;
+            continue;
+        }
+        
+        const int *in = MATRIX_ROW(src, y) + x0;
+        if (left || right) {
+            for (int x = 0; x < left; x++) line[x] = neutral;
+            memcpy(line + left, in + left, (length - left - right) * sizeof(int));
+            for (int x = length - right; x < length; x++) line[x] = neutral;
+            in = line;
+        }
+        min_max_line(in, out, cols, window_size, maximum, prefix, suffix);
+    }
+}
+
+bool apply_min_max_filter_iteration(const matrix_t *src, matrix_t *dst, int window_size, bool maximum,
+                                    scratch_arena_t *scratch, int start_row, int end_row,
+                                    int start_col, int end_col) {
+    int radius = window_size / 2;
+    
+    if (start_row >= end_row || start_col >= end_col) return true;
+    
+    int rows = end_row - start_row;
+    int cols = end_col - start_col;
+    int length = rows + 2 * radius;   // строк, читаемых вертикальным проходом
+    size_t block_size = (size_t)window_size * cols;
+    
+    // Вертикальный проход идет блоками по window_size строк результатов
+    // горизонтального прохода: нужны суффиксы текущего блока и префиксы
+    // следующего, поэтому в памяти держатся только два блока
+    size_t mark = scratch ? scratch->used : 0;
+    int *current = scratch_alloc(scratch, block_size * sizeof(int));
+    int *next = scratch_alloc(scratch, block_size * sizeof(int));
+    int *prefix = scratch_alloc(scratch, block_size * sizeof(int));
+    int *line = scratch_alloc(scratch, (size_t)(cols + 2 * radius) * 3 * sizeof(int));
+    
+    if (!current || !next || !prefix || !line) {
+        if (scratch) scratch->used = mark;
+        return false;
+    }
+    int *line_prefix = line + cols + 2 * radius;
+    int *line_suffix = line_prefix + cols + 2 * radius;
+    
+    int first = start_row - radius;
+    min_max_block_rows(src, current, first, imin(window_size, length), cols, window_size, maximum,
+                       start_col, line, line_prefix, line_suffix);
+    
+    for (int base = 0; base < rows; base += window_size) {
+        int size = imin(window_size, length - base);
+        int next_size = imin(window_size, length - base - window_size);
+        
+        // Суффиксы текущего блока (на месте)
+        for (int k = size - 2; k >= 0; k--) {
+            int *row = current + (size_t)k * cols;
+            const int *below = row + cols;
+            for (int x = 0; x < cols; x++) row[x] = min_max(row[x], below[x], maximum);
+        }
+        
+        // Следующий блок и его префиксы
+        if (next_size > 0) {
+            min_max_block_rows(src, next, first + base + window_size, next_size, cols, window_size,
+                               maximum, start_col, line, line_prefix, line_suffix);
+            memcpy(prefix, next, cols * sizeof(int));
+            for (int k = 1; k < next_size; k++) {
+                const int *above = prefix + (size_t)(k - 1) * cols;
+                const int *in = next + (size_t)k * cols;
+                int *row = prefix + (size_t)k * cols;
+                for (int x = 0; x < cols; x++) row[x] = min_max(above[x], in[x], maximum);
+            }
+        }
+        
+        // Окно строки base + k - суффикс k текущего блока и префикс k - 1
+        // следующего; окно строки base совпадает с блоком целиком
+        for (int k = 0; k < window_size && base + k < rows; k++) {
+            int *out = MATRIX_ROW(dst, start_row + base + k) + start_col;
+            const int *suffix = current + (size_t)k * cols;
+            if (k == 0) {
+                memcpy(out, suffix, cols * sizeof(int));
+                continue;
+            }
+            const int *head = prefix + (size_t)(k - 1) * cols;
+            for (int x = 0; x < cols; x++) out[x] = min_max(suffix[x], head[x], maximum);
+        }
+        
+        int *swap = current;
+        current = next;
+        next = swap;
+    }
+    
+    scratch->used = mark;
+    return true;
+}
+
+// Функция для значения граничного пикселя: выбор без сортировки окна
+static int border_pixel(const matrix_t *src, int x, int y, int window_size, int percentile, int *window) {
+    int count = gather_window(src, x, y, window_size, window);
+    return select_rank(window, count, rank_index(count, percentile));
+}
+
+bool apply_median_filter_border(const matrix_t *src, matrix_t *dst, int window_size, int percentile,
+                                scratch_arena_t *scratch, int start_row, int end_row,
+                                int start_col, int end_col) {
+    int radius = window_size / 2;
+    int left_end = imin(end_col, radius);
+    int right_begin = imax(imax(start_col, src->width - radius), left_end);
+    
+    size_t mark = scratch ? scratch->used : 0;
+    int *heap;
+    int *window = window_buffer(scratch, window_size, &heap);
+    if (!window) return false;
+    
+    for (int y = start_row; y < end_row; y++) {
+        int *out = MATRIX_ROW(dst, y);
+        if (y < radius || y >= src->height - radius) {
+            for (int x = start_col; x < end_col; x++) {
+                out[x] = border_pixel(src, x, y, window_size, percentile, window);
+            }
+            continue;
+        }
+        for (int x = start_col; x < left_end; x++) {
+            out[x] = border_pixel(src, x, y, window_size, percentile, window);
+        }
+        for (int x = right_begin; x < end_col; x++) {
+            out[x] = border_pixel(src, x, y, window_size, percentile, window);
+        }
+    }
+    
+    free(heap);
+    if (scratch) scratch->used = mark;
+    return true;
+}
+
+filter_algorithm_t select_algorithm(filter_algorithm_t algorithm, int window_size, int percentile) {
+    bool has_network = window_size == 3 || window_size == 5 || window_size == 7;
+    bool min_max = percentile == RANK_MIN || percentile == RANK_MAX;
+    
+    if (algorithm == ALGO_AUTO) {
+        if (min_max) return ALGO_VAN_HERK;
+        return has_network && percentile == RANK_MEDIAN ? ALGO_NETWORK : ALGO_HISTOGRAM;
+    }
+    if (algorithm == ALGO_NETWORK && percentile != RANK_MEDIAN) {
+        fprintf(stderr, "Warning: Sorting networks only select the median, falling back to sort\n");
+        return ALGO_SORT;
+    }
+    if (algorithm == ALGO_NETWORK && !has_network) {
+        fprintf(stderr, "Warning: No sorting network for window %d, falling back to sort\n", window_size);
+        return ALGO_SORT;
+    }
+    if (algorithm == ALGO_VAN_HERK && !min_max) {
+        fprintf(stderr, "Warning: van Herk/Gil-Werman only selects the minimum or maximum, falling back to sort\n");
+        return ALGO_SORT;
+    }
+    return algorithm;
+}
+
+bool filter_rect(const matrix_t *src, matrix_t *dst, const filter_params_t *params,
+                 scratch_arena_t *scratch, int start_row, int end_row, int start_col, int end_col) {
+    int window_size = params->window_size;
+    int radius = window_size / 2;
+    
+    // Минимум и максимум считаются вместе с краями: окно обрезается
+    // подстановкой нейтрального значения за пределами матрицы
+    if (params->algorithm == ALGO_VAN_HERK &&
+        apply_min_max_filter_iteration(src, dst, window_size, params->percentile == RANK_MAX, scratch,
+                                       start_row, end_row, start_col, end_col)) {
+        return true;
+    }
+    
+    // Битовые плоскости и гистограммы тоже: ячейки за краем больше любого
+    // уровня
+    if (params->algorithm == ALGO_BITPLANE &&
+        apply_median_filter_iteration_bitplane(src, dst, window_size, params->percentile, params->levels,
+                                               scratch, start_row, end_row, start_col, end_col)) {
+        return true;
+    }
+    if (params->algorithm == ALGO_HISTOGRAM &&
+        apply_median_filter_iteration_histogram(src, dst, window_size, params->percentile, params->levels,
+                                                scratch, start_row, end_row, start_col, end_col)) {
+        return true;
+    }
+    
+    // Внутренняя часть, где окно целиком помещается в матрицу
+    int first_row = imax(start_row, radius);
+    int last_row = imin(end_row, src->height - radius);
+    int first_col = imax(start_col, radius);
+    int last_col = imin(end_col, src->width - radius);
+    
+    if (first_row < last_row && first_col < last_col) {
+        bool done = false;
+        if (params->algorithm == ALGO_NETWORK) {
+            done = apply_median_filter_iteration_network(src, dst, window_size, params->simd, scratch,
+                                                         first_row, last_row, first_col, last_col);
+        }
+        
+        // Эталонный путь (и запасной при нехватке рабочей памяти)
+        if (!done && !apply_median_filter_iteration(src, dst, window_size, params->percentile, scratch,
+                                                    first_row, last_row, first_col, last_col)) {
+            return false;
+        }
+    }
+    
+    return apply_median_filter_border(src, dst, window_size, params->percentile, scratch, start_row, end_row,
+                                      start_col, end_col);
+}
+
+bool filter_rows(const matrix_t *src, matrix_t *dst, const filter_params_t *params,
+                 scratch_arena_t *scratch, int start_row, int end_row) {
+    return filter_rect(src, dst, params, scratch, start_row, end_row, 0, src->width);
+}
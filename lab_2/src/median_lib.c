@@ -0,0 +1,2600 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "../include/thread_pool.h"
+#include "../include/text_io.h"
+#include "../include/instrument.h"
+#include "../include/median_kernels.h"
+#include "../include/median_lib.h"
+
+// Двоичный формат матрицы (.bin): заголовок, затем строки по stride байт,
+// начиная со смещения data_offset. Числа в порядке байтов x86 (little-endian)
+#define MATRIX_BIN_MAGIC "MEDMATRX"
+#define MATRIX_BIN_VERSION 1
+#define MATRIX_BIN_INT32 1  // тип элемента: знаковое 32-битное целое
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t element_type;
+    uint32_t height;
+    uint32_t width;
+    uint64_t stride;        // байт между началами строк
+    uint64_t data_offset;   // байт от начала файла до первой строки
+    uint8_t reserved[24];   // до 64 байт: строки выровнены по кэш-линии
+} matrix_bin_header_t;
+
+// Задание для пула потоков: все проходы фильтра по всем плиткам.
+// Проход p читает buffers[p % 2] и пишет buffers[(p + 1) % 2]; плитка
+// начинает проход, как только соседние плитки завершили предыдущий
+typedef struct {
+    matrix_t *buffers[2];
+    const filter_params_t *params;
+    int k_iters;
+    int passes;                        // проходов по fuse_depth итераций
+    struct tile_scheduler *scheduler;  // очереди готовых плиток с кражей работы
+    matrix_t **tile_buffers;           // по два буфера плитки на поток
+    scratch_arena_t *scratch;          // рабочая память ядер, по одной на поток
+    int tiles_x;
+    int tiles_y;
+    int reach;                         // радиус соседства в плитках
+    atomic_int *pending;               // [2 * tile + p % 2]: соседей, не завершивших проход p - 1
+    int *tile_pass;                    // следующий проход плитки
+    atomic_int remaining;              // невыполненных пар (плитка, проход)
+    
+    // Пропуск неизменившихся плиток (NULL без params->skip_clean)
+    unsigned char *changed;            // [2 * tile + p % 2]: изменил ли проход p плитку
+    atomic_int *pass_left;             // [p]: плиток, не завершивших проход p
+    atomic_int *pass_changed;          // [p]: плиток, измененных проходом p
+    atomic_int converged_pass;         // первый проход без изменений (INT_MAX - нет)
+    atomic_int stop_pass;              // проход, после которого потоки остановлены
+} filter_job_t;
+
+// Функция для проверки расширения имени файла
+static bool has_extension(const char *filename, const char *extension) {
+    size_t length = strlen(filename), ext_length = strlen(extension);
+    return length >= ext_length && strcmp(filename + length - ext_length, extension) == 0;
+}
+
+// Функция для имени временного файла вывода: результат пишется в
+// <filename>.tmp и переименовывается поверх filename, поэтому вход,
+// отображенный из того же файла, не затирается до конца записи.
+// Устройства и каналы (/dev/null, fifo) пишутся напрямую - temp пуст
+static bool output_temp_path(const char *filename, char *temp, size_t size) {
+    struct stat st;
+    temp[0] = '\0';
+    if (stat(filename, &st) == 0 && !S_ISREG(st.st_mode)) return true;
+    if (snprintf(temp, size, "%s.tmp", filename) < (int)size) return true;
+    fprintf(stderr, "Error: Output path %s is too long\n", filename);
+    return false;
+}
+
+// Функция для завершения вывода: временный файл заменяет filename
+// или удаляется при ошибке записи
+static bool output_commit(const char *temp, const char *filename, bool ok) {
+    if (temp[0] == '\0') return ok;
+    if (ok && rename(temp, filename) != 0) {
+        fprintf(stderr, "Error: Cannot replace file %s\n", filename);
+        ok = false;
+    }
+    if (!ok) unlink(temp);
+    return ok;
+}
+
+// Функция для чтения матрицы из двоичного файла: строки не копируются
+// (рамки нет). Отображение частное: запись в матрицу (фильтр на месте)
+// не меняет файл, страницы копируются при первой записи. Результат в тот
+// же файл пишется через переименование (write_matrix), иначе усечение
+// файла обнулило бы еще не скопированные страницы
+static matrix_t* read_matrix_binary(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(matrix_bin_header_t)) {
+        fprintf(stderr, "Error: Invalid file format\n");
+        close(fd);
+        return NULL;
+    }
+    
+    size_t size = st.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map file %s\n", filename);
+        return NULL;
+    }
+    
+    const matrix_bin_header_t *header = mapping;
+    uint64_t row_bytes = (uint64_t)header->width * sizeof(int);
+    if (memcmp(header->magic, MATRIX_BIN_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MATRIX_BIN_VERSION || header->element_type != MATRIX_BIN_INT32 ||
+        header->width == 0 || header->height == 0 ||
+        header->width > INT_MAX || header->height > INT_MAX ||
+        header->stride < row_bytes || header->stride % sizeof(int) != 0 ||
+        header->stride / sizeof(int) > INT_MAX || header->data_offset % sizeof(int) != 0 ||
+        header->data_offset > size || size - header->data_offset < row_bytes ||
+        (size - header->data_offset - row_bytes) / header->stride < header->height - 1) {
+        fprintf(stderr, "Error: Invalid binary matrix header in %s\n", filename);
+        munmap(mapping, size);
+        return NULL;
+    }
+    
+    matrix_t *matrix = malloc(sizeof(matrix_t));
+    if (!matrix) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        munmap(mapping, size);
+        return NULL;
+    }
+    *matrix = (matrix_t){
+        .data = (int*)((char*)mapping + header->data_offset),
+        .buffer = NULL,
+        .width = (int)header->width,
+        .height = (int)header->height,
+        .stride = (int)(header->stride / sizeof(int)),
+        .halo = 0,
+        .mapping = mapping,
+        .mapping_size = size
+    };
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    return matrix;
+}
+
+// Функция для записи матрицы в двоичный файл через отображение в память
+static bool write_matrix_binary(const char *filename, const matrix_t *matrix) {
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        return false;
+    }
+    
+    size_t row_bytes = (size_t)matrix->width * sizeof(int);
+    size_t stride = (row_bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    size_t offset = sizeof(matrix_bin_header_t);
+    size_t size = offset + stride * matrix->height;
+    
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map file %s\n", filename);
+        return false;
+    }
+    
+    matrix_bin_header_t header = {
+        .version = MATRIX_BIN_VERSION,
+        .element_type = MATRIX_BIN_INT32,
+        .height = matrix->height,
+        .width = matrix->width,
+        .stride = stride,
+        .data_offset = offset
+    };
+    memcpy(header.magic, MATRIX_BIN_MAGIC, sizeof(header.magic));
+    memcpy(mapping, &header, sizeof(header));
+    
+    for (int y = 0; y < matrix->height; y++) {
+        memcpy((char*)mapping + offset + (size_t)y * stride, MATRIX_ROW(matrix, y), row_bytes);
+    }
+    
+    bool ok = munmap(mapping, size) == 0;
+    if (!ok) fprintf(stderr, "Error: Cannot write file %s\n", filename);
+    return ok;
+}
+
+matrix_t* read_matrix(const char *filename, thread_pool_t *pool) {
+    if (has_extension(filename, ".bin")) return read_matrix_binary(filename);
+    
+    text_matrix_t text;
+    if (!text_matrix_open(filename, &text)) {
+        return NULL;
+    }
+    
+    matrix_t *matrix = create_matrix(text.cols, text.rows, 0);
+    if (!matrix) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        text_matrix_close(&text);
+        return NULL;
+    }
+    
+    bool ok = text_matrix_parse(&text, matrix->data, matrix->stride, pool);
+    text_matrix_close(&text);
+    if (!ok) {
+        free_matrix(matrix);
+        return NULL;
+    }
+    return matrix;
+}
+
+bool read_matrix_size(const char *filename, int *width, int *height) {
+    if (has_extension(filename, ".bin")) {
+        matrix_t *matrix = read_matrix_binary(filename);
+        if (!matrix) return false;
+        *width = matrix->width;
+        *height = matrix->height;
+        free_matrix(matrix);
+        return true;
+    }
+    
+    text_matrix_t text;
+    if (!text_matrix_open(filename, &text)) return false;
+    *width = text.cols;
+    *height = text.rows;
+    text_matrix_close(&text);
+    return true;
+}
+
+bool write_matrix(const char *filename, const matrix_t *matrix, thread_pool_t *pool) {
+    char temp[PATH_MAX];
+    if (!output_temp_path(filename, temp, sizeof(temp))) return false;
+    
+    // Формат выбирается по имени результата, а не временного файла
+    const char *target = temp[0] ? temp : filename;
+    bool ok = has_extension(filename, ".bin")
+        ? write_matrix_binary(target, matrix)
+        : text_matrix_write(target, matrix->data, matrix->height, matrix->width, matrix->stride, pool);
+    return output_commit(temp, filename, ok);
+}
+
+// Функция для подготовки рабочей матрицы к выбранному алгоритму
+static void prepare_levels(filter_params_t *params, matrix_t *current, value_levels_t *levels) {
+    levels->values = NULL;
+    levels->count = 0;
+    
+    params->algorithm = select_algorithm(params->algorithm, params->window_size, params->percentile);
+    if (!uses_levels(params->algorithm)) return;
+    
+    if (!build_value_levels(current, levels)) {
+        fprintf(stderr, "Warning: More than %d distinct values, falling back to sort\n", HIST_MAX_LEVELS);
+        params->algorithm = ALGO_SORT;
+        return;
+    }
+    
+    // Ранг окна переходит через монотонную замену, поэтому все итерации
+    // идут в номерах уровней
+    matrix_to_levels(current, levels);
+    params->levels = levels->count;
+}
+
+// Функция для возврата результата из уровней яркости
+static void finish_levels(const filter_params_t *params, matrix_t *result, value_levels_t *levels) {
+    if (uses_levels(params->algorithm)) {
+        matrix_from_levels(result, levels);
+    }
+    free(levels->values);
+}
+
+int default_tile_size(int window_size, int fuse_depth) {
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) l2 = 1 << 20;
+    
+    long cells = l2 / 2 / (2 * sizeof(int));
+    int side = 1;
+    while ((long)(side + 1) * (side + 1) <= cells) side++;
+    int tile = side - 2 * fuse_depth * (window_size / 2);
+    return tile < 32 ? 32 : tile;
+}
+
+// Функция для создания буфера плитки с учетом ореола слияния
+static matrix_t* create_tile_buffer(const filter_params_t *params) {
+    int grow = params->fuse_depth * (params->window_size / 2);
+    int side = params->tile_size + 2 * grow;
+    return create_matrix(side, side, params->window_size / 2);
+}
+
+// Функция для обработки плитки [y0, y1) x [x0, x1) на depth итераций подряд.
+// Плитка копируется в буфер с ореолом depth * r, на каждой итерации
+// считается область, сужающаяся на r, так что данные остаются в кэше.
+// Края буфера, не совпадающие с краями матрицы, отстоят от считаемой
+// области не меньше чем на r, поэтому результат совпадает с поитерационным
+static void filter_tile_fused(const matrix_t *src, matrix_t *dst, const filter_params_t *params,
+                              int depth, int y0, int y1, int x0, int x1, matrix_t *a, matrix_t *b,
+                              scratch_arena_t *scratch) {
+    int radius = params->window_size / 2;
+    int grow = depth * radius;
+    int ey0 = imax(y0 - grow, 0), ey1 = imin(y1 + grow, src->height);
+    int ex0 = imax(x0 - grow, 0), ex1 = imin(x1 + grow, src->width);
+    
+    resize_matrix(a, ex1 - ex0, ey1 - ey0);
+    resize_matrix(b, ex1 - ex0, ey1 - ey0);
+    for (int y = ey0; y < ey1; y++) {
+        memcpy(MATRIX_ROW(a, y - ey0), MATRIX_ROW(src, y) + ex0, (ex1 - ex0) * sizeof(int));
+    }
+    
+    for (int i = 1; i <= depth; i++) {
+        int g = (depth - i) * radius;
+        filter_rect(a, b, params, scratch,
+                    imax(y0 - g, 0) - ey0, imin(y1 + g, src->height) - ey0,
+                    imax(x0 - g, 0) - ex0, imin(x1 + g, src->width) - ex0);
+        matrix_t *temp = a;
+        a = b;
+        b = temp;
+    }
+    
+    for (int y = y0; y < y1; y++) {
+        memcpy(MATRIX_ROW(dst, y) + x0, MATRIX_ROW(a, y - ey0) + (x0 - ex0), (x1 - x0) * sizeof(int));
+    }
+}
+
+// Функция для определения прямоугольника [y0, y1) x [x0, x1) плитки номер tile
+static void tile_rect(const matrix_t *matrix, int tile_size, int tile, int *y0, int *y1, int *x0, int *x1) {
+    int tiles_x = (matrix->width + tile_size - 1) / tile_size;
+    *y0 = tile / tiles_x * tile_size;
+    *x0 = tile % tiles_x * tile_size;
+    *y1 = imin(*y0 + tile_size, matrix->height);
+    *x1 = imin(*x0 + tile_size, matrix->width);
+}
+
+// Функция для учета работы потока над плиткой (depth итераций)
+static void count_tile_work(const matrix_t *matrix, int tile_size, int tile, int depth, int thread_id) {
+    int y0, y1, x0, x1;
+    tile_rect(matrix, tile_size, tile, &y0, &y1, &x0, &x1);
+    instrument_add_work(thread_id, (long long)depth * (y1 - y0), (long long)depth * (y1 - y0) * (x1 - x0));
+}
+
+// Функция для обработки плитки номер tile сетки плиток
+// (одна итерация считается прямо по матрице, без копирования в буфер)
+static void filter_tile_index(const matrix_t *src, matrix_t *dst, const filter_params_t *params,
+                              int depth, int tile, matrix_t *a, matrix_t *b, scratch_arena_t *scratch) {
+    int y0, y1, x0, x1;
+    tile_rect(src, params->tile_size, tile, &y0, &y1, &x0, &x1);
+    if (depth == 1) {
+        filter_rect(src, dst, params, scratch, y0, y1, x0, x1);
+    } else {
+        filter_tile_fused(src, dst, params, depth, y0, y1, x0, x1, a, b, scratch);
+    }
+}
+
+// Функция для подсчета плиток матрицы
+static int count_tiles(const matrix_t *matrix, int tile_size) {
+    return ((matrix->width + tile_size - 1) / tile_size) *
+           ((matrix->height + tile_size - 1) / tile_size);
+}
+
+// Функция для определения соседей плитки tile (включая ее саму): плиток,
+// чьи данные нужны ей на следующем проходе и которые читают ее данные.
+// Соседи образуют прямоугольник [ty0, ty1] x [tx0, tx1] сетки плиток
+static int tile_neighbours(int tiles_x, int tiles_y, int reach, int tile,
+                           int *ty0, int *ty1, int *tx0, int *tx1) {
+    int ty = tile / tiles_x, tx = tile % tiles_x;
+    *ty0 = imax(ty - reach, 0);
+    *ty1 = imin(ty + reach, tiles_y - 1);
+    *tx0 = imax(tx - reach, 0);
+    *tx1 = imin(tx + reach, tiles_x - 1);
+    return (*ty1 - *ty0 + 1) * (*tx1 - *tx0 + 1);
+}
+
+// Функция для числа итераций прохода pass (короче fuse_depth бывает
+// только последний проход)
+static int pass_depth(const filter_params_t *params, int k_iters, int pass) {
+    return imin(params->fuse_depth, k_iters - pass * params->fuse_depth);
+}
+
+// Функция для проверки, нужно ли считать плитку на проходе pass.
+// changed[2 * n + p % 2] - изменил ли проход p плитку n. Если ни один
+// сосед не изменился на проходе pass - 1 той же глубины, результат
+// прохода совпадет с его входом, а он уже лежит в буфере назначения:
+// буферы чередуются, и там остался результат прохода pass - 1
+static bool tile_dirty(const unsigned char *changed, int tiles_x, int pass, bool same_depth,
+                       int ty0, int ty1, int tx0, int tx1) {
+    if (pass == 0 || !same_depth) return true;
+    
+    for (int ny = ty0; ny <= ty1; ny++) {
+        for (int nx = tx0; nx <= tx1; nx++) {
+            if (changed[2 * (ny * tiles_x + nx) + (pass - 1) % 2]) return true;
+        }
+    }
+    return false;
+}
+
+// Функция для проверки, изменил ли проход плитку tile (src - вход прохода)
+static bool tile_changed(const matrix_t *src, const matrix_t *dst, int tile_size, int tile) {
+    int y0, y1, x0, x1;
+    tile_rect(src, tile_size, tile, &y0, &y1, &x0, &x1);
+    for (int y = y0; y < y1; y++) {
+        if (memcmp(MATRIX_ROW(src, y) + x0, MATRIX_ROW(dst, y) + x0, (x1 - x0) * sizeof(int)) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Очередь готовых плиток потока (кольцевой буфер): владелец берет последнюю
+// добавленную плитку, данные которой еще в кэше, другие потоки крадут
+// самую старую. Выравнивание по строке кэша убирает ложное разделение
+typedef struct {
+    _Alignas(MATRIX_ALIGNMENT) pthread_mutex_t lock;
+    int *items;
+    int capacity;
+    int head;       // самая старая плитка
+    int count;
+    unsigned seed;  // выбор жертвы для кражи (меняет только владелец)
+} tile_deque_t;
+
+// Планировщик плиток: у каждого потока своя очередь готовых плиток,
+// освободившиеся потоки крадут чужие плитки
+typedef struct tile_scheduler {
+    tile_deque_t *deques;
+    int num_threads;
+} tile_scheduler_t;
+
+// Функция для освобождения планировщика
+static void scheduler_destroy(tile_scheduler_t *scheduler) {
+    for (int i = 0; i < scheduler->num_threads; i++) {
+        pthread_mutex_destroy(&scheduler->deques[i].lock);
+        free(scheduler->deques[i].items);
+    }
+    free(scheduler->deques);
+}
+
+// Функция для создания планировщика на num_threads очередей
+// по capacity плиток
+static bool scheduler_init(tile_scheduler_t *scheduler, int num_threads, int capacity) {
+    void *deques = NULL;
+    if (posix_memalign(&deques, MATRIX_ALIGNMENT, num_threads * sizeof(tile_deque_t)) != 0) {
+        fprintf(stderr, "Error: Memory allocation failed for tile scheduler\n");
+        return false;
+    }
+    scheduler->deques = deques;
+    scheduler->num_threads = num_threads;
+    for (int i = 0; i < num_threads; i++) {
+        tile_deque_t *deque = &scheduler->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->items = malloc(capacity * sizeof(int));
+        deque->capacity = capacity;
+        deque->head = 0;
+        deque->count = 0;
+        deque->seed = (unsigned)i * 2654435761u + 1;
+        if (!deque->items) {
+            fprintf(stderr, "Error: Memory allocation failed for tile scheduler\n");
+            scheduler->num_threads = i + 1;
+            scheduler_destroy(scheduler);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Функция для добавления готовой плитки в очередь потока thread_id
+static void scheduler_push(tile_scheduler_t *scheduler, int thread_id, int tile) {
+    tile_deque_t *deque = &scheduler->deques[thread_id];
+    pthread_mutex_lock(&deque->lock);
+    deque->items[(deque->head + deque->count) % deque->capacity] = tile;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Функция для определения домашних плиток [lo, hi) потока thread_id:
+// равные непрерывные диапазоны номеров плиток
+static void home_tiles(int tiles, int num_threads, int thread_id, int *lo, int *hi) {
+    *lo = (int)((long)tiles * thread_id / num_threads);
+    *hi = (int)((long)tiles * (thread_id + 1) / num_threads);
+}
+
+// Функция для раздачи плиток по очередям их домашних потоков
+// (владелец получит свои плитки по порядку строк)
+static void scheduler_seed(tile_scheduler_t *scheduler, int tiles) {
+    int n = scheduler->num_threads;
+    for (int i = 0; i < n; i++) {
+        int lo, hi;
+        home_tiles(tiles, n, i, &lo, &hi);
+        for (int t = hi - 1; t >= lo; t--) {
+            scheduler_push(scheduler, i, t);
+        }
+    }
+}
+
+// Функция для получения следующей готовой плитки потоком thread_id: сначала
+// из своей очереди, затем кражей из чужих, начиная со случайной.
+// Возвращает -1, если готовых плиток сейчас нет
+static int scheduler_next(tile_scheduler_t *scheduler, int thread_id) {
+    tile_deque_t *own = &scheduler->deques[thread_id];
+    int tile = -1;
+    pthread_mutex_lock(&own->lock);
+    if (own->count > 0) {
+        own->count--;
+        tile = own->items[(own->head + own->count) % own->capacity];
+    }
+    pthread_mutex_unlock(&own->lock);
+    if (tile >= 0) return tile;
+    
+    int n = scheduler->num_threads;
+    own->seed = own->seed * 1103515245u + 12345u;
+    int start = (int)((own->seed >> 16) % (unsigned)n);
+    for (int i = 0; i < n; i++) {
+        tile_deque_t *victim = &scheduler->deques[(start + i) % n];
+        if (victim == own) continue;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count > 0) {
+            tile = victim->items[victim->head];
+            victim->head = (victim->head + 1) % victim->capacity;
+            victim->count--;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (tile >= 0) return tile;
+    }
+    return -1;
+}
+
+
+// КОНТЕКСТ
+struct median_context {
+    thread_pool_t *pool;        // NULL - один поток
+    scratch_arena_t *scratch;   // рабочая память ядер, по одной на поток
+    int scratch_count;
+    matrix_t *buffers[2];       // рабочие матрицы (текущая итерация и следующая)
+    int capacity_width;         // наибольшая матрица, помещающаяся в буферы
+    int capacity_height;
+    matrix_t *channel;          // канал изображения как матрица int
+    compact_plane_t planes[2];  // компактные плоскости канала (вход итерации и выход)
+    size_t plane_capacity;      // байт, выделенных под каждую плоскость
+};
+
+// Функция для подготовки count (1 или 2) рабочих матриц контекста под
+// матрицу width x height с рамкой halo: память прошлого вызова
+// переиспользуется, если матрица в нее помещается. Новые буферы
+// выделяются без записи (первое касание делают потоки, которые их считают)
+static bool reserve_buffers(median_context_t *ctx, int width, int height, int halo, int count) {
+    bool fits = ctx->buffers[0] && (count == 1 || ctx->buffers[1]) && ctx->buffers[0]->halo == halo &&
+                width <= ctx->capacity_width && height <= ctx->capacity_height;
+    if (fits) {
+        for (int i = 0; i < 2 && ctx->buffers[i]; i++) {
+            ctx->buffers[i]->width = width;
+            ctx->buffers[i]->height = height;
+        }
+        return true;
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        free_matrix(ctx->buffers[i]);
+        ctx->buffers[i] = i < count ? allocate_matrix(width, height, halo) : NULL;
+    }
+    if (!ctx->buffers[0] || (count == 2 && !ctx->buffers[1])) {
+        fprintf(stderr, "Error: Memory allocation failed for %dx%d matrix\n", height, width);
+        free_matrix(ctx->buffers[0]);
+        free_matrix(ctx->buffers[1]);
+        ctx->buffers[0] = ctx->buffers[1] = NULL;
+        return false;
+    }
+    ctx->capacity_width = width;
+    ctx->capacity_height = height;
+    return true;
+}
+
+// Функция для подготовки рабочей памяти ядер всех потоков контекста под
+// прямоугольники не шире cols столбцов матрицы шириной width. Память
+// выделяется до цикла фильтра и только растет от вызова к вызову
+static bool reserve_scratch(median_context_t *ctx, const filter_params_t *params, int width, int cols) {
+    size_t size = filter_scratch_size(params, width, cols);
+    for (int i = 0; i < ctx->scratch_count; i++) {
+        if (!scratch_reserve(&ctx->scratch[i], size)) {
+            fprintf(stderr, "Error: Memory allocation failed for %zu bytes of filter scratch\n", size);
+            return false;
+        }
+    }
+    return true;
+}
+
+median_context_t* median_context_create(int num_threads, pool_placement_t placement) {
+    median_context_t *ctx = calloc(1, sizeof(median_context_t));
+    if (!ctx) {
+        fprintf(stderr, "Error: Memory allocation failed for filter context\n");
+        return NULL;
+    }
+    
+    ctx->scratch_count = num_threads > 1 ? num_threads : 1;
+    ctx->scratch = calloc(ctx->scratch_count, sizeof(scratch_arena_t));
+    if (!ctx->scratch) {
+        fprintf(stderr, "Error: Memory allocation failed for filter context\n");
+        free(ctx);
+        return NULL;
+    }
+    
+    if (num_threads > 1) {
+        ctx->pool = thread_pool_create(num_threads);
+        if (!ctx->pool) {
+            median_context_destroy(ctx);
+            return NULL;
+        }
+        
+        // Привязанные потоки первыми касаются своих плиток, и их
+        // страницы остаются в памяти своего узла NUMA
+        if (placement != POOL_PLACE_NONE && !thread_pool_place(ctx->pool, placement)) {
+            median_context_destroy(ctx);
+            return NULL;
+        }
+    } else if (placement != POOL_PLACE_NONE) {
+        fprintf(stderr, "Warning: Thread placement needs more than one thread, ignored\n");
+    }
+    return ctx;
+}
+
+thread_pool_t* median_context_pool(const median_context_t *ctx) {
+    return ctx->pool;
+}
+
+void median_context_destroy(median_context_t *ctx) {
+    if (!ctx) return;
+    
+    free_matrix(ctx->buffers[0]);
+    free_matrix(ctx->buffers[1]);
+    free_matrix(ctx->channel);
+    free(ctx->planes[0].data);
+    free(ctx->planes[1].data);
+    for (int i = 0; i < ctx->scratch_count; i++) scratch_free(&ctx->scratch[i]);
+    free(ctx->scratch);
+    thread_pool_destroy(ctx->pool);
+    free(ctx);
+}
+
+filter_params_t median_default_params(int window_size) {
+    filter_params_t params = {
+        .window_size = window_size,
+        .percentile = RANK_MEDIAN,
+        .algorithm = ALGO_AUTO,
+        .simd = SIMD_AUTO,
+        .fuse_depth = 1,
+        .tile_size = 0,
+        .skip_clean = false,
+        .in_place = false
+    };
+    return params;
+}
+
+filter_params_t median_resolve_params(const filter_params_t *params) {
+    filter_params_t resolved = *params;
+    resolved.algorithm = select_algorithm(params->algorithm, params->window_size, params->percentile);
+    if (resolved.simd == SIMD_AUTO || resolved.simd > detect_simd_level()) resolved.simd = detect_simd_level();
+    if (resolved.fuse_depth < 1) resolved.fuse_depth = 1;
+    if (resolved.tile_size <= 0) resolved.tile_size = default_tile_size(params->window_size, resolved.fuse_depth);
+    return resolved;
+}
+
+
+// ПОСЛЕДОВАТЕЛЬНАЯ ВЕРСИЯ
+// Результат - одна из рабочих матриц контекста. converged (может быть
+// NULL) получает число итераций, после которого матрица перестала
+// меняться, или -1 (без params->skip_clean всегда -1)
+static matrix_t* median_filter_sequential(median_context_t *ctx, const matrix_t *input, int k_iters,
+                                          const filter_params_t *filter, int *converged) {
+    // Рамка в радиус окна: граничные пиксели читают окно без проверок
+    int halo = filter->window_size / 2;
+    if (!reserve_buffers(ctx, input->width, input->height, halo, 2)) return NULL;
+    matrix_t *current = ctx->buffers[0];
+    matrix_t *next = ctx->buffers[1];
+    for (int y = 0; y < input->height; y++) {
+        memcpy(MATRIX_ROW(current, y), MATRIX_ROW(input, y), input->width * sizeof(int));
+    }
+    fill_matrix_halo(current);
+    fill_matrix_halo(next);
+    
+    filter_params_t params = *filter;
+    value_levels_t levels;
+    prepare_levels(&params, current, &levels);
+    
+    // Без памяти под буферы плиток работаем без блокирования
+    matrix_t *tile_a = NULL, *tile_b = NULL;
+    if (params.fuse_depth > 1) {
+        tile_a = create_tile_buffer(&params);
+        tile_b = create_tile_buffer(&params);
+        if (!tile_a || !tile_b) params.fuse_depth = 1;
+    }
+    
+    // Проход без плиток считает строки целиком
+    scratch_arena_t *scratch = &ctx->scratch[0];
+    if (!reserve_scratch(ctx, &params, input->width, input->width)) {
+        free(levels.values);
+        free_matrix(tile_a);
+        free_matrix(tile_b);
+        return NULL;
+    }
+    
+    // Отметки изменившихся плиток по четности прохода (без памяти считаем все)
+    int tiles_x = (input->width + params.tile_size - 1) / params.tile_size;
+    int tiles_y = (input->height + params.tile_size - 1) / params.tile_size;
+    int reach = (params.fuse_depth * halo + params.tile_size - 1) / params.tile_size;
+    unsigned char *changed = params.skip_clean ? calloc(2 * tiles_x * tiles_y, 1) : NULL;
+    if (converged) *converged = -1;
+    
+    // За один проход выполняется до fuse_depth итераций
+    for (int pass = 0, iter = 0; iter < k_iters; pass++) {
+        int depth = pass_depth(&params, k_iters, pass);
+        
+        if (!changed && depth == 1) {
+            filter_rows(current, next, &params, scratch, 0, current->height);
+            instrument_add_work(-1, current->height, (long long)current->height * current->width);
+        } else if (!changed) {
+            int tiles = count_tiles(current, params.tile_size);
+            for (int t = 0; t < tiles; t++) {
+                filter_tile_index(current, next, &params, depth, t, tile_a, tile_b, scratch);
+            }
+            instrument_add_work(-1, (long long)depth * current->height,
+                                (long long)depth * current->height * current->width);
+        } else {
+            bool same_depth = pass > 0 && depth == pass_depth(&params, k_iters, pass - 1);
+            int changed_tiles = 0;
+            for (int t = 0; t < tiles_x * tiles_y; t++) {
+                int ty0, ty1, tx0, tx1;
+                tile_neighbours(tiles_x, tiles_y, reach, t, &ty0, &ty1, &tx0, &tx1);
+                bool dirty = tile_dirty(changed, tiles_x, pass, same_depth, ty0, ty1, tx0, tx1);
+                if (dirty) {
+                    filter_tile_index(current, next, &params, depth, t, tile_a, tile_b, scratch);
+                    count_tile_work(current, params.tile_size, t, depth, -1);
+                }
+                changed[2 * t + pass % 2] = dirty && tile_changed(current, next, params.tile_size, t);
+                changed_tiles += changed[2 * t + pass % 2];
+            }
+            
+            // Проход ничего не изменил: следующие проходы той же глубины
+            // тоже ничего не изменят
+            if (changed_tiles == 0) {
+                if (converged && *converged < 0) *converged = iter;
+                if ((k_iters - iter) % depth == 0) iter = k_iters - depth;
+            }
+        }
+        iter += depth;
+        
+        // Меняем местами текущую и следующую матрицу
+        matrix_t *temp = current;
+        current = next;
+        next = temp;
+    }
+    free(changed);
+    
+    finish_levels(&params, current, &levels);
+    free_matrix(tile_a);
+    free_matrix(tile_b);
+    return current;
+}
+
+// Функция для завершения прохода pass последней плиткой (при skip_clean):
+// проход без изменений - матрица сошлась; если дальше идут проходы той же
+// глубины, результат уже готов и потоки останавливаются
+static void finish_pass(filter_job_t *job, int pass) {
+    if (atomic_load(&job->pass_changed[pass]) != 0) return;
+    
+    int first = atomic_load(&job->converged_pass);
+    while (pass < first && !atomic_compare_exchange_weak(&job->converged_pass, &first, pass)) {}
+    
+    int depth = pass_depth(job->params, job->k_iters, pass);
+    if ((job->k_iters - pass * job->params->fuse_depth) % depth == 0) {
+        int stop = atomic_load(&job->stop_pass);
+        while (pass < stop && !atomic_compare_exchange_weak(&job->stop_pass, &stop, pass)) {}
+        atomic_store(&job->remaining, 0);
+    }
+}
+
+// Функция потока пула: берет готовые плитки (свои или краденые), считает
+// очередной проход и отмечает его у соседей. Последний сосед, завершивший
+// проход, ставит плитку в свою очередь. Соседи расходятся не больше чем
+// на проход, поэтому счетчиков на плитку два (по четности прохода)
+static void filter_job_task(void *arg, int thread_id) {
+    filter_job_t *job = (filter_job_t*)arg;
+    const filter_params_t *params = job->params;
+    matrix_t **buffers = job->tile_buffers + 2 * thread_id;
+    
+    // Ожидание готовых плиток (соседи не завершили проход) учитывается отдельно
+    bool timed = instrument_active();
+    unsigned long long wait_start = 0, wait_ns = 0;
+    
+    while (atomic_load_explicit(&job->remaining, memory_order_acquire) > 0) {
+        int t = scheduler_next(job->scheduler, thread_id);
+        if (t < 0) {
+            if (timed && !wait_start) wait_start = instrument_now_ns();
+            sched_yield();
+            continue;
+        }
+        if (wait_start) {
+            wait_ns += instrument_now_ns() - wait_start;
+            wait_start = 0;
+        }
+        
+        int pass = job->tile_pass[t];
+        int depth = pass_depth(params, job->k_iters, pass);
+        int ty0, ty1, tx0, tx1;
+        int neighbours = tile_neighbours(job->tiles_x, job->tiles_y, job->reach, t, &ty0, &ty1, &tx0, &tx1);
+        const matrix_t *src = job->buffers[pass % 2];
+        matrix_t *dst = job->buffers[(pass + 1) % 2];
+        
+        // Счетчик этой четности следующий раз нужен для прохода pass + 2:
+        // его соседи не могут завершить pass + 1, пока плитка не завершит pass.
+        // По той же причине соседи успеют прочитать отметку changed прохода
+        // pass - 1 до того, как плитка перезапишет ее на проходе pass + 1
+        atomic_store(&job->pending[2 * t + pass % 2], neighbours);
+        bool dirty = !job->changed ||
+                     tile_dirty(job->changed, job->tiles_x, pass,
+                                pass > 0 && depth == pass_depth(params, job->k_iters, pass - 1),
+                                ty0, ty1, tx0, tx1);
+        if (dirty) {
+            filter_tile_index(src, dst, params, depth, t, buffers[0], buffers[1], job->scratch + thread_id);
+            if (timed) count_tile_work(src, params->tile_size, t, depth, thread_id);
+        }
+        job->tile_pass[t] = pass + 1;
+        
+        if (job->changed) {
+            job->changed[2 * t + pass % 2] = dirty && tile_changed(src, dst, params->tile_size, t);
+            if (job->changed[2 * t + pass % 2]) atomic_fetch_add(&job->pass_changed[pass], 1);
+            if (atomic_fetch_sub(&job->pass_left[pass], 1) == 1) finish_pass(job, pass);
+        }
+        
+        if (pass + 1 < job->passes) {
+            for (int ny = ty0; ny <= ty1; ny++) {
+                for (int nx = tx0; nx <= tx1; nx++) {
+                    int n = ny * job->tiles_x + nx;
+                    if (atomic_fetch_sub(&job->pending[2 * n + (pass + 1) % 2], 1) == 1) {
+                        scheduler_push(job->scheduler, thread_id, n);
+                    }
+                }
+            }
+        }
+        atomic_fetch_sub_explicit(&job->remaining, 1, memory_order_release);
+    }
+    
+    if (timed) {
+        if (wait_start) wait_ns += instrument_now_ns() - wait_start;
+        instrument_add_wait(thread_id, wait_ns);
+    }
+}
+
+// Задание первого касания: каждый поток копирует вход в свои домашние
+// плитки и обнуляет их во втором буфере, поэтому на машине с несколькими
+// узлами NUMA страницы плитки лежат в памяти узла, где ее будут считать
+typedef struct {
+    const matrix_t *input;
+    matrix_t *current;
+    matrix_t *next;
+    int tile_size;
+    int tiles_x;
+    int tiles;
+    int num_threads;
+} first_touch_job_t;
+
+// Функция потока пула для первого касания домашних плиток
+static void first_touch_task(void *arg, int thread_id) {
+    first_touch_job_t *job = (first_touch_job_t*)arg;
+    int lo, hi;
+    home_tiles(job->tiles, job->num_threads, thread_id, &lo, &hi);
+    
+    for (int t = lo; t < hi; t++) {
+        int x0 = t % job->tiles_x * job->tile_size;
+        int y0 = t / job->tiles_x * job->tile_size;
+        int width = imin(job->tile_size, job->input->width - x0);
+        int y1 = imin(y0 + job->tile_size, job->input->height);
+        for (int y = y0; y < y1; y++) {
+            memcpy(MATRIX_ROW(job->current, y) + x0, MATRIX_ROW(job->input, y) + x0, width * sizeof(int));
+            memset(MATRIX_ROW(job->next, y) + x0, 0, width * sizeof(int));
+        }
+    }
+}
+
+// ПАРАЛЛЕЛЬНАЯ ВЕРСИЯ (потоки пула живут между вызовами; все итерации
+// выполняются одним запуском пула без глобальных барьеров).
+// Результат и converged - как в median_filter_sequential
+static matrix_t* median_filter_parallel(median_context_t *ctx, const matrix_t *input, int k_iters,
+                                        const filter_params_t *filter, int *converged) {
+    thread_pool_t *pool = ctx->pool;
+    int num_threads = thread_pool_size(pool);
+    
+    // Рамка в радиус окна: граничные пиксели читают окно без проверок.
+    // Буферы заполняются в first_touch_task потоками, которые их считают
+    int halo = filter->window_size / 2;
+    if (!reserve_buffers(ctx, input->width, input->height, halo, 2)) return NULL;
+    matrix_t *current = ctx->buffers[0];
+    matrix_t *next = ctx->buffers[1];
+    
+    filter_params_t params = *filter;
+    int tiles_x = (input->width + params.tile_size - 1) / params.tile_size;
+    int tiles_y = (input->height + params.tile_size - 1) / params.tile_size;
+    int tiles = tiles_x * tiles_y;
+    
+    // Без памяти под планировщик считаем последовательно
+    tile_scheduler_t scheduler;
+    matrix_t **buffers = calloc(2 * num_threads, sizeof(matrix_t*));
+    atomic_int *pending = malloc(2 * tiles * sizeof(atomic_int));
+    int *tile_pass = calloc(tiles, sizeof(int));
+    if (!buffers || !pending || !tile_pass || !scheduler_init(&scheduler, num_threads, tiles)) {
+        free(buffers);
+        free(pending);
+        free(tile_pass);
+        return median_filter_sequential(ctx, input, k_iters, filter, converged);
+    }
+    
+    first_touch_job_t touch = {
+        .input = input,
+        .current = current,
+        .next = next,
+        .tile_size = params.tile_size,
+        .tiles_x = tiles_x,
+        .tiles = tiles,
+        .num_threads = num_threads
+    };
+    thread_pool_run(pool, first_touch_task, &touch);
+    fill_matrix_halo(current);
+    fill_matrix_halo(next);
+    
+    value_levels_t levels;
+    prepare_levels(&params, current, &levels);
+    
+    // Без памяти под буферы плиток работаем без блокирования
+    for (int i = 0; i < 2 * num_threads && params.fuse_depth > 1; i++) {
+        buffers[i] = create_tile_buffer(&params);
+        if (!buffers[i]) params.fuse_depth = 1;
+    }
+    
+    // Потоки считают только плитки (со слиянием - вместе с ореолом)
+    int tile_cols = imin(input->width, params.tile_size + 2 * params.fuse_depth * halo);
+    if (!reserve_scratch(ctx, &params, input->width, tile_cols)) {
+        for (int i = 0; i < 2 * num_threads; i++) {
+            free_matrix(buffers[i]);
+        }
+        free(buffers);
+        free(pending);
+        free(tile_pass);
+        scheduler_destroy(&scheduler);
+        free(levels.values);
+        return NULL;
+    }
+    
+    filter_job_t job = {
+        .buffers = { current, next },
+        .params = &params,
+        .k_iters = k_iters,
+        .passes = (k_iters + params.fuse_depth - 1) / params.fuse_depth,
+        .scheduler = &scheduler,
+        .tile_buffers = buffers,
+        .scratch = ctx->scratch,
+        .tiles_x = tiles_x,
+        .tiles_y = tiles_y,
+        .reach = (params.fuse_depth * halo + params.tile_size - 1) / params.tile_size,
+        .pending = pending,
+        .tile_pass = tile_pass
+    };
+    atomic_init(&job.remaining, tiles * job.passes);
+    atomic_init(&job.converged_pass, INT_MAX);
+    atomic_init(&job.stop_pass, INT_MAX);
+    for (int t = 0; t < tiles; t++) {
+        int ty0, ty1, tx0, tx1;
+        atomic_init(&pending[2 * t], 0);
+        atomic_init(&pending[2 * t + 1], tile_neighbours(tiles_x, tiles_y, job.reach, t, &ty0, &ty1, &tx0, &tx1));
+    }
+    
+    // Без памяти под отметки изменений считаем все плитки
+    if (params.skip_clean) {
+        job.changed = calloc(2 * tiles, 1);
+        job.pass_left = malloc(job.passes * sizeof(atomic_int));
+        job.pass_changed = malloc(job.passes * sizeof(atomic_int));
+        if (!job.changed || !job.pass_left || !job.pass_changed) {
+            free(job.changed);
+            free(job.pass_left);
+            free(job.pass_changed);
+            job.changed = NULL;
+        }
+        for (int p = 0; job.changed && p < job.passes; p++) {
+            atomic_init(&job.pass_left[p], tiles);
+            atomic_init(&job.pass_changed[p], 0);
+        }
+    }
+    scheduler_seed(&scheduler, tiles);
+    
+    // Главный поток только ждет завершения всех проходов. После остановки
+    // по сходимости оба буфера содержат одну и ту же (готовую) матрицу
+    thread_pool_run(pool, filter_job_task, &job);
+    int stop_pass = atomic_load(&job.stop_pass);
+    int done = stop_pass < job.passes ? stop_pass + 1 : job.passes;
+    current = job.buffers[done % 2];
+    next = job.buffers[(done + 1) % 2];
+    
+    int converged_pass = atomic_load(&job.converged_pass);
+    if (converged) *converged = converged_pass < job.passes ? converged_pass * params.fuse_depth : -1;
+    if (job.changed) {
+        free(job.changed);
+        free(job.pass_left);
+        free(job.pass_changed);
+    }
+    
+    for (int i = 0; i < 2 * num_threads; i++) {
+        free_matrix(buffers[i]);
+    }
+    free(buffers);
+    free(pending);
+    free(tile_pass);
+    scheduler_destroy(&scheduler);
+    finish_levels(&params, current, &levels);
+    
+    return current;
+}
+
+// ВЕРСИЯ НА МЕСТЕ
+// Вторая матрица не нужна: каждый поток проходит свою полосу строк
+// порциями через небольшой буфер с рамкой и пишет результат обратно.
+// Исходные значения r строк над порцией (уже перезаписанных) хранятся
+// в кольце потока, а r строк по обе стороны границ полос сохраняются
+// до начала итерации: соседний поток перезапишет их раньше, чем они
+// понадобятся. Память O(width * (window + INPLACE_BATCH_ROWS)) на поток
+
+// Строк результата в одной порции
+#define INPLACE_BATCH_ROWS 16
+
+// Буферы потока для фильтра на месте
+typedef struct {
+    matrix_t *band;     // порция и r строк над и под ней, с рамкой
+    matrix_t *out;      // результат порции (строки нумеруются как в band)
+    int *above;         // исходные строки [y0 - r, y0) над порцией y0
+    int *below;         // исходные строки [b1, b1 + r) под полосой потока
+} in_place_buffers_t;
+
+// Задание пула: одна итерация на месте, полосы строк делятся между потоками
+typedef struct {
+    matrix_t *matrix;
+    const filter_params_t *params;
+    in_place_buffers_t *buffers;
+    scratch_arena_t *scratch;
+    int parts;
+} in_place_job_t;
+
+// Функция для определения полосы строк [b0, b1) потока part
+static void in_place_band(const in_place_job_t *job, int part, int *b0, int *b1) {
+    int height = job->matrix->height;
+    *b0 = (int)((long)height * part / job->parts);
+    *b1 = (int)((long)height * (part + 1) / job->parts);
+}
+
+// Задача пула: сохранение исходных строк у границ своей полосы
+static void in_place_save_task(void *arg, int thread_id) {
+    in_place_job_t *job = (in_place_job_t*)arg;
+    const matrix_t *matrix = job->matrix;
+    in_place_buffers_t *buffers = &job->buffers[thread_id];
+    int radius = job->params->window_size / 2;
+    size_t row_bytes = (size_t)matrix->width * sizeof(int);
+    int b0, b1;
+    in_place_band(job, thread_id, &b0, &b1);
+    if (b0 == b1) return;
+    
+    for (int y = imax(b0 - radius, 0); y < b0; y++) {
+        memcpy(buffers->above + (size_t)(y - (b0 - radius)) * matrix->width, MATRIX_ROW(matrix, y), row_bytes);
+    }
+    for (int y = b1; y < imin(b1 + radius, matrix->height); y++) {
+        memcpy(buffers->below + (size_t)(y - b1) * matrix->width, MATRIX_ROW(matrix, y), row_bytes);
+    }
+}
+
+// Задача пула: проход своей полосы порциями. Порция [y0, y1) копируется
+// в буфер вместе с r строками контекста (вид буфера начинается и
+// кончается краем матрицы только там, где порция его касается), считается
+// и записывается обратно; перед записью последние r исходных строк
+// порции уходят в кольцо для следующей
+static void in_place_sweep_task(void *arg, int thread_id) {
+    in_place_job_t *job = (in_place_job_t*)arg;
+    matrix_t *matrix = job->matrix;
+    in_place_buffers_t *buffers = &job->buffers[thread_id];
+    int radius = job->params->window_size / 2;
+    int width = matrix->width;
+    size_t row_bytes = (size_t)width * sizeof(int);
+    int b0, b1;
+    in_place_band(job, thread_id, &b0, &b1);
+    
+    for (int y0 = b0, y1; y0 < b1; y0 = y1) {
+        y1 = imin(y0 + INPLACE_BATCH_ROWS, b1);
+        int top = imax(y0 - radius, 0);
+        int bottom = imin(y1 + radius, matrix->height);
+        
+        for (int y = top; y < bottom; y++) {
+            const int *row = y < y0 ? buffers->above + (size_t)(y - (y0 - radius)) * width
+                           : y < b1 ? MATRIX_ROW(matrix, y)
+                           : buffers->below + (size_t)(y - b1) * width;
+            memcpy(MATRIX_ROW(buffers->band, y - top), row, row_bytes);
+        }
+        
+        // Под видом - рамка, как под краем матрицы
+        matrix_t view = *buffers->band;
+        view.height = bottom - top;
+        for (int y = view.height; y < view.height + radius; y++) {
+            int *row = MATRIX_ROW(&view, y);
+            for (int x = -view.halo; x < width + view.halo; x++) row[x] = MATRIX_PAD;
+        }
+        matrix_t out = *buffers->out;
+        out.height = view.height;
+        filter_rows(&view, &out, job->params, &job->scratch[thread_id], y0 - top, y1 - top);
+        
+        if (y1 < b1) {
+            for (int y = imax(y1 - radius, 0); y < y1; y++) {
+                memcpy(buffers->above + (size_t)(y - (y1 - radius)) * width, MATRIX_ROW(&view, y - top), row_bytes);
+            }
+        }
+        for (int y = y0; y < y1; y++) {
+            memcpy(MATRIX_ROW(matrix, y), MATRIX_ROW(&out, y - top), row_bytes);
+        }
+    }
+}
+
+// Функция для освобождения буферов фильтра на месте
+static void free_in_place_buffers(in_place_buffers_t *buffers, int parts) {
+    for (int i = 0; i < parts && buffers; i++) {
+        free_matrix(buffers[i].band);
+        free_matrix(buffers[i].out);
+        free(buffers[i].above);
+        free(buffers[i].below);
+    }
+    free(buffers);
+}
+
+// Функция для k_iters итераций на месте в матрице matrix (параметры уже
+// разрешены; слияние итераций и пропуск плиток не применяются)
+static bool median_filter_in_place(median_context_t *ctx, matrix_t *matrix, int k_iters,
+                                   const filter_params_t *filter) {
+    int radius = filter->window_size / 2;
+    int width = matrix->width;
+    int parts = ctx->pool ? thread_pool_size(ctx->pool) : 1;
+    int band_rows = INPLACE_BATCH_ROWS + 2 * radius;
+    
+    in_place_buffers_t *buffers = calloc(parts, sizeof(in_place_buffers_t));
+    bool ok = buffers != NULL;
+    for (int i = 0; i < parts && ok; i++) {
+        buffers[i].band = create_matrix(width, band_rows, radius);
+        buffers[i].out = allocate_matrix(width, band_rows, 0);
+        buffers[i].above = malloc(((size_t)radius * width + 1) * sizeof(int));
+        buffers[i].below = malloc(((size_t)radius * width + 1) * sizeof(int));
+        ok = buffers[i].band && buffers[i].out && buffers[i].above && buffers[i].below;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for in-place buffers\n");
+        free_in_place_buffers(buffers, parts);
+        return false;
+    }
+    
+    filter_params_t params = *filter;
+    value_levels_t levels;
+    prepare_levels(&params, matrix, &levels);
+    if (!reserve_scratch(ctx, &params, width, width)) {
+        free(levels.values);
+        free_in_place_buffers(buffers, parts);
+        return false;
+    }
+    
+    in_place_job_t job = {
+        .matrix = matrix,
+        .params = &params,
+        .buffers = buffers,
+        .scratch = ctx->scratch,
+        .parts = parts
+    };
+    for (int iter = 0; iter < k_iters; iter++) {
+        if (ctx->pool) {
+            thread_pool_run(ctx->pool, in_place_save_task, &job);
+            thread_pool_run(ctx->pool, in_place_sweep_task, &job);
+        } else {
+            in_place_sweep_task(&job, 0);
+        }
+    }
+    for (int part = 0; part < parts; part++) {
+        int b0, b1;
+        in_place_band(&job, part, &b0, &b1);
+        instrument_add_work(ctx->pool ? part : -1, (long long)k_iters * (b1 - b0),
+                            (long long)k_iters * (b1 - b0) * width);
+    }
+    
+    finish_levels(&params, matrix, &levels);
+    free_in_place_buffers(buffers, parts);
+    return true;
+}
+
+// Функция для проверки размеров матрицы и параметров фильтра
+static bool valid_request(const matrix_t *matrix, int k_iters, const filter_params_t *params) {
+    if (matrix->width <= 0 || matrix->height <= 0 || k_iters <= 0 ||
+        params->window_size <= 0 || params->window_size % 2 == 0 ||
+        params->percentile < 0 || params->percentile > 100) {
+        fprintf(stderr, "Error: Invalid filter parameters\n");
+        return false;
+    }
+    return true;
+}
+
+const matrix_t* median_context_filter(median_context_t *ctx, const matrix_t *input, int k_iters,
+                                      const filter_params_t *params, int *converged) {
+    if (!valid_request(input, k_iters, params)) return NULL;
+    
+    filter_params_t resolved = median_resolve_params(params);
+    if (resolved.in_place) {
+        // Одна рабочая матрица без рамки: рамку дает буфер порции
+        if (converged) *converged = -1;
+        if (!reserve_buffers(ctx, input->width, input->height, 0, 1)) return NULL;
+        matrix_t *current = ctx->buffers[0];
+        for (int y = 0; y < input->height; y++) {
+            memcpy(MATRIX_ROW(current, y), MATRIX_ROW(input, y), input->width * sizeof(int));
+        }
+        return median_filter_in_place(ctx, current, k_iters, &resolved) ? current : NULL;
+    }
+    return ctx->pool ? median_filter_parallel(ctx, input, k_iters, &resolved, converged)
+                     : median_filter_sequential(ctx, input, k_iters, &resolved, converged);
+}
+
+bool median_context_filter_in_place(median_context_t *ctx, matrix_t *matrix, int k_iters,
+                                    const filter_params_t *params) {
+    if (!valid_request(matrix, k_iters, params)) return false;
+    
+    filter_params_t resolved = median_resolve_params(params);
+    return median_filter_in_place(ctx, matrix, k_iters, &resolved);
+}
+
+bool median_filter_buffer(median_context_t *ctx, const void *src, size_t src_stride, void *dst,
+                          size_t dst_stride, int width, int height, median_element_t type, int k_iters,
+                          const filter_params_t *params, int *converged) {
+    // Компактные типы идут через плоскости канала контекста
+    if (type != MEDIAN_INT32) {
+        median_image_t source = {
+            .data = (void*)src,
+            .width = width,
+            .height = height,
+            .channels = 1,
+            .stride = src_stride,
+            .type = type
+        };
+        median_image_t target = source;
+        target.data = dst;
+        target.stride = dst_stride;
+        if (converged) *converged = -1;
+        return median_filter_image(ctx, &source, &target, k_iters, params);
+    }
+    if (src_stride % sizeof(int) != 0 || src_stride < width * sizeof(int) || dst_stride < width * sizeof(int)) {
+        fprintf(stderr, "Error: Invalid buffer stride\n");
+        return false;
+    }
+    
+    // На месте фильтр идет прямо в dst: вход копируется туда (если это
+    // другой буфер), и другой памяти размером с матрицу не нужно
+    if (params->in_place) {
+        if (dst_stride % sizeof(int) != 0) {
+            fprintf(stderr, "Error: Invalid buffer stride\n");
+            return false;
+        }
+        for (int y = 0; y < height && dst != src; y++) {
+            memmove((char*)dst + (size_t)y * dst_stride, (const char*)src + (size_t)y * src_stride,
+                    width * sizeof(int));
+        }
+        matrix_t target = {
+            .data = (int*)dst,
+            .width = width,
+            .height = height,
+            .stride = (int)(dst_stride / sizeof(int))
+        };
+        if (converged) *converged = -1;
+        return median_context_filter_in_place(ctx, &target, k_iters, params);
+    }
+    
+    // Вход читается прямо из буфера вызывающей стороны (без рамки:
+    // рамку имеют только рабочие матрицы контекста)
+    matrix_t view = {
+        .data = (int*)src,
+        .width = width,
+        .height = height,
+        .stride = (int)(src_stride / sizeof(int))
+    };
+    const matrix_t *result = median_context_filter(ctx, &view, k_iters, params, converged);
+    if (!result) return false;
+    
+    for (int y = 0; y < height; y++) {
+        memcpy((char*)dst + (size_t)y * dst_stride, MATRIX_ROW(result, y), width * sizeof(int));
+    }
+    return true;
+}
+
+// ОБЛАСТЬ ИНТЕРЕСА
+// Считаются только плитки REGION_TILE_SIZE x REGION_TILE_SIZE, задетые
+// областью, и их окрестность: итерация i из k нужна в пикселях не дальше
+// (k - i) * r от области, это плитки не дальше ceil((k - i) * r / T) от
+// плиток области. Рабочие матрицы контекста выделяются без записи, и
+// страницы неиспользуемых плиток не трогаются
+
+// Сторона плитки области: мельче плиток слияния, чтобы считать меньше
+// лишнего вокруг маленьких прямоугольников и одиночных пикселей маски
+#define REGION_TILE_SIZE 64
+
+// Отметки плиток области (ячейка - битовая маска)
+#define REGION_RECT 1   // плитку задевает прямоугольник
+#define REGION_MASK 2   // в плитке есть пиксели маски
+
+// Задача потоков для одной итерации над списком плиток
+typedef struct {
+    const matrix_t *src;
+    matrix_t *dst;
+    const filter_params_t *params;
+    scratch_arena_t *scratch;
+    const int *tiles;
+    int count;
+    int parts;
+    atomic_bool failed;
+} region_job_t;
+
+static void region_task(void *arg, int thread_id) {
+    region_job_t *job = arg;
+    for (int i = thread_id; i < job->count; i += job->parts) {
+        int y0, y1, x0, x1;
+        tile_rect(job->src, REGION_TILE_SIZE, job->tiles[i], &y0, &y1, &x0, &x1);
+        if (!filter_rect(job->src, job->dst, job->params, &job->scratch[thread_id], y0, y1, x0, x1)) {
+            atomic_store(&job->failed, true);
+        }
+        instrument_add_work(thread_id, y1 - y0, (long long)(y1 - y0) * (x1 - x0));
+    }
+}
+
+// Функция для матрицы-окна [y0, y1) x [x0, x1) в памяти матрицы matrix
+static matrix_t matrix_view(const matrix_t *matrix, int y0, int y1, int x0, int x1) {
+    return (matrix_t){
+        .data = MATRIX_ROW(matrix, y0) + x0,
+        .width = x1 - x0,
+        .height = y1 - y0,
+        .stride = matrix->stride
+    };
+}
+
+// Функция для заполнения рамки матрицы значением MATRIX_PAD только рядом
+// с плиткой [y0, y1) x [x0, x1) (остальные строки рамки не трогаются)
+static void fill_tile_halo(matrix_t *matrix, int y0, int y1, int x0, int x1) {
+    int halo = matrix->halo;
+    int left = x0 == 0 ? -halo : x0, right = x1 == matrix->width ? x1 + halo : x1;
+    for (int y = y0 == 0 ? -halo : y0; y < (y1 == matrix->height ? y1 + halo : y1); y++) {
+        int *row = MATRIX_ROW(matrix, y);
+        if (y < 0 || y >= matrix->height) {
+            for (int x = left; x < right; x++) row[x] = MATRIX_PAD;
+            continue;
+        }
+        for (int x = left; x < 0; x++) row[x] = MATRIX_PAD;
+        for (int x = matrix->width; x < right; x++) row[x] = MATRIX_PAD;
+    }
+}
+
+// Функция для обрезки прямоугольника по матрице: [y0, y1) x [x0, x1)
+// (пустой, если y0 >= y1 или x0 >= x1)
+static void clip_rect(const matrix_t *matrix, const median_rect_t *rect, int *y0, int *y1, int *x0, int *x1) {
+    long bottom = (long)rect->y + rect->height, right = (long)rect->x + rect->width;
+    *y0 = imax(rect->y, 0);
+    *x0 = imax(rect->x, 0);
+    *y1 = bottom < matrix->height ? (int)bottom : matrix->height;
+    *x1 = right < matrix->width ? (int)right : matrix->width;
+}
+
+// Функция для отметки плиток, задетых прямоугольниками и маской области.
+// Прямоугольники обрезаются по матрице, маска просматривается один раз
+static bool mark_region(const matrix_t *matrix, const median_region_t *region, unsigned char *marks,
+                        int tiles_x) {
+    for (int i = 0; i < region->rect_count; i++) {
+        const median_rect_t *rect = &region->rects[i];
+        if (rect->width < 0 || rect->height < 0) {
+            fprintf(stderr, "Error: Invalid region rectangle %dx%d at (%d, %d)\n", rect->height, rect->width,
+                    rect->y, rect->x);
+            return false;
+        }
+        int y0, y1, x0, x1;
+        clip_rect(matrix, rect, &y0, &y1, &x0, &x1);
+        for (int ty = y0 / REGION_TILE_SIZE; y0 < y1 && ty <= (y1 - 1) / REGION_TILE_SIZE; ty++) {
+            for (int tx = x0 / REGION_TILE_SIZE; x0 < x1 && tx <= (x1 - 1) / REGION_TILE_SIZE; tx++) {
+                marks[ty * tiles_x + tx] |= REGION_RECT;
+            }
+        }
+    }
+    
+    const matrix_t *mask = region->mask;
+    if (!mask) return true;
+    if (mask->width != matrix->width || mask->height != matrix->height) {
+        fprintf(stderr, "Error: Mask %dx%d does not match %dx%d matrix\n", mask->height, mask->width,
+                matrix->height, matrix->width);
+        return false;
+    }
+    for (int y = 0; y < mask->height; y++) {
+        const int *row = MATRIX_ROW(mask, y);
+        for (int x = 0; x < mask->width; x++) {
+            if (row[x]) marks[y / REGION_TILE_SIZE * tiles_x + x / REGION_TILE_SIZE] |= REGION_MASK;
+        }
+    }
+    return true;
+}
+
+// Функция для расстояния (по Чебышеву, в плитках) от каждой плитки до
+// ближайшей отмеченной: два прохода по сетке (INT_MAX / 2 - отметок нет)
+static void region_distances(const unsigned char *marks, int *dist, int tiles_x, int tiles_y) {
+    int far = INT_MAX / 2;
+    for (int t = 0; t < tiles_x * tiles_y; t++) dist[t] = marks[t] ? 0 : far;
+    
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int *d = &dist[ty * tiles_x + tx];
+            for (int dx = -1; dx <= 1 && ty > 0; dx++) {
+                if (tx + dx >= 0 && tx + dx < tiles_x) *d = imin(*d, dist[(ty - 1) * tiles_x + tx + dx] + 1);
+            }
+            if (tx > 0) *d = imin(*d, dist[ty * tiles_x + tx - 1] + 1);
+        }
+    }
+    for (int ty = tiles_y - 1; ty >= 0; ty--) {
+        for (int tx = tiles_x - 1; tx >= 0; tx--) {
+            int *d = &dist[ty * tiles_x + tx];
+            for (int dx = -1; dx <= 1 && ty < tiles_y - 1; dx++) {
+                if (tx + dx >= 0 && tx + dx < tiles_x) *d = imin(*d, dist[(ty + 1) * tiles_x + tx + dx] + 1);
+            }
+            if (tx < tiles_x - 1) *d = imin(*d, dist[ty * tiles_x + tx + 1] + 1);
+        }
+    }
+}
+
+// Функция для расстояния в плитках, на которое доходят iters итераций
+// окна радиуса radius (не больше tiles: дальше плиток нет)
+static int region_reach(int iters, int radius, int tiles) {
+    long reach = ((long)iters * radius + REGION_TILE_SIZE - 1) / REGION_TILE_SIZE;
+    return reach < tiles ? (int)reach : tiles;
+}
+
+// Функция для списка плиток не дальше reach от области (их число)
+static int region_tiles(const int *dist, int tiles, int reach, int *list) {
+    int count = 0;
+    for (int t = 0; t < tiles; t++) {
+        if (dist[t] <= reach) list[count++] = t;
+    }
+    return count;
+}
+
+// Функция для уровней яркости по входу плиток list (значения берутся из
+// прямоугольника, охватывающего эти плитки) и замены ими значений плиток
+// в обеих рабочих матрицах. Без уровней алгоритм переходит на сортировку
+static bool prepare_region_levels(filter_params_t *params, const matrix_t *input, matrix_t **buffers,
+                                  const int *list, int count, value_levels_t *levels) {
+    levels->values = NULL;
+    levels->count = 0;
+    if (!uses_levels(params->algorithm) || count == 0) return true;
+    
+    int by0 = INT_MAX, by1 = 0, bx0 = INT_MAX, bx1 = 0;
+    for (int i = 0; i < count; i++) {
+        int y0, y1, x0, x1;
+        tile_rect(input, REGION_TILE_SIZE, list[i], &y0, &y1, &x0, &x1);
+        by0 = imin(by0, y0);
+        by1 = imax(by1, y1);
+        bx0 = imin(bx0, x0);
+        bx1 = imax(bx1, x1);
+    }
+    
+    matrix_t bounds = matrix_view(input, by0, by1, bx0, bx1);
+    if (!build_value_levels(&bounds, levels)) {
+        fprintf(stderr, "Warning: More than %d distinct values, falling back to sort\n", HIST_MAX_LEVELS);
+        params->algorithm = ALGO_SORT;
+        return true;
+    }
+    params->levels = levels->count;
+    
+    for (int i = 0; i < count; i++) {
+        int y0, y1, x0, x1;
+        tile_rect(input, REGION_TILE_SIZE, list[i], &y0, &y1, &x0, &x1);
+        for (int b = 0; b < 2; b++) {
+            matrix_t tile = matrix_view(buffers[b], y0, y1, x0, x1);
+            matrix_to_levels(&tile, levels);
+        }
+    }
+    return true;
+}
+
+// Функция для записи результата в пиксели области матрицы matrix
+// (плитки маски переписываются попиксельно, прямоугольники - строками)
+static void store_region(matrix_t *matrix, const matrix_t *result, const median_region_t *region,
+                         const unsigned char *marks, int tiles) {
+    for (int i = 0; i < region->rect_count; i++) {
+        int y0, y1, x0, x1;
+        clip_rect(matrix, &region->rects[i], &y0, &y1, &x0, &x1);
+        for (int y = y0; y < y1 && x0 < x1; y++) {
+            memcpy(MATRIX_ROW(matrix, y) + x0, MATRIX_ROW(result, y) + x0, (x1 - x0) * sizeof(int));
+        }
+    }
+    
+    for (int t = 0; t < tiles; t++) {
+        if (!(marks[t] & REGION_MASK)) continue;
+        int y0, y1, x0, x1;
+        tile_rect(matrix, REGION_TILE_SIZE, t, &y0, &y1, &x0, &x1);
+        for (int y = y0; y < y1; y++) {
+            const int *mask = MATRIX_ROW(region->mask, y);
+            for (int x = x0; x < x1; x++) {
+                if (mask[x]) MATRIX_ROW(matrix, y)[x] = MATRIX_ROW(result, y)[x];
+            }
+        }
+    }
+}
+
+bool median_context_filter_region(median_context_t *ctx, matrix_t *matrix, int k_iters,
+                                  const filter_params_t *params, const median_region_t *region) {
+    if (!valid_request(matrix, k_iters, params)) return false;
+    
+    filter_params_t resolved = median_resolve_params(params);
+    int radius = resolved.window_size / 2;
+    int tiles_x = (matrix->width + REGION_TILE_SIZE - 1) / REGION_TILE_SIZE;
+    int tiles_y = (matrix->height + REGION_TILE_SIZE - 1) / REGION_TILE_SIZE;
+    int tiles = tiles_x * tiles_y;
+    
+    unsigned char *marks = calloc(tiles, 1);
+    int *dist = malloc(tiles * sizeof(int));
+    int *list = malloc(tiles * sizeof(int));
+    value_levels_t levels = { 0 };
+    bool ok = marks && dist && list;
+    if (!ok) fprintf(stderr, "Error: Memory allocation failed for %d region tiles\n", tiles);
+    ok = ok && mark_region(matrix, region, marks, tiles_x);
+    if (ok) region_distances(marks, dist, tiles_x, tiles_y);
+    
+    // Вход копируется в обе рабочие матрицы на всю глубину чтения (с рамкой
+    // у краев матрицы): ячейки за окрестностью итерации хранят устаревшие,
+    // но допустимые значения
+    int count = ok ? region_tiles(dist, tiles, region_reach(k_iters, radius, tiles) +
+                                  region_reach(1, radius, tiles), list) : 0;
+    
+    // Пустая область (маска без единиц, прямоугольники вне матрицы):
+    // матрица остается как есть
+    if (ok && count == 0) {
+        free(marks);
+        free(dist);
+        free(list);
+        return true;
+    }
+    ok = ok && reserve_buffers(ctx, matrix->width, matrix->height, radius, 2);
+    for (int i = 0; i < count && ok; i++) {
+        int y0, y1, x0, x1;
+        tile_rect(matrix, REGION_TILE_SIZE, list[i], &y0, &y1, &x0, &x1);
+        for (int b = 0; b < 2; b++) {
+            for (int y = y0; y < y1; y++) {
+                memcpy(MATRIX_ROW(ctx->buffers[b], y) + x0, MATRIX_ROW(matrix, y) + x0, (x1 - x0) * sizeof(int));
+            }
+            fill_tile_halo(ctx->buffers[b], y0, y1, x0, x1);
+        }
+    }
+    ok = ok && prepare_region_levels(&resolved, matrix, ctx->buffers, list, count, &levels);
+    ok = ok && reserve_scratch(ctx, &resolved, matrix->width, REGION_TILE_SIZE);
+    
+    matrix_t *current = ctx->buffers[0];
+    matrix_t *next = ctx->buffers[1];
+    for (int iter = 1; iter <= k_iters && ok; iter++) {
+        count = region_tiles(dist, tiles, region_reach(k_iters - iter, radius, tiles), list);
+        
+        region_job_t job = {
+            .src = current,
+            .dst = next,
+            .params = &resolved,
+            .scratch = ctx->scratch,
+            .tiles = list,
+            .count = count,
+            .parts = ctx->pool ? thread_pool_size(ctx->pool) : 1
+        };
+        atomic_init(&job.failed, false);
+        if (ctx->pool) thread_pool_run(ctx->pool, region_task, &job);
+        else region_task(&job, 0);
+        ok = !atomic_load(&job.failed);
+        
+        matrix_t *temp = current;
+        current = next;
+        next = temp;
+    }
+    
+    // Уровни возвращаются в значения только в плитках области
+    for (int t = 0; t < tiles && ok && uses_levels(resolved.algorithm); t++) {
+        if (!marks[t]) continue;
+        int y0, y1, x0, x1;
+        tile_rect(matrix, REGION_TILE_SIZE, t, &y0, &y1, &x0, &x1);
+        matrix_t tile = matrix_view(current, y0, y1, x0, x1);
+        matrix_from_levels(&tile, &levels);
+    }
+    if (ok) store_region(matrix, current, region, marks, tiles);
+    
+    free(levels.values);
+    free(marks);
+    free(dist);
+    free(list);
+    return ok;
+}
+
+
+// ИЗОБРАЖЕНИЯ
+// Каналы фильтруются по одному. Медиана окна 3, 5 и 7 для uint8 и uint16
+// идет сетями сравнения-обмена прямо над компактной плоскостью канала;
+// остальные алгоритмы и int32 с несколькими каналами работают через
+// матрицу int канала
+
+// Размеры элементов в байтах (в порядке median_element_t)
+static const int element_sizes[MEDIAN_ELEMENT_COUNT] = { 4, 1, 2 };
+
+// Задание пула: одна итерация над компактной плоскостью, строки делятся
+// между потоками поровну
+typedef struct {
+    const compact_plane_t *src;
+    compact_plane_t *dst;
+    const filter_params_t *params;
+    scratch_arena_t *scratch;
+    int parts;
+    atomic_bool failed;
+} compact_job_t;
+
+static void compact_task(void *arg, int thread_id) {
+    compact_job_t *job = arg;
+    int height = job->src->height;
+    int y0 = (int)((long)height * thread_id / job->parts);
+    int y1 = (int)((long)height * (thread_id + 1) / job->parts);
+    
+    if (!apply_median_filter_compact(job->src, job->dst, job->params->window_size, job->params->simd,
+                                     &job->scratch[thread_id], y0, y1)) {
+        atomic_store(&job->failed, true);
+    }
+    instrument_add_work(thread_id, y1 - y0, (long long)(y1 - y0) * job->src->width);
+}
+
+// Функция для подготовки двух компактных плоскостей контекста под канал
+// width x height (память прошлого вызова переиспользуется)
+static bool reserve_planes(median_context_t *ctx, int width, int height, int element_size) {
+    int stride = (int)((((size_t)width * element_size + MATRIX_ALIGNMENT - 1) & ~(size_t)(MATRIX_ALIGNMENT - 1)) /
+                       element_size);
+    size_t bytes = (size_t)stride * height * element_size;
+    
+    if (bytes > ctx->plane_capacity) {
+        for (int i = 0; i < 2; i++) {
+            free(ctx->planes[i].data);
+            if (posix_memalign(&ctx->planes[i].data, MATRIX_ALIGNMENT, bytes) != 0) ctx->planes[i].data = NULL;
+        }
+        if (!ctx->planes[0].data || !ctx->planes[1].data) {
+            fprintf(stderr, "Error: Memory allocation failed for %dx%d channel\n", height, width);
+            free(ctx->planes[0].data);
+            free(ctx->planes[1].data);
+            ctx->planes[0].data = ctx->planes[1].data = NULL;
+            ctx->plane_capacity = 0;
+            return false;
+        }
+        ctx->plane_capacity = bytes;
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        ctx->planes[i].width = width;
+        ctx->planes[i].height = height;
+        ctx->planes[i].stride = stride;
+        ctx->planes[i].element_size = element_size;
+    }
+    return true;
+}
+
+// Функция для шага в байтах между соседними значениями канала в строке
+static size_t sample_step(const median_image_t *image) {
+    int size = element_sizes[image->type];
+    return image->channel_stride ? (size_t)size : (size_t)size * image->channels;
+}
+
+// Функция для начала строки y канала channel изображения
+static char* channel_row(const median_image_t *image, int y, int channel) {
+    size_t offset = image->channel_stride ? (size_t)channel * image->channel_stride
+                                          : (size_t)channel * element_sizes[image->type];
+    return (char*)image->data + (size_t)y * image->stride + offset;
+}
+
+// Функция для копирования канала channel изображения в компактную
+// плоскость (to_image - из плоскости обратно в изображение)
+static void copy_plane(const median_image_t *image, int channel, const compact_plane_t *plane, bool to_image) {
+    size_t step = sample_step(image);
+    size_t row_bytes = (size_t)plane->width * plane->element_size;
+    
+    for (int y = 0; y < image->height; y++) {
+        char *row = channel_row(image, y, channel);
+        char *plane_row = (char*)plane->data + (size_t)y * plane->stride * plane->element_size;
+        if (step == (size_t)plane->element_size) {
+            if (to_image) memcpy(row, plane_row, row_bytes);
+            else memcpy(plane_row, row, row_bytes);
+        } else if (plane->element_size == 1) {
+            uint8_t *values = (uint8_t*)plane_row;
+            for (int x = 0; x < image->width; x++, row += step) {
+                if (to_image) *(uint8_t*)row = values[x];
+                else values[x] = *(uint8_t*)row;
+            }
+        } else {
+            uint16_t *values = (uint16_t*)plane_row;
+            for (int x = 0; x < image->width; x++, row += step) {
+                if (to_image) *(uint16_t*)row = values[x];
+                else values[x] = *(uint16_t*)row;
+            }
+        }
+    }
+}
+
+// Функция для копирования канала channel изображения в матрицу int
+// (to_image - из матрицы обратно в изображение)
+static void copy_channel(const median_image_t *image, int channel, matrix_t *matrix, bool to_image) {
+    size_t step = sample_step(image);
+    
+    for (int y = 0; y < image->height; y++) {
+        char *row = channel_row(image, y, channel);
+        int *values = MATRIX_ROW(matrix, y);
+        for (int x = 0; x < image->width; x++, row += step) {
+            switch (image->type) {
+                case MEDIAN_UINT8:
+                    if (to_image) *(uint8_t*)row = (uint8_t)values[x];
+                    else values[x] = *(uint8_t*)row;
+                    break;
+                case MEDIAN_UINT16:
+                    if (to_image) *(uint16_t*)row = (uint16_t)values[x];
+                    else values[x] = *(uint16_t*)row;
+                    break;
+                default:
+                    if (to_image) *(int32_t*)row = values[x];
+                    else values[x] = *(int32_t*)row;
+                    break;
+            }
+        }
+    }
+}
+
+// Функция для k_iters итераций медианы над компактным каналом channel
+static bool filter_compact_channel(median_context_t *ctx, const median_image_t *src, const median_image_t *dst,
+                                   int channel, int k_iters, const filter_params_t *params) {
+    int current = 0;
+    copy_plane(src, channel, &ctx->planes[0], false);
+    
+    for (int iter = 0; iter < k_iters; iter++) {
+        compact_plane_t *from = &ctx->planes[current];
+        compact_plane_t *to = &ctx->planes[1 - current];
+        if (ctx->pool) {
+            compact_job_t job = {
+                .src = from,
+                .dst = to,
+                .params = params,
+                .scratch = ctx->scratch,
+                .parts = thread_pool_size(ctx->pool)
+            };
+            atomic_init(&job.failed, false);
+            thread_pool_run(ctx->pool, compact_task, &job);
+            if (atomic_load(&job.failed)) return false;
+        } else {
+            if (!apply_median_filter_compact(from, to, params->window_size, params->simd, &ctx->scratch[0],
+                                             0, from->height)) {
+                return false;
+            }
+            instrument_add_work(-1, from->height, (long long)from->height * from->width);
+        }
+        current = 1 - current;
+    }
+    
+    copy_plane(dst, channel, &ctx->planes[current], true);
+    return true;
+}
+
+// Функция для k_iters итераций фильтра над каналом channel через матрицу int
+static bool filter_wide_channel(median_context_t *ctx, const median_image_t *src, const median_image_t *dst,
+                                int channel, int k_iters, const filter_params_t *params) {
+    copy_channel(src, channel, ctx->channel, false);
+    
+    const matrix_t *result = ctx->channel;
+    if (params->in_place) {
+        if (!median_context_filter_in_place(ctx, ctx->channel, k_iters, params)) return false;
+    } else {
+        result = median_context_filter(ctx, ctx->channel, k_iters, params, NULL);
+        if (!result) return false;
+    }
+    
+    copy_channel(dst, channel, (matrix_t*)result, true);
+    return true;
+}
+
+// Функция для проверки описания изображения: тип, размеры и шаги,
+// выровненные по размеру элемента
+static bool valid_image(const median_image_t *image) {
+    if ((int)image->type < 0 || image->type >= MEDIAN_ELEMENT_COUNT || image->channels <= 0 ||
+        image->width <= 0 || image->height <= 0 || !image->data) {
+        fprintf(stderr, "Error: Invalid image description\n");
+        return false;
+    }
+    
+    size_t size = element_sizes[image->type];
+    size_t row_bytes = (size_t)image->width * sample_step(image);
+    if (image->stride % size != 0 || image->channel_stride % size != 0 || image->stride < row_bytes ||
+        (image->channel_stride && image->channels > 1 && image->channel_stride < row_bytes)) {
+        fprintf(stderr, "Error: Invalid image stride\n");
+        return false;
+    }
+    return true;
+}
+
+bool median_filter_image(median_context_t *ctx, const median_image_t *src, const median_image_t *dst,
+                         int k_iters, const filter_params_t *params) {
+    if (!valid_image(src) || !valid_image(dst)) return false;
+    if (src->type != dst->type || src->width != dst->width || src->height != dst->height ||
+        src->channels != dst->channels) {
+        fprintf(stderr, "Error: Source and destination images differ in shape or type\n");
+        return false;
+    }
+    
+    matrix_t shape = { .width = src->width, .height = src->height };
+    if (!valid_request(&shape, k_iters, params)) return false;
+    
+    // Один канал int32 фильтруется прямо в буферах вызывающей стороны
+    if (src->type == MEDIAN_INT32 && src->channels == 1) {
+        return median_filter_buffer(ctx, src->data, src->stride, dst->data, dst->stride, src->width,
+                                    src->height, MEDIAN_INT32, k_iters, params, NULL);
+    }
+    
+    filter_params_t resolved = median_resolve_params(params);
+    bool compact = src->type != MEDIAN_INT32 && resolved.algorithm == ALGO_NETWORK;
+    if (compact) {
+        if (!reserve_planes(ctx, src->width, src->height, element_sizes[src->type])) return false;
+        size_t size = compact_scratch_size(resolved.window_size, src->width, element_sizes[src->type]);
+        for (int i = 0; i < ctx->scratch_count; i++) {
+            if (!scratch_reserve(&ctx->scratch[i], size)) {
+                fprintf(stderr, "Error: Memory allocation failed for %zu bytes of filter scratch\n", size);
+                return false;
+            }
+        }
+    } else if (!ctx->channel || ctx->channel->width != src->width || ctx->channel->height != src->height) {
+        free_matrix(ctx->channel);
+        ctx->channel = allocate_matrix(src->width, src->height, 0);
+        if (!ctx->channel) {
+            fprintf(stderr, "Error: Memory allocation failed for %dx%d channel\n", src->height, src->width);
+            return false;
+        }
+    }
+    
+    for (int c = 0; c < src->channels; c++) {
+        bool ok = compact ? filter_compact_channel(ctx, src, dst, c, k_iters, &resolved)
+                          : filter_wide_channel(ctx, src, dst, c, k_iters, &resolved);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// ПОТОКОВАЯ ВЕРСИЯ
+// Матрица не загружается целиком: строки входа проходят через конвейер
+// из k ступеней, каждая ступень хранит скользящую полосу строк своего
+// входа (2r строк контекста и порция новых) и выдает готовые строки
+// следующей ступени. Память O(width * (window + STREAM_BATCH_ROWS) * k)
+
+// Порция строк, которую ступень накапливает перед обработкой
+#define STREAM_BATCH_ROWS 16
+
+// Прочитанная часть отображения входа освобождается порциями этого размера
+#define STREAM_RELEASE_BYTES (8 << 20)
+
+// Построчный источник матрицы: двоичный файл читается прямо из
+// отображения, текстовый разбирается по строкам
+typedef struct {
+    matrix_t *binary;
+    text_matrix_t text;
+    size_t text_pos;
+    int width;
+    int height;
+    int next_row;
+    size_t released;    // начало еще не освобожденной части отображения
+} row_reader_t;
+
+// Построчный приемник матрицы: двоичный файл (строки пишутся по своим
+// смещениям) или текстовый. Строки идут во временный файл, который при
+// закрытии заменяет результат: вход может быть отображен из того же файла
+typedef struct {
+    text_writer_t *text;
+    int fd;
+    size_t stride;
+    int next_row;
+    const char *filename;
+    char temp[PATH_MAX];
+} row_writer_t;
+
+// Ступень конвейера: полоса band хранит строки [first, first + filled)
+// входа ступени, строки результата считаются в out с теми же номерами
+typedef struct {
+    matrix_t *band;
+    matrix_t *out;
+    int first;
+    int filled;
+    int next_out;   // следующая строка результата ступени
+} stream_stage_t;
+
+// Потоковый конвейер
+typedef struct {
+    stream_stage_t *stages;
+    int k_iters;
+    int height;
+    const filter_params_t *params;
+    const value_levels_t *levels;
+    matrix_t *line;     // строка результата, переводимая из уровней
+    row_writer_t *writer;
+    thread_pool_t *pool;
+    scratch_arena_t *scratch;   // рабочая память ядер, по одной на поток
+    bool error;
+} stream_pipeline_t;
+
+// Задание пула: строки [y0, y1) порции ступени делятся между потоками
+typedef struct {
+    const matrix_t *src;
+    matrix_t *dst;
+    const filter_params_t *params;
+    scratch_arena_t *scratch;
+    int y0;
+    int y1;
+    int parts;
+} stream_batch_job_t;
+
+// Функция для открытия построчного источника
+static bool row_reader_open(row_reader_t *reader, const char *filename) {
+    reader->binary = NULL;
+    reader->text_pos = 0;
+    reader->next_row = 0;
+    reader->released = 0;
+    if (has_extension(filename, ".bin")) {
+        reader->binary = read_matrix_binary(filename);
+        if (!reader->binary) return false;
+        reader->width = reader->binary->width;
+        reader->height = reader->binary->height;
+        return true;
+    }
+    if (!text_matrix_open(filename, &reader->text)) return false;
+    reader->width = reader->text.cols;
+    reader->height = reader->text.rows;
+    reader->text_pos = reader->text.body;
+    return true;
+}
+
+// Функция для возврата источника к первой строке
+static void row_reader_rewind(row_reader_t *reader) {
+    reader->next_row = 0;
+    reader->text_pos = reader->text.body;
+    reader->released = 0;
+}
+
+// Функция для чтения очередной строки источника
+static bool row_reader_next(row_reader_t *reader, int *row) {
+    const char *base;
+    size_t consumed;
+    if (reader->binary) {
+        const int *src = MATRIX_ROW(reader->binary, reader->next_row);
+        memcpy(row, src, reader->width * sizeof(int));
+        base = reader->binary->mapping;
+        consumed = (const char*)src - base;
+    } else {
+        if (!text_matrix_read_row(&reader->text, &reader->text_pos, row)) return false;
+        base = reader->text.text;
+        consumed = reader->text_pos;
+    }
+    reader->next_row++;
+    
+    // Прочитанные страницы файла больше не нужны: отдаем их системе,
+    // чтобы вход не копился в памяти процесса
+    if (consumed - reader->released >= STREAM_RELEASE_BYTES) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t end = consumed / page * page;
+        madvise((void*)(base + reader->released), end - reader->released, MADV_DONTNEED);
+        reader->released = end;
+    }
+    return true;
+}
+
+// Функция для закрытия источника
+static void row_reader_close(row_reader_t *reader) {
+    if (reader->binary) {
+        free_matrix(reader->binary);
+    } else {
+        text_matrix_close(&reader->text);
+    }
+}
+
+// Функция для открытия построчного приемника матрицы width x height
+static bool row_writer_open(row_writer_t *writer, const char *filename, int width, int height) {
+    writer->text = NULL;
+    writer->fd = -1;
+    writer->next_row = 0;
+    writer->filename = filename;
+    if (!output_temp_path(filename, writer->temp, sizeof(writer->temp))) return false;
+    
+    const char *target = writer->temp[0] ? writer->temp : filename;
+    if (!has_extension(filename, ".bin")) {
+        writer->text = text_writer_open(target, height, width);
+        if (!writer->text) output_commit(writer->temp, filename, false);
+        return writer->text != NULL;
+    }
+    
+    // Файл сразу получает полный размер, строки пишутся по смещениям
+    size_t row_bytes = (size_t)width * sizeof(int);
+    writer->stride = (row_bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    matrix_bin_header_t header = {
+        .version = MATRIX_BIN_VERSION,
+        .element_type = MATRIX_BIN_INT32,
+        .height = height,
+        .width = width,
+        .stride = writer->stride,
+        .data_offset = sizeof(matrix_bin_header_t)
+    };
+    memcpy(header.magic, MATRIX_BIN_MAGIC, sizeof(header.magic));
+    
+    writer->fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0 ||
+        ftruncate(writer->fd, sizeof(header) + writer->stride * height) != 0 ||
+        pwrite(writer->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        fprintf(stderr, "Error: Cannot create file %s\n", target);
+        if (writer->fd >= 0) close(writer->fd);
+        output_commit(writer->temp, filename, false);
+        return false;
+    }
+    return true;
+}
+
+// Функция для записи очередной строки width значений
+static bool row_writer_next(row_writer_t *writer, const int *row, int width) {
+    if (writer->text) return text_writer_row(writer->text, row);
+    
+    size_t bytes = (size_t)width * sizeof(int);
+    off_t offset = sizeof(matrix_bin_header_t) + writer->stride * writer->next_row++;
+    return pwrite(writer->fd, row, bytes, offset) == (ssize_t)bytes;
+}
+
+// Функция для закрытия приемника: при ok результат заменяет файл,
+// иначе временный файл удаляется
+static bool row_writer_close(row_writer_t *writer, bool ok) {
+    bool closed = writer->text ? text_writer_close(writer->text) : close(writer->fd) == 0;
+    return output_commit(writer->temp, writer->filename, closed && ok);
+}
+
+// Функция потока пула: свои строки порции ступени
+static void stream_batch_task(void *arg, int thread_id) {
+    stream_batch_job_t *job = (stream_batch_job_t*)arg;
+    int rows = job->y1 - job->y0;
+    int y0 = job->y0 + (int)((long)rows * thread_id / job->parts);
+    int y1 = job->y0 + (int)((long)rows * (thread_id + 1) / job->parts);
+    if (y0 < y1) filter_rows(job->src, job->dst, job->params, job->scratch + thread_id, y0, y1);
+}
+
+static void stream_push(stream_pipeline_t *pipeline, int stage, const int *row);
+
+// Функция для обработки накопленных строк ступени: считаются строки,
+// для которых есть все r строк снизу (в конце входа - все оставшиеся),
+// они передаются дальше, а полоса сдвигается с сохранением 2r строк
+static void stream_process(stream_pipeline_t *pipeline, int index, bool final) {
+    stream_stage_t *stage = &pipeline->stages[index];
+    const filter_params_t *params = pipeline->params;
+    int radius = params->window_size / 2;
+    
+    // Вид полосы высотой filled: края вида совпадают с краями матрицы
+    // только там, где полоса действительно касается края
+    matrix_t view = *stage->band;
+    view.height = stage->filled;
+    matrix_t out = *stage->out;
+    out.height = stage->filled;
+    if (final) {
+        // Под последней строкой входа - рамка, как под краем матрицы
+        for (int y = stage->filled; y < stage->filled + radius; y++) {
+            int *row = MATRIX_ROW(&view, y);
+            for (int x = -view.halo; x < view.width + view.halo; x++) row[x] = MATRIX_PAD;
+        }
+    }
+    
+    int y0 = stage->next_out - stage->first;
+    int y1 = final ? stage->filled : stage->filled - radius;
+    if (y0 >= y1) return;
+    
+    int parts = pipeline->pool ? thread_pool_size(pipeline->pool) : 1;
+    stream_batch_job_t job = {
+        .src = &view, .dst = &out, .params = params, .scratch = pipeline->scratch,
+        .y0 = y0, .y1 = y1, .parts = parts
+    };
+    if (pipeline->pool) {
+        thread_pool_run(pipeline->pool, stream_batch_task, &job);
+    } else {
+        stream_batch_task(&job, 0);
+    }
+    
+    for (int y = y0; y < y1 && !pipeline->error; y++) {
+        stream_push(pipeline, index + 1, MATRIX_ROW(&out, y));
+    }
+    stage->next_out = stage->first + y1;
+    
+    // Оставляем r строк контекста над следующей строкой результата
+    int drop = y1 - radius;
+    if (!final && drop > 0) {
+        memmove(MATRIX_ROW(stage->band, 0) - stage->band->halo, MATRIX_ROW(stage->band, drop) - stage->band->halo,
+                (size_t)(stage->filled - drop) * stage->band->stride * sizeof(int));
+        stage->first += drop;
+        stage->filled -= drop;
+    }
+}
+
+// Функция для передачи строки входа ступени stage (после последней
+// ступени строка переводится из уровней и записывается)
+static void stream_push(stream_pipeline_t *pipeline, int index, const int *row) {
+    if (index == pipeline->k_iters) {
+        int width = pipeline->line->width;
+        if (pipeline->levels->count > 0) {
+            memcpy(pipeline->line->data, row, width * sizeof(int));
+            matrix_from_levels(pipeline->line, pipeline->levels);
+            row = pipeline->line->data;
+        }
+        if (!row_writer_next(pipeline->writer, row, width)) pipeline->error = true;
+        return;
+    }
+    
+    stream_stage_t *stage = &pipeline->stages[index];
+    memcpy(MATRIX_ROW(stage->band, stage->filled), row, stage->band->width * sizeof(int));
+    stage->filled++;
+    if (stage->filled == stage->band->height) {
+        stream_process(pipeline, index, false);
+    }
+}
+
+// Функция для построения уровней яркости по строкам источника
+// (плотный диапазон или до HIST_MAX_LEVELS различных значений)
+static bool stream_build_levels(row_reader_t *reader, int *row, value_levels_t *levels) {
+    int min_value = INT_MAX, max_value = INT_MIN;
+    for (int y = 0; y < reader->height; y++) {
+        if (!row_reader_next(reader, row)) return false;
+        for (int x = 0; x < reader->width; x++) {
+            if (row[x] < min_value) min_value = row[x];
+            if (row[x] > max_value) max_value = row[x];
+        }
+    }
+    row_reader_rewind(reader);
+    
+    levels->values = NULL;
+    levels->min_value = min_value;
+    if ((long long)max_value - min_value < HIST_MAX_LEVELS) {
+        levels->count = max_value - min_value + 1;
+        return true;
+    }
+    
+    // Разреженный диапазон: упорядоченный список различных значений
+    int *values = malloc(HIST_MAX_LEVELS * sizeof(int));
+    if (!values) return false;
+    int count = 0;
+    for (int y = 0; y < reader->height; y++) {
+        if (!row_reader_next(reader, row)) {
+            free(values);
+            return false;
+        }
+        for (int x = 0; x < reader->width; x++) {
+            int lo = 0, hi = count;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (values[mid] < row[x]) lo = mid + 1;
+                else hi = mid;
+            }
+            if (lo < count && values[lo] == row[x]) continue;
+            if (count == HIST_MAX_LEVELS) {
+                free(values);
+                row_reader_rewind(reader);
+                return false;
+            }
+            memmove(values + lo + 1, values + lo, (count - lo) * sizeof(int));
+            values[lo] = row[x];
+            count++;
+        }
+    }
+    row_reader_rewind(reader);
+    levels->values = values;
+    levels->count = count;
+    return true;
+}
+
+bool median_filter_stream(const char *input, const char *output, int k_iters,
+                          thread_pool_t *pool, const filter_params_t *filter) {
+    row_reader_t reader;
+    if (!row_reader_open(&reader, input)) return false;
+    
+    filter_params_t params = *filter;
+    params.algorithm = select_algorithm(params.algorithm, params.window_size, params.percentile);
+    int radius = params.window_size / 2;
+    int width = reader.width, height = reader.height;
+    int band_rows = 2 * radius + imax(STREAM_BATCH_ROWS, params.window_size);
+    
+    stream_stage_t *stages = calloc(k_iters, sizeof(stream_stage_t));
+    matrix_t *row = create_matrix(width, 1, 0);
+    matrix_t *line = create_matrix(width, 1, 0);
+    bool ok = stages && row && line;
+    for (int i = 0; i < k_iters && ok; i++) {
+        stages[i].band = create_matrix(width, band_rows, radius);
+        stages[i].out = create_matrix(width, band_rows, 0);
+        ok = stages[i].band && stages[i].out;
+    }
+    
+    value_levels_t levels = { .values = NULL, .count = 0 };
+    if (ok && uses_levels(params.algorithm)) {
+        if (stream_build_levels(&reader, row->data, &levels)) {
+            params.levels = levels.count;
+        } else {
+            fprintf(stderr, "Warning: More than %d distinct values, falling back to sort\n", HIST_MAX_LEVELS);
+            params.algorithm = ALGO_SORT;
+            levels.count = 0;
+            row_reader_rewind(&reader);
+        }
+    }
+    
+    // Рабочая память ядер для каждого потока, одна на все ступени и порции
+    int parts = pool ? thread_pool_size(pool) : 1;
+    scratch_arena_t *scratch = calloc(parts, sizeof(scratch_arena_t));
+    size_t scratch_size = filter_scratch_size(&params, width, width);
+    ok = ok && scratch;
+    for (int i = 0; i < parts && ok; i++) {
+        ok = scratch_reserve(&scratch[i], scratch_size);
+    }
+    
+    row_writer_t writer;
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for stream buffers\n");
+    } else {
+        ok = row_writer_open(&writer, output, width, height);
+    }
+    
+    if (ok) {
+        stream_pipeline_t pipeline = {
+            .stages = stages,
+            .k_iters = k_iters,
+            .height = height,
+            .params = &params,
+            .levels = &levels,
+            .line = line,
+            .writer = &writer,
+            .pool = pool,
+            .scratch = scratch
+        };
+        
+        for (int y = 0; y < height && !pipeline.error; y++) {
+            if (!row_reader_next(&reader, row->data)) {
+                pipeline.error = true;
+                break;
+            }
+            if (levels.count > 0) matrix_to_levels(row, &levels);
+            stream_push(&pipeline, 0, row->data);
+        }
+        
+        // Конец входа: ступени по очереди досчитывают оставшиеся строки
+        for (int i = 0; i < k_iters && !pipeline.error; i++) {
+            stream_process(&pipeline, i, true);
+        }
+        ok = row_writer_close(&writer, !pipeline.error);
+    }
+    
+    for (int i = 0; i < k_iters && stages; i++) {
+        free_matrix(stages[i].band);
+        free_matrix(stages[i].out);
+    }
+    free(stages);
+    for (int i = 0; i < parts && scratch; i++) {
+        scratch_free(&scratch[i]);
+    }
+    free(scratch);
+    free_matrix(row);
+    free_matrix(line);
+    free(levels.values);
+    row_reader_close(&reader);
+    return ok;
+}
+
+double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// ПАКЕТНЫЙ РЕЖИМ
+// Кадры (файлы из списка "вход выход" или матрицы, идущие друг за другом
+// в stdin) проходят конвейер из трех стадий: поток чтения готовит кадр
+// N + 1, главный поток фильтрует кадр N на общем пуле, поток записи
+// выводит кадр N - 1. Записанные кадры возвращаются читателю вместе
+// с входными матрицами, и матрицы того же размера не выделяются заново
+
+// Кадров в очереди между соседними стадиями
+#define FRAME_QUEUE_SIZE 2
+
+// Длина имени файла в списке пакета
+#define BATCH_PATH_MAX 4096
+
+// Кадр конвейера
+typedef struct frame {
+    int index;
+    matrix_t *input;        // NULL - кадр не прочитан (ошибка уже выведена)
+    matrix_t *result;       // копия результата из контекста (переиспользуется)
+    bool filtered;          // result содержит результат этого кадра
+    char input_file[BATCH_PATH_MAX];
+    char output_file[BATCH_PATH_MAX];
+    double filter_ms;
+    int converged;
+    struct frame *next;     // список свободных кадров
+} frame_t;
+
+// Очередь кадров между стадиями; NULL в очереди - конец кадров
+typedef struct {
+    frame_t *items[FRAME_QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} frame_queue_t;
+
+// Пакетное задание
+typedef struct {
+    FILE *list;                 // список "вход выход" (NULL - поток кадров)
+    text_stream_t *stream;      // поток кадров
+    int output_fd;              // вывод кадров потока
+    frame_queue_t to_filter;
+    frame_queue_t to_write;
+    frame_t *spare;             // записанные кадры для повторного использования
+    pthread_mutex_t spare_lock;
+    atomic_bool error;
+    int written;
+} batch_t;
+
+// Функция для создания пустой очереди кадров
+static void frame_queue_init(frame_queue_t *queue) {
+    queue->head = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+// Функция для освобождения очереди кадров
+static void frame_queue_destroy(frame_queue_t *queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+// Функция для добавления кадра (ждет, пока в очереди появится место)
+static void frame_queue_push(frame_queue_t *queue, frame_t *frame) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == FRAME_QUEUE_SIZE) pthread_cond_wait(&queue->changed, &queue->lock);
+    queue->items[(queue->head + queue->count) % FRAME_QUEUE_SIZE] = frame;
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Функция для извлечения кадра (ждет, пока кадр появится)
+static frame_t* frame_queue_pop(frame_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) pthread_cond_wait(&queue->changed, &queue->lock);
+    frame_t *frame = queue->items[queue->head];
+    queue->head = (queue->head + 1) % FRAME_QUEUE_SIZE;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return frame;
+}
+
+// Функция для освобождения кадра и его матриц
+static void free_frame(frame_t *frame) {
+    if (!frame) return;
+    free_matrix(frame->input);
+    free_matrix(frame->result);
+    free(frame);
+}
+
+// Функция для получения свободного кадра (записанного ранее или нового)
+static frame_t* batch_take_frame(batch_t *batch) {
+    pthread_mutex_lock(&batch->spare_lock);
+    frame_t *frame = batch->spare;
+    if (frame) batch->spare = frame->next;
+    pthread_mutex_unlock(&batch->spare_lock);
+    
+    if (!frame) frame = calloc(1, sizeof(frame_t));
+    if (!frame) fprintf(stderr, "Error: Memory allocation failed for frame\n");
+    return frame;
+}
+
+// Функция для возврата записанного кадра читателю
+static void batch_return_frame(batch_t *batch, frame_t *frame) {
+    pthread_mutex_lock(&batch->spare_lock);
+    frame->next = batch->spare;
+    batch->spare = frame;
+    pthread_mutex_unlock(&batch->spare_lock);
+}
+
+// Функция для чтения кадра по очередной строке списка "вход выход"
+// (пустые строки и строки с # пропускаются). Возвращает false в конце
+// списка; ошибка чтения файла оставляет кадр без входа
+static bool read_list_frame(batch_t *batch, frame_t *frame) {
+    char line[2 * BATCH_PATH_MAX + 16];
+    char format[32];
+    snprintf(format, sizeof(format), "%%%ds %%%ds", BATCH_PATH_MAX - 1, BATCH_PATH_MAX - 1);
+    
+    free_matrix(frame->input);
+    frame->input = NULL;
+    while (fgets(line, sizeof(line), batch->list)) {
+        char first;
+        if (sscanf(line, " %c", &first) != 1 || first == '#') continue;
+        
+        if (sscanf(line, format, frame->input_file, frame->output_file) != 2) {
+            fprintf(stderr, "Error: Invalid batch line: %s", line);
+            atomic_store(&batch->error, true);
+            continue;
+        }
+        frame->input = read_matrix(frame->input_file, NULL);
+        if (!frame->input) atomic_store(&batch->error, true);
+        return true;
+    }
+    return false;
+}
+
+// Функция для чтения очередного кадра потока в матрицу кадра (матрица
+// прежнего размера используется повторно). Возвращает false в конце
+// потока или при ошибке (поток после ошибки не продолжить)
+static bool read_stream_frame(batch_t *batch, frame_t *frame) {
+    int rows, cols;
+    bool end;
+    if (!text_stream_header(batch->stream, &rows, &cols, &end)) {
+        if (!end) atomic_store(&batch->error, true);
+        return false;
+    }
+    
+    if (frame->input && (frame->input->width != cols || frame->input->height != rows)) {
+        free_matrix(frame->input);
+        frame->input = NULL;
+    }
+    if (!frame->input) frame->input = create_matrix(cols, rows, 0);
+    if (!frame->input) {
+        fprintf(stderr, "Error: Memory allocation failed for frame\n");
+        atomic_store(&batch->error, true);
+        return false;
+    }
+    
+    if (!text_stream_read(batch->stream, frame->input->data, rows, cols, frame->input->stride)) {
+        atomic_store(&batch->error, true);
+        return false;
+    }
+    return true;
+}
+
+// Функция потока чтения кадров
+static void* batch_reader(void *arg) {
+    batch_t *batch = (batch_t*)arg;
+    
+    for (int index = 0; ; index++) {
+        frame_t *frame = batch_take_frame(batch);
+        if (!frame) {
+            atomic_store(&batch->error, true);
+            break;
+        }
+        
+        frame->index = index;
+        bool read = batch->list ? read_list_frame(batch, frame) : read_stream_frame(batch, frame);
+        if (!read) {
+            free_frame(frame);
+            break;
+        }
+        frame_queue_push(&batch->to_filter, frame);
+        
+        // Поток кадров после ошибки записи дальше не читаем
+        if (!batch->list && atomic_load(&batch->error)) break;
+    }
+    frame_queue_push(&batch->to_filter, NULL);
+    return NULL;
+}
+
+// Функция для записи кадра в поток вывода
+static bool write_stream_frame(int fd, const matrix_t *matrix) {
+    text_writer_t *writer = text_writer_fd(fd, matrix->height, matrix->width);
+    if (!writer) return false;
+    
+    bool ok = true;
+    for (int y = 0; y < matrix->height && ok; y++) {
+        ok = text_writer_row(writer, MATRIX_ROW(matrix, y));
+    }
+    return text_writer_close(writer) && ok;
+}
+
+// Функция для копирования результата фильтра в матрицу кадра (матрица
+// прежнего размера используется повторно)
+static bool copy_frame_result(frame_t *frame, const matrix_t *result) {
+    if (frame->result && (frame->result->width != result->width || frame->result->height != result->height)) {
+        free_matrix(frame->result);
+        frame->result = NULL;
+    }
+    if (!frame->result) frame->result = allocate_matrix(result->width, result->height, 0);
+    if (!frame->result) return false;
+    
+    for (int y = 0; y < result->height; y++) {
+        memcpy(MATRIX_ROW(frame->result, y), MATRIX_ROW(result, y), result->width * sizeof(int));
+    }
+    return true;
+}
+
+// Функция потока записи кадров
+static void* batch_writer(void *arg) {
+    batch_t *batch = (batch_t*)arg;
+    
+    frame_t *frame;
+    while ((frame = frame_queue_pop(&batch->to_write)) != NULL) {
+        if (frame->filtered) {
+            bool ok = batch->list ? write_matrix(frame->output_file, frame->result, NULL)
+                                  : write_stream_frame(batch->output_fd, frame->result);
+            if (ok) {
+                batch->written++;
+                if (batch->list) {
+                    printf("Frame %d: %s -> %s, %dx%d, filter %.3f ms\n", frame->index, frame->input_file,
+                           frame->output_file, frame->result->height, frame->result->width, frame->filter_ms);
+                } else {
+                    printf("Frame %d: %dx%d, filter %.3f ms\n", frame->index,
+                           frame->result->height, frame->result->width, frame->filter_ms);
+                }
+            } else {
+                atomic_store(&batch->error, true);
+            }
+        }
+        batch_return_frame(batch, frame);
+    }
+    return NULL;
+}
+
+bool median_filter_batch(const char *list, int input_fd, int output_fd, int k_iters,
+                         median_context_t *ctx, const filter_params_t *filter) {
+    batch_t batch = { .output_fd = output_fd };
+    if (list) {
+        batch.list = fopen(list, "r");
+        if (!batch.list) {
+            fprintf(stderr, "Error: Cannot open file %s\n", list);
+            return false;
+        }
+    } else {
+        batch.stream = text_stream_open(input_fd);
+        if (!batch.stream) return false;
+    }
+    frame_queue_init(&batch.to_filter);
+    frame_queue_init(&batch.to_write);
+    pthread_mutex_init(&batch.spare_lock, NULL);
+    atomic_init(&batch.error, false);
+    
+    pthread_t reader, writer;
+    bool has_reader = pthread_create(&reader, NULL, batch_reader, &batch) == 0;
+    bool has_writer = has_reader && pthread_create(&writer, NULL, batch_writer, &batch) == 0;
+    if (!has_writer) {
+        fprintf(stderr, "Error: Cannot create batch threads\n");
+        atomic_store(&batch.error, true);
+    }
+    
+    // Главный поток фильтрует кадры; без потока записи кадры только
+    // вычитываются, чтобы поток чтения завершился
+    frame_t *frame;
+    while (has_reader && (frame = frame_queue_pop(&batch.to_filter)) != NULL) {
+        if (!has_writer) {
+            free_frame(frame);
+            continue;
+        }
+        frame->filtered = false;
+        if (frame->input) {
+            double start = get_time_ms();
+            instrument_phase_begin(PHASE_FILTER);
+            const matrix_t *result = median_context_filter(ctx, frame->input, k_iters, filter, &frame->converged);
+            instrument_phase_end();
+            frame->filter_ms = get_time_ms() - start;
+            
+            // Рабочие матрицы контекста нужны следующему кадру, а запись
+            // идет параллельно с ним: результат копируется в матрицу кадра
+            frame->filtered = result && copy_frame_result(frame, result);
+            if (!frame->filtered) {
+                fprintf(stderr, "Error: Filtering frame %d failed\n", frame->index);
+                atomic_store(&batch.error, true);
+            }
+        }
+        frame_queue_push(&batch.to_write, frame);
+    }
+    if (has_writer) {
+        frame_queue_push(&batch.to_write, NULL);
+        pthread_join(writer, NULL);
+    }
+    if (has_reader) pthread_join(reader, NULL);
+    
+    while (batch.spare) {
+        frame_t *next = batch.spare->next;
+        free_frame(batch.spare);
+        batch.spare = next;
+    }
+    pthread_mutex_destroy(&batch.spare_lock);
+    frame_queue_destroy(&batch.to_filter);
+    frame_queue_destroy(&batch.to_write);
+    if (batch.list) fclose(batch.list);
+    text_stream_close(batch.stream);
+    
+    printf("Frames written: %d\n", batch.written);
+    return !atomic_load(&batch.error);
+}
+
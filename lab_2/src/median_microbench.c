@@ -0,0 +1,353 @@
+///usr/bin/cc -O3 -o /tmp/median_microbench $0 "$(dirname $0)/median_kernels.c" && exec /tmp/median_microbench "$@"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#include "../include/median_kernels.h"
+
+// Замеры отдельных ядер медианы на синтетической матрице в памяти (без
+// файлов и потоков): каждое ядро считает одну итерацию по внутренней
+// части матрицы, результат сверяется с эталонным ядром (сортировка окна)
+
+#define MICRO_MAX_AXIS 32
+
+// Распределения синтетических данных
+typedef enum {
+    DIST_RANDOM,    // равномерный шум в [0, 255]
+    DIST_CONSTANT,  // все значения одинаковы
+    DIST_SORTED,    // значения растут по строкам
+    DIST_SALT,      // плавный градиент, 10% пикселей заменены на 0 или 255
+    DIST_COUNT
+} distribution_t;
+
+// Имена распределений для опции -d (в порядке distribution_t)
+static const char *distribution_names[] = { "random", "constant", "sorted", "salt-pepper" };
+
+// Ядро для замера: алгоритм и набор инструкций сетей
+typedef struct {
+    const char *name;
+    filter_algorithm_t algorithm;
+    simd_level_t simd;
+} micro_kernel_t;
+
+// Все ядра (сети только для наборов инструкций, которые есть у процессора)
+static const micro_kernel_t all_kernels[] = {
+    { "sort", ALGO_SORT, SIMD_SCALAR },
+    { "histogram", ALGO_HISTOGRAM, SIMD_SCALAR },
+    { "bitplane", ALGO_BITPLANE, SIMD_SCALAR },
+    { "network-scalar", ALGO_NETWORK, SIMD_SCALAR },
+    { "network-sse4.1", ALGO_NETWORK, SIMD_SSE41 },
+    { "network-avx2", ALGO_NETWORK, SIMD_AVX2 },
+    { "network-avx512", ALGO_NETWORK, SIMD_AVX512 }
+};
+
+#define KERNEL_COUNT (int)(sizeof(all_kernels) / sizeof(all_kernels[0]))
+
+// Глобальные переменные для параметров
+static int size = 256;
+static int windows[MICRO_MAX_AXIS] = { 3, 5, 7, 9 };
+static int window_count = 4;
+static bool distributions[DIST_COUNT] = { true, true, true, true };
+static bool kernels[KERNEL_COUNT] = { true, true, true, true, true, true, true };
+static int repeats = 5;
+static const char *csv_file = NULL;
+
+// Функция для замера времени в наносекундах
+static double get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Функция для заполнения матрицы данными распределения
+static void fill_distribution(matrix_t *matrix, distribution_t distribution) {
+    unsigned seed = 12345;
+    for (int y = 0; y < matrix->height; y++) {
+        int *row = MATRIX_ROW(matrix, y);
+        for (int x = 0; x < matrix->width; x++) {
+            seed = seed * 1103515245u + 12345u;
+            unsigned r = seed >> 8;
+            switch (distribution) {
+                case DIST_RANDOM:
+                    row[x] = r % 256;
+                    break;
+                case DIST_CONSTANT:
+                    row[x] = 128;
+                    break;
+                case DIST_SORTED:
+                    row[x] = y * matrix->width + x;
+                    break;
+                default:
+                    row[x] = (x + y) * 255 / (matrix->width + matrix->height);
+                    if (r % 10 == 0) row[x] = (r & 1024) ? 255 : 0;
+                    break;
+            }
+        }
+    }
+}
+
+// Функция для сравнения времен (для qsort)
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Функция для одной итерации ядра по внутренней части матрицы
+static bool run_kernel(const micro_kernel_t *kernel, const matrix_t *src, matrix_t *dst,
+                       int window_size, int levels, scratch_arena_t *scratch) {
+    int r = window_size / 2;
+    int rows = src->height - r, cols = src->width - r;
+    switch (kernel->algorithm) {
+        case ALGO_HISTOGRAM:
+            return apply_median_filter_iteration_histogram(src, dst, window_size, RANK_MEDIAN, levels,
+                                                           scratch, r, rows, r, cols);
+        case ALGO_BITPLANE:
+            return apply_median_filter_iteration_bitplane(src, dst, window_size, RANK_MEDIAN, levels,
+                                                          scratch, r, rows, r, cols);
+        case ALGO_NETWORK:
+            return apply_median_filter_iteration_network(src, dst, window_size, kernel->simd, scratch,
+                                                           r, rows, r, cols);
+        default:
+            return apply_median_filter_iteration(src, dst, window_size, RANK_MEDIAN, scratch, r, rows, r, cols);
+    }
+}
+
+// Функция для подготовки рабочей памяти ядра (выделение не замеряется)
+static bool reserve_kernel_scratch(scratch_arena_t *scratch, filter_algorithm_t algorithm, int window_size,
+                                   int levels, int size) {
+    filter_params_t params = {
+        .window_size = window_size,
+        .percentile = RANK_MEDIAN,
+        .algorithm = algorithm,
+        .levels = levels
+    };
+    if (scratch_reserve(scratch, filter_scratch_size(&params, size, size))) return true;
+    fprintf(stderr, "Error: Memory allocation failed for kernel scratch\n");
+    return false;
+}
+
+// Функция для сравнения внутренней части результата с эталоном
+static bool same_interior(const matrix_t *a, const matrix_t *b, int window_size) {
+    int r = window_size / 2;
+    for (int y = r; y < a->height - r; y++) {
+        if (memcmp(MATRIX_ROW(a, y) + r, MATRIX_ROW(b, y) + r, (a->width - 2 * r) * sizeof(int)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Функция для разбора списка окон через запятую
+static bool parse_windows(const char *text) {
+    window_count = 0;
+    const char *p = text;
+    while (*p) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value <= 0 || value % 2 == 0 || window_count == MICRO_MAX_AXIS) return false;
+        windows[window_count++] = (int)value;
+        if (*end == ',') end++;
+        else if (*end) return false;
+        p = end;
+    }
+    return window_count > 0;
+}
+
+// Функция для разбора списка имен через запятую в отметки selected
+static bool parse_names(char *text, const char **names, int count, bool *selected) {
+    memset(selected, 0, count * sizeof(bool));
+    for (char *name = strtok(text, ","); name; name = strtok(NULL, ",")) {
+        int found = -1;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(name, names[i]) == 0) found = i;
+        }
+        if (found < 0) {
+            fprintf(stderr, "Error: Unknown name '%s'\n", name);
+            return false;
+        }
+        selected[found] = true;
+    }
+    return true;
+}
+
+// Функция для вывода справки
+void print_usage(const char *program_name) {
+    printf("Usage: %s [-n <size>] [-w <windows>] [-d <distributions>] [-a <kernels>] [-r <repeats>] [-c <csv>]\n", program_name);
+    printf("Options (lists are comma-separated):\n");
+    printf("  -n <size>           Side of the square matrix (default: 256)\n");
+    printf("  -w <windows>        Window sizes (default: 3,5,7,9)\n");
+    printf("  -d <distributions>  random, constant, sorted, salt-pepper (default: all)\n");
+    printf("  -a <kernels>        sort, histogram, bitplane, network-scalar, network-sse4.1, network-avx2,\n");
+    printf("                      network-avx512 (default: all supported)\n");
+    printf("  -r <repeats>        Timed runs per point, the median is reported (default: 5)\n");
+    printf("  -c <csv>            Write results as CSV\n");
+}
+
+// Функция для парсинга аргументов командной строки
+bool parse_arguments(int argc, char **argv) {
+    const char *kernel_names[KERNEL_COUNT];
+    for (int i = 0; i < KERNEL_COUNT; i++) kernel_names[i] = all_kernels[i].name;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:d:a:r:c:")) != -1) {
+        switch (opt) {
+            case 'n':
+                size = atoi(optarg);
+                if (size <= 0) {
+                    fprintf(stderr, "Error: Matrix size must be positive\n");
+                    return false;
+                }
+                break;
+            case 'w':
+                if (!parse_windows(optarg)) {
+                    fprintf(stderr, "Error: Window sizes must be positive and odd\n");
+                    return false;
+                }
+                break;
+            case 'd':
+                if (!parse_names(optarg, distribution_names, DIST_COUNT, distributions)) return false;
+                break;
+            case 'a':
+                if (!parse_names(optarg, kernel_names, KERNEL_COUNT, kernels)) return false;
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                if (repeats <= 0) {
+                    fprintf(stderr, "Error: Repeats must be positive\n");
+                    return false;
+                }
+                break;
+            case 'c':
+                csv_file = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!parse_arguments(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    FILE *csv = NULL;
+    if (csv_file) {
+        csv = fopen(csv_file, "w");
+        if (!csv) {
+            fprintf(stderr, "Error: Cannot create file %s\n", csv_file);
+            return 1;
+        }
+        fprintf(csv, "distribution,window,kernel,ns_per_pixel,cycles_per_pixel,correct\n");
+    }
+    
+    double *times = malloc(repeats * sizeof(double));
+    double *cycles = malloc(repeats * sizeof(double));
+    if (!times || !cycles) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return 1;
+    }
+    
+    printf("Matrix: %dx%d, repeats: %d (cycles are TSC reference cycles)\n", size, size, repeats);
+    printf("%-12s %6s %-15s %12s %14s %8s\n", "distribution", "window", "kernel", "ns/pixel", "cycles/pixel", "check");
+    
+    simd_level_t supported = detect_simd_level();
+    scratch_arena_t scratch = { NULL, 0, 0 };
+    bool failed = false;
+    for (int d = 0; d < DIST_COUNT; d++) {
+        if (!distributions[d]) continue;
+        for (int w = 0; w < window_count; w++) {
+            int window_size = windows[w];
+            int r = window_size / 2;
+            if (size <= 2 * r) continue;
+            long pixels = (long)(size - 2 * r) * (size - 2 * r);
+    
+            matrix_t *src = create_matrix(size, size, r);
+            matrix_t *levels_src = create_matrix(size, size, r);
+            matrix_t *reference = create_matrix(size, size, r);
+            matrix_t *dst = create_matrix(size, size, r);
+            if (!src || !levels_src || !reference || !dst) {
+                fprintf(stderr, "Error: Memory allocation failed for matrices\n");
+                return 1;
+            }
+            fill_distribution(src, (distribution_t)d);
+            for (int y = 0; y < size; y++) memset(MATRIX_ROW(dst, y), 0, size * sizeof(int));
+    
+            // Гистограммное ядро считает в номерах уровней, подготовка не замеряется
+            value_levels_t levels;
+            bool has_levels = build_value_levels(src, &levels);
+            for (int y = 0; y < size; y++) {
+                memcpy(MATRIX_ROW(levels_src, y), MATRIX_ROW(src, y), size * sizeof(int));
+            }
+            if (has_levels) matrix_to_levels(levels_src, &levels);
+    
+            if (!reserve_kernel_scratch(&scratch, ALGO_SORT, window_size, 0, size)) return 1;
+            apply_median_filter_iteration(src, reference, window_size, RANK_MEDIAN, &scratch,
+                                          r, size - r, r, size - r);
+    
+            for (int k = 0; k < KERNEL_COUNT; k++) {
+                const micro_kernel_t *kernel = &all_kernels[k];
+                if (!kernels[k]) continue;
+                if (kernel->algorithm == ALGO_NETWORK &&
+                    (kernel->simd > supported || (window_size != 3 && window_size != 5 && window_size != 7))) continue;
+                if (uses_levels(kernel->algorithm) && !has_levels) continue;
+    
+                const matrix_t *input = uses_levels(kernel->algorithm) ? levels_src : src;
+                if (!reserve_kernel_scratch(&scratch, kernel->algorithm, window_size, levels.count, size)) return 1;
+                bool ran = true;
+                for (int i = 0; i < repeats && ran; i++) {
+                    double start = get_time_ns();
+                    unsigned long long start_cycles = __rdtsc();
+                    ran = run_kernel(kernel, input, dst, window_size, levels.count, &scratch);
+                    cycles[i] = (double)(__rdtsc() - start_cycles) / pixels;
+                    times[i] = (get_time_ns() - start) / pixels;
+                }
+                // Ядро отказалось считать: замеров нет, запуск считается ошибкой
+                if (!ran) {
+                    failed = true;
+                    printf("%-12s %6d %-15s %12s %14s %8s\n", distribution_names[d], window_size,
+                           kernel->name, "-", "-", "FAILED");
+                    if (csv) fprintf(csv, "%s,%d,%s,,,0\n", distribution_names[d], window_size, kernel->name);
+                    fflush(stdout);
+                    continue;
+                }
+                qsort(times, repeats, sizeof(double), compare_doubles);
+                qsort(cycles, repeats, sizeof(double), compare_doubles);
+    
+                if (uses_levels(kernel->algorithm)) matrix_from_levels(dst, &levels);
+                bool correct = same_interior(dst, reference, window_size);
+                failed |= !correct;
+    
+                printf("%-12s %6d %-15s %12.2f %14.2f %8s\n", distribution_names[d], window_size,
+                       kernel->name, times[repeats / 2], cycles[repeats / 2], correct ? "ok" : "MISMATCH");
+                if (csv) {
+                    fprintf(csv, "%s,%d,%s,%.3f,%.3f,%d\n", distribution_names[d], window_size,
+                            kernel->name, times[repeats / 2], cycles[repeats / 2], correct);
+                }
+                fflush(stdout);
+            }
+    
+            if (has_levels) free(levels.values);
+            free_matrix(src);
+            free_matrix(levels_src);
+            free_matrix(reference);
+            free_matrix(dst);
+        }
+    }
+    
+    scratch_free(&scratch);
+    free(times);
+    free(cycles);
+    if (csv && fclose(csv) != 0) {
+        fprintf(stderr, "Error: Cannot write file %s\n", csv_file);
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
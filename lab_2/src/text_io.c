@@ -0,0 +1,659 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <emmintrin.h>
+
+#include "../include/text_io.h"
+
+// Размер блока классификации символов и буфера записи потока
+#define TEXT_BLOCK 64
+#define TEXT_WRITE_BUFFER (1 << 20)
+
+// Максимальная длина числа int в тексте вместе с разделителем
+#define TEXT_INT_MAX_LENGTH 12
+
+// Часть файла для разбора одним потоком
+typedef struct {
+    size_t begin;
+    size_t end;
+    size_t first;   // номер первого значения части
+    size_t count;   // значений в части
+    bool error;
+} text_chunk_t;
+
+// Задание разбора: части файла и матрица назначения
+typedef struct {
+    const text_matrix_t *text;
+    text_chunk_t *chunks;
+    int *data;
+    int stride;
+} text_parse_job_t;
+
+// Полоса строк для форматирования одним потоком
+typedef struct {
+    int row_begin;
+    int row_end;
+    size_t offset;  // смещение полосы в файле
+    size_t length;
+    bool error;
+} text_band_t;
+
+// Задание записи: полосы строк, файл и исходная матрица
+typedef struct {
+    text_band_t *bands;
+    const int *data;
+    int cols;
+    int stride;
+    int fd;
+} text_write_job_t;
+
+// Функция для запуска задачи на потоках пула или в вызывающем потоке
+static void run_task(thread_pool_t *pool, thread_pool_task_t task, void *arg) {
+    if (pool) {
+        thread_pool_run(pool, task, arg);
+    } else {
+        task(arg, 0);
+    }
+}
+
+// Функция для классификации 64 байт: биты символов чисел (цифры и '-')
+// и пробельных символов, по 16 байт за инструкцию SSE2
+static inline void classify_block(const char *p, uint64_t *number, uint64_t *space) {
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    uint64_t n = 0, s = 0;
+    for (int i = 0; i < TEXT_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i d = _mm_sub_epi8(v, zero);
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        __m128i minus = _mm_cmpeq_epi8(v, _mm_set1_epi8('-'));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+        n |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_or_si128(digit, minus)) << i;
+        s |= (uint64_t)(unsigned)_mm_movemask_epi8(ws) << i;
+    }
+    *number = n;
+    *space = s;
+}
+
+// Функция для классификации блока с позиции pos: неполный последний
+// блок дополняется пробелами
+static inline void classify_at(const char *text, size_t pos, size_t end,
+                               uint64_t *number, uint64_t *space) {
+    if (end - pos >= TEXT_BLOCK) {
+        classify_block(text + pos, number, space);
+        return;
+    }
+    char tail[TEXT_BLOCK];
+    memset(tail, ' ', sizeof(tail));
+    memcpy(tail, text + pos, end - pos);
+    classify_block(tail, number, space);
+}
+
+// Функция для проверки пробельного символа
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Функция для разбора числа с позиции pos: после числа должен идти
+// пробельный символ или конец части
+static bool parse_int(const char *text, size_t pos, size_t end, int *value) {
+    bool negative = text[pos] == '-';
+    if (negative) pos++;
+    
+    long long result = 0;
+    size_t digits = 0;
+    while (pos < end && (unsigned)(text[pos] - '0') < 10) {
+        result = result * 10 + (text[pos] - '0');
+        if (++digits > 10) return false;
+        pos++;
+    }
+    if (digits == 0) return false;
+    if (pos < end && !is_space(text[pos])) return false;
+    
+    if (negative) result = -result;
+    if (result < INT_MIN || result > INT_MAX) return false;
+    *value = (int)result;
+    return true;
+}
+
+// Функция для быстрого разбора числа до 7 цифр: 8 байт читаются разом,
+// длина числа определяется по первому байту-не-цифре, цифры собираются
+// умножениями (SWAR). Длинные числа и конец части разбираются parse_int.
+// Заемы и переносы между байтами идут только от байтов-не-цифр к старшим,
+// то есть не портят цифры перед первым таким байтом
+static inline bool parse_token(const char *text, size_t pos, size_t end, int *value) {
+    bool negative = text[pos] == '-';
+    size_t p = pos + negative;
+    if (end - p >= 8) {
+        uint64_t x;
+        memcpy(&x, text + p, 8);
+        uint64_t t = x - 0x3030303030303030ull;
+        uint64_t nondigit = ((t + 0x7676767676767676ull) | t) & 0x8080808080808080ull;
+        if (nondigit) {
+            int length = __builtin_ctzll(nondigit) >> 3;
+            if (length == 0 || !is_space(text[p + length])) return false;
+            t <<= (8 - length) * 8;
+            t = t * 10 + (t >> 8);
+            t = (((t & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+                 (((t >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+            *value = negative ? -(int)t : (int)t;
+            return true;
+        }
+    }
+    return parse_int(text, pos, end, value);
+}
+
+// Функция первого прохода: подсчет чисел части (начал серий символов чисел)
+// и проверка, что в ней нет посторонних символов
+static void count_task(void *arg, int thread_id) {
+    text_parse_job_t *job = (text_parse_job_t*)arg;
+    text_chunk_t *chunk = &job->chunks[thread_id];
+    const char *text = job->text->text;
+    
+    uint64_t carry = 0;
+    size_t count = 0;
+    for (size_t pos = chunk->begin; pos < chunk->end; pos += TEXT_BLOCK) {
+        uint64_t number, space;
+        classify_at(text, pos, chunk->end, &number, &space);
+        if (~(number | space)) {
+            chunk->error = true;
+            return;
+        }
+        uint64_t starts = number & ~((number << 1) | carry);
+        count += __builtin_popcountll(starts);
+        carry = number >> 63;
+    }
+    chunk->count = count;
+}
+
+// Функция второго прохода: разбор чисел части прямо в строки матрицы
+static void parse_task(void *arg, int thread_id) {
+    text_parse_job_t *job = (text_parse_job_t*)arg;
+    text_chunk_t *chunk = &job->chunks[thread_id];
+    const text_matrix_t *matrix = job->text;
+    const char *text = matrix->text;
+    
+    size_t total = (size_t)matrix->rows * matrix->cols;
+    if (chunk->first >= total) return;
+    size_t left = total - chunk->first;
+    int row = (int)(chunk->first / matrix->cols);
+    int col = (int)(chunk->first % matrix->cols);
+    int *out = job->data + (ptrdiff_t)row * job->stride;
+    
+    uint64_t carry = 0;
+    for (size_t pos = chunk->begin; pos < chunk->end && left > 0; pos += TEXT_BLOCK) {
+        uint64_t number, space;
+        classify_at(text, pos, chunk->end, &number, &space);
+        uint64_t starts = number & ~((number << 1) | carry);
+        carry = number >> 63;
+    
+        while (starts && left > 0) {
+            size_t start = pos + __builtin_ctzll(starts);
+            starts &= starts - 1;
+            if (!parse_token(text, start, chunk->end, &out[col])) {
+                chunk->error = true;
+                return;
+            }
+            left--;
+            if (++col == matrix->cols) {
+                col = 0;
+                out += job->stride;
+            }
+        }
+    }
+}
+
+bool text_matrix_open(const char *filename, text_matrix_t *text) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: Invalid file format\n");
+        close(fd);
+        return false;
+    }
+    
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map file %s\n", filename);
+        return false;
+    }
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+    
+    text->text = mapping;
+    text->size = st.st_size;
+    
+    // Заголовок "rows cols": два числа после пробельных символов
+    int header[2];
+    size_t pos = 0;
+    for (int i = 0; i < 2; i++) {
+        while (pos < text->size && is_space(text->text[pos])) pos++;
+        if (pos == text->size || !parse_int(text->text, pos, text->size, &header[i]) || header[i] <= 0) {
+            fprintf(stderr, "Error: Invalid file format\n");
+            text_matrix_close(text);
+            return false;
+        }
+        while (pos < text->size && !is_space(text->text[pos])) pos++;
+    }
+    
+    text->rows = header[0];
+    text->cols = header[1];
+    text->body = pos;
+    return true;
+}
+
+bool text_matrix_parse(const text_matrix_t *text, int *data, int stride, thread_pool_t *pool) {
+    int parts = pool ? thread_pool_size(pool) : 1;
+    text_chunk_t *chunks = calloc(parts, sizeof(text_chunk_t));
+    if (!chunks) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return false;
+    }
+    
+    // Границы частей сдвигаются за ближайший перевод строки
+    size_t body = text->size - text->body;
+    size_t begin = text->body;
+    for (int i = 0; i < parts; i++) {
+        size_t end = text->body + (size_t)((double)body * (i + 1) / parts);
+        if (i == parts - 1) end = text->size;
+        if (end < begin) end = begin;
+        const char *newline = end < text->size ? memchr(text->text + end, '\n', text->size - end) : NULL;
+        if (i < parts - 1) end = newline ? (size_t)(newline - text->text) + 1 : text->size;
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+    
+    text_parse_job_t job = { .text = text, .chunks = chunks, .data = data, .stride = stride };
+    run_task(pool, count_task, &job);
+    
+    size_t total = 0;
+    bool error = false;
+    for (int i = 0; i < parts; i++) {
+        chunks[i].first = total;
+        total += chunks[i].count;
+        error |= chunks[i].error;
+    }
+    
+    if (!error && total >= (size_t)text->rows * text->cols) {
+        run_task(pool, parse_task, &job);
+        for (int i = 0; i < parts; i++) error |= chunks[i].error;
+    }
+    free(chunks);
+    
+    if (error) {
+        fprintf(stderr, "Error: Invalid data in matrix file\n");
+        return false;
+    }
+    if (total < (size_t)text->rows * text->cols) {
+        fprintf(stderr, "Error: Incomplete matrix data (%zu of %zu values)\n",
+                total, (size_t)text->rows * text->cols);
+        return false;
+    }
+    return true;
+}
+
+void text_matrix_close(text_matrix_t *text) {
+    munmap((void*)text->text, text->size);
+    text->text = NULL;
+}
+
+// Пары цифр 00..99 для форматирования по две цифры за шаг
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Степени десяти для подсчета цифр
+static const unsigned powers_of_10[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// Функция для подсчета длины числа в тексте без ветвлений: число цифр
+// оценивается по номеру старшего бита (log10(2) ~ 1233 / 4096)
+static inline size_t int_length(int value) {
+    unsigned u = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    unsigned estimate = (32 - __builtin_clz(u | 1)) * 1233 >> 12;
+    return (value < 0) + estimate + ((u | 1) >= powers_of_10[estimate]);
+}
+
+// Функция для записи числа в out, возвращает конец записанного:
+// длина известна заранее, цифры пишутся с конца парами
+static inline char* format_int(char *out, int value) {
+    unsigned u = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    char *end = out + int_length(value);
+    if (value < 0) *out = '-';
+    
+    char *p = end;
+    while (u >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * (u % 100), 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        memcpy(p - 2, digit_pairs + 2 * u, 2);
+    } else {
+        p[-1] = (char)('0' + u);
+    }
+    return end;
+}
+
+// Функция для записи всего буфера по смещению offset
+static bool write_all(int fd, const char *buffer, size_t length, size_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, buffer, length, offset);
+        if (written <= 0) return false;
+        buffer += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// Функция для записи всего буфера в текущую позицию (каналы без перемотки)
+static bool write_sequential(int fd, const char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, buffer, length);
+        if (written <= 0) return false;
+        buffer += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Функция первого прохода записи: длина текста полосы строк
+static void length_task(void *arg, int thread_id) {
+    text_write_job_t *job = (text_write_job_t*)arg;
+    text_band_t *band = &job->bands[thread_id];
+    size_t length = 0;
+    for (int y = band->row_begin; y < band->row_end; y++) {
+        const int *row = job->data + (ptrdiff_t)y * job->stride;
+        for (int x = 0; x < job->cols; x++) {
+            length += int_length(row[x]) + 1;
+        }
+    }
+    band->length = length;
+}
+
+// Функция второго прохода записи: форматирование полосы в буфер потока
+// и запись буфера в файл большими блоками
+static void format_task(void *arg, int thread_id) {
+    text_write_job_t *job = (text_write_job_t*)arg;
+    text_band_t *band = &job->bands[thread_id];
+    if (band->row_begin == band->row_end) return;
+    
+    char *buffer = malloc(TEXT_WRITE_BUFFER);
+    if (!buffer) {
+        band->error = true;
+        return;
+    }
+    
+    size_t offset = band->offset;
+    char *p = buffer;
+    for (int y = band->row_begin; y < band->row_end && !band->error; y++) {
+        const int *row = job->data + (ptrdiff_t)y * job->stride;
+        for (int x = 0; x < job->cols; x++) {
+            if (p - buffer > TEXT_WRITE_BUFFER - TEXT_INT_MAX_LENGTH) {
+                if (!write_all(job->fd, buffer, p - buffer, offset)) band->error = true;
+                offset += p - buffer;
+                p = buffer;
+            }
+            p = format_int(p, row[x]);
+            *p++ = x < job->cols - 1 ? ' ' : '\n';
+        }
+    }
+    if (!band->error && !write_all(job->fd, buffer, p - buffer, offset)) band->error = true;
+    free(buffer);
+}
+
+bool text_matrix_write(const char *filename, const int *data, int rows, int cols, int stride,
+                       thread_pool_t *pool) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        return false;
+    }
+
+    int parts = pool ? thread_pool_size(pool) : 1;
+    text_band_t *bands = calloc(parts, sizeof(text_band_t));
+    if (!bands) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        close(fd);
+        return false;
+    }
+    for (int i = 0; i < parts; i++) {
+        bands[i].row_begin = (int)((long)rows * i / parts);
+        bands[i].row_end = (int)((long)rows * (i + 1) / parts);
+    }
+
+    char header[32];
+    int header_length = snprintf(header, sizeof(header), "%d %d\n", rows, cols);
+    bool ok = write_all(fd, header, header_length, 0);
+
+    text_write_job_t job = { .bands = bands, .data = data, .cols = cols, .stride = stride, .fd = fd };
+    if (ok) {
+        run_task(pool, length_task, &job);
+        size_t offset = header_length;
+        for (int i = 0; i < parts; i++) {
+            bands[i].offset = offset;
+            offset += bands[i].length;
+        }
+        run_task(pool, format_task, &job);
+        for (int i = 0; i < parts; i++) ok &= !bands[i].error;
+    }
+
+    free(bands);
+    if (close(fd) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Cannot write file %s\n", filename);
+    return ok;
+}
+
+bool text_matrix_read_row(const text_matrix_t *text, size_t *pos, int *row) {
+    size_t p = *pos;
+    for (int x = 0; x < text->cols; x++) {
+        while (p < text->size && is_space(text->text[p])) p++;
+        if (p == text->size) {
+            fprintf(stderr, "Error: Incomplete matrix data\n");
+            return false;
+        }
+        if (!parse_token(text->text, p, text->size, &row[x])) {
+            fprintf(stderr, "Error: Invalid data in matrix file\n");
+            return false;
+        }
+        while (p < text->size && !is_space(text->text[p])) p++;
+    }
+    *pos = p;
+    return true;
+}
+
+struct text_writer {
+    int fd;
+    int cols;
+    char *buffer;
+    size_t used;
+    size_t offset;  // записано в файл
+    bool sequential; // чужой дескриптор: запись подряд, без закрытия
+    bool error;
+};
+
+// Функция для сброса буфера потоковой записи в файл
+static void text_writer_flush(text_writer_t *writer) {
+    if (!writer->error) {
+        bool written = writer->sequential
+            ? write_sequential(writer->fd, writer->buffer, writer->used)
+            : write_all(writer->fd, writer->buffer, writer->used, writer->offset);
+        if (!written) writer->error = true;
+    }
+    writer->offset += writer->used;
+    writer->used = 0;
+}
+
+// Функция для создания записи в дескриптор fd с заголовком "rows cols"
+static text_writer_t* create_writer(int fd, int rows, int cols, bool sequential) {
+    text_writer_t *writer = calloc(1, sizeof(text_writer_t));
+    char *buffer = malloc(TEXT_WRITE_BUFFER);
+    if (!writer || !buffer) {
+        free(writer);
+        free(buffer);
+        return NULL;
+    }
+    
+    writer->fd = fd;
+    writer->cols = cols;
+    writer->buffer = buffer;
+    writer->sequential = sequential;
+    writer->used = snprintf(buffer, TEXT_WRITE_BUFFER, "%d %d\n", rows, cols);
+    return writer;
+}
+
+text_writer_t* text_writer_open(const char *filename, int rows, int cols) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    text_writer_t *writer = fd >= 0 ? create_writer(fd, rows, cols, false) : NULL;
+    if (!writer) {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        if (fd >= 0) close(fd);
+    }
+    return writer;
+}
+
+text_writer_t* text_writer_fd(int fd, int rows, int cols) {
+    text_writer_t *writer = create_writer(fd, rows, cols, true);
+    if (!writer) fprintf(stderr, "Error: Memory allocation failed for matrix writer\n");
+    return writer;
+}
+
+bool text_writer_row(text_writer_t *writer, const int *row) {
+    for (int x = 0; x < writer->cols; x++) {
+        if (writer->used > TEXT_WRITE_BUFFER - TEXT_INT_MAX_LENGTH) {
+            text_writer_flush(writer);
+        }
+        char *p = format_int(writer->buffer + writer->used, row[x]);
+        *p++ = x < writer->cols - 1 ? ' ' : '\n';
+        writer->used = p - writer->buffer;
+    }
+    return !writer->error;
+}
+
+bool text_writer_close(text_writer_t *writer) {
+    text_writer_flush(writer);
+    bool ok = !writer->error;
+    if (!writer->sequential && close(writer->fd) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Cannot write matrix file\n");
+    free(writer->buffer);
+    free(writer);
+    return ok;
+}
+
+// Буфер чтения потока кадров: перед разбором числа в буфере остается
+// не меньше TEXT_STREAM_LOOKAHEAD байт (или конец потока), так что
+// число целиком лежит в буфере
+#define TEXT_STREAM_BUFFER (1 << 20)
+#define TEXT_STREAM_LOOKAHEAD 32
+
+struct text_stream {
+    int fd;
+    char *buffer;
+    size_t pos;
+    size_t size;
+    bool eof;
+};
+
+text_stream_t* text_stream_open(int fd) {
+    text_stream_t *stream = calloc(1, sizeof(text_stream_t));
+    char *buffer = malloc(TEXT_STREAM_BUFFER);
+    if (!stream || !buffer) {
+        fprintf(stderr, "Error: Memory allocation failed for matrix stream\n");
+        free(stream);
+        free(buffer);
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->buffer = buffer;
+    return stream;
+}
+
+// Функция для дочитывания потока, пока в буфере меньше need байт
+static bool text_stream_fill(text_stream_t *stream, size_t need) {
+    if (stream->size - stream->pos >= need || stream->eof) return true;
+    
+    memmove(stream->buffer, stream->buffer + stream->pos, stream->size - stream->pos);
+    stream->size -= stream->pos;
+    stream->pos = 0;
+    while (stream->size < need && !stream->eof) {
+        ssize_t got = read(stream->fd, stream->buffer + stream->size, TEXT_STREAM_BUFFER - stream->size);
+        if (got < 0) {
+            fprintf(stderr, "Error: Cannot read matrix stream\n");
+            return false;
+        }
+        if (got == 0) stream->eof = true;
+        stream->size += got;
+    }
+    return true;
+}
+
+// Функция для пропуска пробельных символов; false - поток кончился
+static bool text_stream_skip_space(text_stream_t *stream) {
+    for (;;) {
+        while (stream->pos < stream->size && is_space(stream->buffer[stream->pos])) stream->pos++;
+        if (stream->pos < stream->size) return true;
+        if (stream->eof || !text_stream_fill(stream, 1) || stream->pos == stream->size) return false;
+    }
+}
+
+// Функция для разбора очередного числа потока
+static bool text_stream_int(text_stream_t *stream, int *value) {
+    if (!text_stream_skip_space(stream)) {
+        fprintf(stderr, "Error: Incomplete matrix data\n");
+        return false;
+    }
+    if (!text_stream_fill(stream, TEXT_STREAM_LOOKAHEAD)) return false;
+    if (!parse_token(stream->buffer, stream->pos, stream->size, value)) {
+        fprintf(stderr, "Error: Invalid data in matrix stream\n");
+        return false;
+    }
+    while (stream->pos < stream->size && !is_space(stream->buffer[stream->pos])) stream->pos++;
+    return true;
+}
+
+bool text_stream_header(text_stream_t *stream, int *rows, int *cols, bool *end) {
+    *end = false;
+    if (!text_stream_skip_space(stream)) {
+        *end = true;
+        return false;
+    }
+    if (!text_stream_int(stream, rows) || !text_stream_int(stream, cols)) return false;
+    if (*rows <= 0 || *cols <= 0) {
+        fprintf(stderr, "Error: Invalid file format\n");
+        return false;
+    }
+    return true;
+}
+
+bool text_stream_read(text_stream_t *stream, int *data, int rows, int cols, int stride) {
+    for (int y = 0; y < rows; y++) {
+        int *row = data + (ptrdiff_t)y * stride;
+        for (int x = 0; x < cols; x++) {
+            if (!text_stream_int(stream, &row[x])) return false;
+        }
+    }
+    return true;
+}
+
+void text_stream_close(text_stream_t *stream) {
+    if (!stream) return;
+    free(stream->buffer);
+    free(stream);
+}
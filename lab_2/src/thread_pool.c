@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "../include/thread_pool.h"
+
+// Сколько проверок делает поток в ожидании, прежде чем уснуть:
+// при частых коротких запусках (малые матрицы, большое k) потоки
+// подхватывают задачу без системного вызова. Если потоков (вместе
+// с главным) больше, чем ядер, ожидание сразу засыпает
+#define THREAD_POOL_SPIN 4000
+
+// Каталог с описанием узлов NUMA
+#define NUMA_NODE_DIR "/sys/devices/system/node"
+
+struct thread_pool {
+    pthread_t *threads;
+    int num_threads;
+    int *cpus;                   // ядро потока (-1 - без привязки)
+    int *nodes;                  // узел NUMA ядра потока
+    int spin;                    // проверок перед засыпанием
+    bool timing;                 // учет времени в задачах
+    unsigned long long *busy_ns; // по потокам; последний - ожидание главного
+    
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;   // новый запуск или остановка
+    pthread_cond_t done_cond;    // все потоки завершили запуск
+    
+    thread_pool_task_t task;
+    void *arg;
+    atomic_uint generation;      // номер текущего запуска
+    atomic_int pending;          // потоков, еще не завершивших запуск
+    atomic_bool stop;
+};
+
+// Аргументы рабочего потока пула
+typedef struct {
+    thread_pool_t *pool;
+    int thread_id;
+} pool_worker_args_t;
+
+// Функция для получения времени CLOCK_MONOTONIC в наносекундах
+static unsigned long long pool_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+// Функция для ожидания запуска с номером, отличным от seen
+static unsigned wait_generation(thread_pool_t *pool, unsigned seen) {
+    for (int i = 0; i < pool->spin; i++) {
+        unsigned current = atomic_load_explicit(&pool->generation, memory_order_acquire);
+        if (current != seen) return current;
+        __builtin_ia32_pause();
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    unsigned current;
+    while ((current = atomic_load(&pool->generation)) == seen) {
+        pthread_cond_wait(&pool->start_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return current;
+}
+
+// Функция рабочего потока пула
+static void* pool_worker(void *_args) {
+    pool_worker_args_t args = *(pool_worker_args_t*)_args;
+    thread_pool_t *pool = args.pool;
+    free(_args);
+    
+    unsigned seen = 0;
+    for (;;) {
+        seen = wait_generation(pool, seen);
+        if (atomic_load(&pool->stop)) break;
+        
+        if (pool->timing) {
+            unsigned long long start = pool_now_ns();
+            pool->task(pool->arg, args.thread_id);
+            pool->busy_ns[args.thread_id] += pool_now_ns() - start;
+        } else {
+            pool->task(pool->arg, args.thread_id);
+        }
+        
+        // Последний завершивший поток будит ожидающий главный поток
+        if (atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_acq_rel) == 1) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done_cond);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return NULL;
+}
+
+// Узел NUMA: номер и доступные процессу ядра
+typedef struct {
+    int id;
+    int *cpus;
+    int count;
+} numa_node_t;
+
+// Функция для освобождения списка узлов
+static void free_numa_nodes(numa_node_t *nodes, int count) {
+    for (int i = 0; i < count; i++) free(nodes[i].cpus);
+    free(nodes);
+}
+
+// Функция для разбора списка ядер вида "0-3,8,10-11" с отбором
+// разрешенных процессу (allowed)
+static bool parse_cpulist(const char *list, const cpu_set_t *allowed, numa_node_t *node) {
+    node->cpus = NULL;
+    node->count = 0;
+    int capacity = 0;
+    
+    const char *p = list;
+    while (*p >= '0' && *p <= '9') {
+        char *end;
+        int first = (int)strtol(p, &end, 10);
+        int last = first;
+        if (*end == '-') last = (int)strtol(end + 1, &end, 10);
+        
+        for (int cpu = first; cpu <= last; cpu++) {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, allowed)) continue;
+            if (node->count == capacity) {
+                capacity = capacity ? 2 * capacity : 16;
+                int *cpus = realloc(node->cpus, capacity * sizeof(int));
+                if (!cpus) return false;
+                node->cpus = cpus;
+            }
+            node->cpus[node->count++] = cpu;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return true;
+}
+
+// Функция для сравнения узлов по номеру (для qsort)
+static int compare_nodes(const void *a, const void *b) {
+    return ((const numa_node_t*)a)->id - ((const numa_node_t*)b)->id;
+}
+
+// Функция для чтения топологии: узлы NUMA из NUMA_NODE_DIR с ядрами,
+// разрешенными процессу. Без NUMA (или sysfs) все ядра считаются одним
+// узлом 0. Возвращает число узлов с ядрами (0 при ошибке)
+static int read_numa_nodes(numa_node_t **result) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        fprintf(stderr, "Error: Cannot get CPU affinity of the process\n");
+        return 0;
+    }
+    
+    numa_node_t *nodes = NULL;
+    int count = 0, capacity = 0;
+    DIR *dir = opendir(NUMA_NODE_DIR);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        int id;
+        char tail;
+        if (sscanf(entry->d_name, "node%d%c", &id, &tail) != 1) continue;
+        
+        char path[512], list[4096];
+        snprintf(path, sizeof(path), NUMA_NODE_DIR "/%s/cpulist", entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (!file) continue;
+        bool read = fgets(list, sizeof(list), file) != NULL;
+        fclose(file);
+        if (!read) continue;
+        
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 8;
+            numa_node_t *grown = realloc(nodes, capacity * sizeof(numa_node_t));
+            if (!grown) break;
+            nodes = grown;
+        }
+        nodes[count].id = id;
+        if (!parse_cpulist(list, &allowed, &nodes[count])) {
+            free(nodes[count].cpus);
+            break;
+        }
+        // Узлы без доступных ядер (только память) пропускаем
+        if (nodes[count].count > 0) count++;
+        else free(nodes[count].cpus);
+    }
+    if (dir) closedir(dir);
+    
+    if (count == 0) {
+        char all[32];
+        snprintf(all, sizeof(all), "0-%d", CPU_SETSIZE - 1);
+        free(nodes);
+        nodes = malloc(sizeof(numa_node_t));
+        if (!nodes || !parse_cpulist(all, &allowed, &nodes[0]) || nodes[0].count == 0) {
+            if (nodes) free(nodes[0].cpus);
+            free(nodes);
+            fprintf(stderr, "Error: Cannot read CPU topology\n");
+            return 0;
+        }
+        nodes[0].id = 0;
+        count = 1;
+    }
+    
+    qsort(nodes, count, sizeof(numa_node_t), compare_nodes);
+    *result = nodes;
+    return count;
+}
+
+thread_pool_t* thread_pool_create(int num_threads) {
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+    if (!pool) {
+        fprintf(stderr, "Error: Memory allocation failed for thread pool\n");
+        return NULL;
+    }
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    pool->cpus = malloc(num_threads * sizeof(int));
+    pool->nodes = malloc(num_threads * sizeof(int));
+    pool->busy_ns = calloc(num_threads + 1, sizeof(unsigned long long));
+    if (!pool->threads || !pool->cpus || !pool->nodes || !pool->busy_ns) {
+        fprintf(stderr, "Error: Memory allocation failed for thread pool\n");
+        free(pool->threads);
+        free(pool->cpus);
+        free(pool->nodes);
+        free(pool->busy_ns);
+        free(pool);
+        return NULL;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pool->cpus[i] = -1;
+        pool->nodes[i] = -1;
+    }
+    
+    pool->spin = num_threads < sysconf(_SC_NPROCESSORS_ONLN) ? THREAD_POOL_SPIN : 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->stop, false);
+    
+    for (int i = 0; i < num_threads; i++) {
+        pool_worker_args_t *args = malloc(sizeof(pool_worker_args_t));
+        if (args) *args = (pool_worker_args_t){ .pool = pool, .thread_id = i };
+        if (!args || pthread_create(&pool->threads[i], NULL, pool_worker, args) != 0) {
+            fprintf(stderr, "Error: Cannot create thread %d\n", i);
+            free(args);
+            pool->num_threads = i;
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+        pool->num_threads = i + 1;
+    }
+    return pool;
+}
+
+// Функция для ожидания главным потоком завершения запуска
+static void wait_done(thread_pool_t *pool) {
+    for (int i = 0; i < pool->spin; i++) {
+        if (atomic_load_explicit(&pool->pending, memory_order_acquire) == 0) return;
+        __builtin_ia32_pause();
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) != 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_run(thread_pool_t *pool, thread_pool_task_t task, void *arg) {
+    unsigned long long start = pool->timing ? pool_now_ns() : 0;
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    atomic_store(&pool->pending, pool->num_threads);
+    atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->lock);
+    
+    wait_done(pool);
+    if (pool->timing) pool->busy_ns[pool->num_threads] += pool_now_ns() - start;
+}
+
+int thread_pool_size(const thread_pool_t *pool) {
+    return pool->num_threads;
+}
+
+bool thread_pool_place(thread_pool_t *pool, pool_placement_t placement) {
+    if (placement == POOL_PLACE_NONE) return true;
+    
+    numa_node_t *nodes;
+    int node_count = read_numa_nodes(&nodes);
+    if (node_count == 0) return false;
+    
+    int total = 0;
+    for (int n = 0; n < node_count; n++) total += nodes[n].count;
+    
+    bool ok = true;
+    for (int i = 0; i < pool->num_threads; i++) {
+        // compact: i-е ядро в порядке узлов; scatter: узлы по кругу,
+        // внутри узла ядра по порядку. Лишние потоки идут на второй круг
+        int node, index;
+        if (placement == POOL_PLACE_SCATTER) {
+            node = i % node_count;
+            index = (i / node_count) % nodes[node].count;
+        } else {
+            index = i % total;
+            for (node = 0; index >= nodes[node].count; node++) index -= nodes[node].count;
+        }
+        
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(nodes[node].cpus[index], &set);
+        if (pthread_setaffinity_np(pool->threads[i], sizeof(set), &set) != 0) {
+            fprintf(stderr, "Error: Cannot pin thread %d to CPU %d\n", i, nodes[node].cpus[index]);
+            ok = false;
+            break;
+        }
+        pool->cpus[i] = nodes[node].cpus[index];
+        pool->nodes[i] = nodes[node].id;
+    }
+    
+    free_numa_nodes(nodes, node_count);
+    return ok;
+}
+
+void thread_pool_print_layout(const thread_pool_t *pool) {
+    numa_node_t *nodes;
+    int node_count = read_numa_nodes(&nodes);
+    if (node_count == 0) return;
+    
+    printf("NUMA nodes: %d (", node_count);
+    for (int n = 0; n < node_count; n++) {
+        printf("%snode%d: %d CPUs", n ? ", " : "", nodes[n].id, nodes[n].count);
+    }
+    printf(")\nThread CPUs:");
+    for (int i = 0; i < pool->num_threads; i++) {
+        if (pool->cpus[i] < 0) printf(" %d->any", i);
+        else printf(" %d->cpu%d/node%d", i, pool->cpus[i], pool->nodes[i]);
+    }
+    printf("\n");
+    free_numa_nodes(nodes, node_count);
+}
+
+void thread_pool_set_timing(thread_pool_t *pool, bool enabled) {
+    memset(pool->busy_ns, 0, (pool->num_threads + 1) * sizeof(unsigned long long));
+    pool->timing = enabled;
+}
+
+unsigned long long thread_pool_busy_ns(const thread_pool_t *pool, int thread_id) {
+    return pool->busy_ns[thread_id];
+}
+
+void thread_pool_destroy(thread_pool_t *pool) {
+    if (!pool) return;
+    
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->stop, true);
+    atomic_fetch_add(&pool->generation, 1);
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->cpus);
+    free(pool->nodes);
+    free(pool->busy_ns);
+    free(pool);
+}